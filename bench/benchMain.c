@@ -0,0 +1,321 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <SDL.h>
+#include <SDL_net.h>
+#include <stdatomic.h>
+#include "../src/defs.h"
+#include "../src/crypto.h"
+#include "../src/net.h"
+#include "../src/transport.h"
+#include "../test/testServer.h"
+
+// Drives the real net module through the stand-in server on the loopback interface & reports how fast the whole
+// pipeline (packing, encryption, framing, the outbox, the reading & the decryption) goes: the handshake latency,
+// messages per second & the file transfer throughput. The other side is played first by the stand-in server's
+// stand-in peers, then by a second real client, whose messages the server relays. Everything is measured once per
+// transport, the in-memory one shows the cost of the pipeline itself, without the sockets' overhead
+
+STATIC_CONST_UNSIGNED BASE_PORT = 8180;
+STATIC_CONST_UNSIGNED MAX_MESSAGE_SIZE = 1 << 16; // the largest negotiable one
+STATIC_CONST_UNSIGNED HANDSHAKES = 10;
+STATIC_CONST_UNSIGNED MESSAGES = 20000;
+STATIC_CONST_UNSIGNED MESSAGE_SIZE = 160; // a typical text message once encrypted for the conversation
+STATIC_CONST_UNSIGNED ECHOES = 2000; // round trips
+STATIC_CONST_UNSIGNED FILE_SIZE = 1 << 26; // 64 mb
+STATIC_CONST_UNSIGNED PEER = 2;
+STATIC_CONST_UNSIGNED WAIT_TIMEOUT = 60000; // in milliseconds
+
+static atomic bool connectionFinished = false, connected = false, loggedIn = false;
+static atomic unsigned echoes = 0, relayedMessages = 0, invitedTransferId = 0;
+static atomic int transferResult = 0, receivedTransferResult = 0; // 1 - sent (received), -1 - failed
+static atomic unsigned long connectedAt = 0; // in performance counter ticks
+static atomic unsigned long receivedFileBytes = 0;
+static NetConnection* atomic connection = NULL;
+static NetConnection* atomic receiver = NULL; // the second client, the first one talks to it through the server
+static const Transport* transport = &TRANSPORT_SDL;
+static const char* transportName = "";
+static unsigned basePort = 0; // each transport uses its own ports as the previous ones may still linger in TIME_WAIT
+
+static void onMessageReceived(unsigned long, unsigned, const byte*, unsigned) { relayedMessages++; } // only the receiver gets them
+static void onLogInResult(bool successful) { loggedIn = successful; }
+static void onErrorReceived(int) {}
+static void onDisconnected(void) {}
+static unsigned long currentTimeMillis(void) { return SDL_GetTicks64(); }
+static void onBroadcastMessageReceived(const byte*, unsigned) { echoes++; }
+
+static void onConnected(bool successful) {
+    connectedAt = SDL_GetPerformanceCounter();
+    connected = successful;
+    connectionFinished = true;
+}
+
+static unsigned nextFileChunkSupplier(unsigned, unsigned index, byte* buffer, unsigned bufferSize, bool) {
+    const unsigned long offset = (unsigned long) index * bufferSize;
+    if (offset >= FILE_SIZE) return 0;
+
+    const unsigned size = (unsigned) min((unsigned long) bufferSize, FILE_SIZE - offset);
+    SDL_memset(buffer, (int) index, size);
+    return size;
+}
+
+static void onFileExchangeInviteReceived(unsigned transferId, unsigned, unsigned, const byte*, const char*, unsigned, bool) { invitedTransferId = transferId; } // accepted by the main thread
+static void nextFileChunkReceiver(unsigned, unsigned, unsigned receivedBytesCount, const byte*) { receivedFileBytes += receivedBytesCount; }
+
+static void onFileExchangeFinished(unsigned, bool successful) {
+    if (netCurrentConnection() == receiver)
+        receivedTransferResult = successful ? 1 : -1;
+    else
+        transferResult = successful ? 1 : -1;
+}
+
+static bool waitFor(bool (*condition)(void)) { // polls the condition, returns false on timeout
+    const unsigned long started = SDL_GetTicks64();
+    while (!(*condition)()) {
+        if (SDL_GetTicks64() - started > WAIT_TIMEOUT) return false;
+        SDL_Delay(1);
+    }
+    return true;
+}
+
+static bool isConnectionFinished(void) { return connectionFinished; }
+static bool isLoggedIn(void) { return loggedIn; }
+static bool areMessagesDelivered(void) { return testServer_messagesReceived(PEER) == MESSAGES; }
+static bool areEchoesReceived(void) { return echoes == ECHOES; }
+static bool isTransferFinished(void) { return transferResult != 0; }
+static bool areMessagesRelayed(void) { return relayedMessages == MESSAGES; }
+static bool isInvited(void) { return invitedTransferId != 0; }
+static bool isRelayedTransferFinished(void) { return transferResult != 0 && receivedTransferResult != 0; }
+
+static inline double secondsSince(unsigned long started)
+{ return (double) (SDL_GetPerformanceCounter() - started) / (double) SDL_GetPerformanceFrequency(); }
+
+static bool connectTo(NetConnection* atomic* slot, unsigned port, double* nullable handshakeSeconds) { // returns false on failure, the connection is left for the caller to clean up
+    connectionFinished = connected = loggedIn = false;
+    const unsigned long started = SDL_GetPerformanceCounter();
+
+    assert(netInit(
+        slot,
+        "127.0.0.1", port, transport,
+        testServer_signPublicKey(), CRYPTO_KEY_SIZE,
+        &onMessageReceived,
+        &onLogInResult,
+        &onErrorReceived,
+        NULL,
+        &onDisconnected,
+        &currentTimeMillis,
+        NULL, NULL, NULL,
+        &onFileExchangeInviteReceived,
+        &nextFileChunkSupplier,
+        &nextFileChunkReceiver,
+        &onFileExchangeFinished,
+        NULL, NULL, NULL,
+        &onBroadcastMessageReceived,
+        &onConnected,
+        NULL
+    ));
+
+    if (!waitFor(&isConnectionFinished) || !connected) return false;
+
+    if (handshakeSeconds) *handshakeSeconds = (double) (connectedAt - started) / (double) SDL_GetPerformanceFrequency();
+    return true;
+}
+
+static bool connectClient(unsigned port, double* nullable handshakeSeconds) { // starts the stand-in server & connects to it, returns false on failure
+    testServer_start(port, MAX_MESSAGE_SIZE, true, transport == &TRANSPORT_MEMORY);
+    if (connectTo(&connection, port, handshakeSeconds)) return true;
+
+    netClean(connection); // a failed connection waits for its owner to clean it up too
+    testServer_stop();
+    return false;
+}
+
+static void disconnectClient(void) {
+    netClean(connection);
+    testServer_stop();
+}
+
+static bool logIn(NetConnection* xConnection) {
+    char username[NET_USERNAME_SIZE], password[NET_UNHASHED_PASSWORD_SIZE];
+    SDL_memset(username, 'u', sizeof username);
+    SDL_memset(password, 'p', sizeof password);
+
+    loggedIn = false;
+    netLogIn(xConnection, username, password);
+    return waitFor(&isLoggedIn);
+}
+
+static void benchmarkHandshakes(void) { // the whole connection: the key exchange, the secure streams' setup & the negotiation
+    double total = 0, worst = 0;
+
+    for (unsigned i = 0; i < HANDSHAKES; i++) {
+        double elapsed = 0;
+        if (!connectClient(basePort + i, &elapsed)) {
+            SDL_Log("%s handshake: failed", transportName);
+            return;
+        }
+
+        total += elapsed;
+        worst = elapsed > worst ? elapsed : worst;
+        disconnectClient();
+    }
+
+    SDL_Log("%s handshake: %.2f ms on average, %.2f ms at worst", transportName, total / HANDSHAKES * 1000, worst * 1000);
+}
+
+static void benchmarkMessages(void) { // one way, from the client to a stand-in peer, then round trips through the server
+    if (!connectClient(basePort + HANDSHAKES, NULL)) return;
+    if (!logIn(connection)) {
+        SDL_Log("%s messages: unable to log in", transportName);
+        disconnectClient();
+        return;
+    }
+
+    byte message[MESSAGE_SIZE];
+    SDL_memset(message, 0xa5, sizeof message);
+
+    unsigned long started = SDL_GetPerformanceCounter();
+    for (unsigned i = 0; i < MESSAGES; i++)
+        assert(netSend(connection, NET_FLAG_PROCEED, message, sizeof message, PEER));
+
+    if (waitFor(&areMessagesDelivered)) {
+        const double elapsed = secondsSince(started);
+        SDL_Log("%s messages: %.0f messages/s one way, %.2f MB/s", transportName, MESSAGES / elapsed, (double) MESSAGES * MESSAGE_SIZE / elapsed / (1 << 20));
+    } else
+        SDL_Log("%s messages: delivered only %u of %u", transportName, testServer_messagesReceived(PEER), MESSAGES);
+
+    echoes = 0;
+    started = SDL_GetPerformanceCounter();
+    for (unsigned i = 0; i < ECHOES; i++) { // one at a time, so each one takes a round trip
+        const unsigned expected = echoes + 1;
+        netSendBroadcast(connection, message, sizeof message);
+        while (echoes < expected && secondsSince(started) * 1000 < WAIT_TIMEOUT);
+    }
+
+    if (waitFor(&areEchoesReceived)) {
+        const double elapsed = secondsSince(started);
+        SDL_Log("%s messages: %.0f round trips/s, %.3f ms per round trip", transportName, ECHOES / elapsed, elapsed / ECHOES * 1000);
+    } else
+        SDL_Log("%s messages: echoed only %u of %u", transportName, echoes, ECHOES);
+
+    NetStats stats;
+    netStats(connection, &stats);
+    SDL_Log("%s messages: %lu us encrypting, %lu us decrypting", transportName, stats.encryptionMicros, stats.decryptionMicros);
+
+    disconnectClient();
+}
+
+static void benchmarkFileTransfer(void) { // to a stand-in peer which acknowledges the chunks, as large as the negotiated message size allows
+    if (!connectClient(basePort + HANDSHAKES + 1, NULL)) return;
+    if (!logIn(connection)) {
+        SDL_Log("%s file: unable to log in", transportName);
+        disconnectClient();
+        return;
+    }
+
+    byte hash[CRYPTO_HASH_SIZE];
+    SDL_memset(hash, 0, sizeof hash);
+    transferResult = 0;
+
+    const unsigned long started = SDL_GetPerformanceCounter();
+    assert(netBeginFileExchange(connection, netNextFileTransferId(connection), PEER, FILE_SIZE, hash, "file", 4, false));
+
+    if (waitFor(&isTransferFinished) && transferResult == 1) {
+        const double elapsed = secondsSince(started);
+        SDL_Log("%s file: %.2f MB/s, %u bytes received by the peer", transportName, FILE_SIZE / elapsed / (1 << 20), testServer_fileBytesReceived(PEER));
+    } else
+        SDL_Log("%s file: the transfer has failed", transportName);
+
+    disconnectClient();
+}
+
+static void benchmarkClientToClient(void) { // the same one way messages & file, but to a real client through the server, so the receiving side's decryption & acknowledgements are included
+    if (transport == &TRANSPORT_MEMORY) { // the stand-in server takes a single client in memory
+        SDL_Log("%s client to client: skipped", transportName);
+        return;
+    }
+
+    const unsigned port = basePort + HANDSHAKES + 2;
+    if (!connectClient(port, NULL)) return;
+
+    if (!logIn(connection) || !connectTo(&receiver, port, NULL) || !logIn(receiver)) {
+        SDL_Log("%s client to client: unable to connect & log in both clients", transportName);
+        if (receiver) netClean(receiver);
+        disconnectClient();
+        return;
+    }
+    const unsigned to = netCurrentUserId(receiver);
+
+    byte message[MESSAGE_SIZE];
+    SDL_memset(message, 0xa5, sizeof message);
+    relayedMessages = 0;
+
+    unsigned long started = SDL_GetPerformanceCounter();
+    for (unsigned i = 0; i < MESSAGES; i++)
+        assert(netSend(connection, NET_FLAG_PROCEED, message, sizeof message, to));
+
+    if (waitFor(&areMessagesRelayed)) {
+        const double elapsed = secondsSince(started);
+        SDL_Log("%s client to client: %.0f messages/s one way, %.2f MB/s", transportName, MESSAGES / elapsed, (double) MESSAGES * MESSAGE_SIZE / elapsed / (1 << 20));
+    } else
+        SDL_Log("%s client to client: delivered only %u of %u messages", transportName, relayedMessages, MESSAGES);
+
+    byte hash[CRYPTO_HASH_SIZE];
+    SDL_memset(hash, 0, sizeof hash);
+    transferResult = receivedTransferResult = 0;
+    invitedTransferId = 0;
+    receivedFileBytes = 0;
+
+    started = SDL_GetPerformanceCounter();
+    assert(netBeginFileExchange(connection, netNextFileTransferId(connection), to, FILE_SIZE, hash, "file", 4, false));
+
+    if (waitFor(&isInvited) && netReplyToFileExchangeInvite(receiver, invitedTransferId, true) && waitFor(&isRelayedTransferFinished) && transferResult == 1 && receivedTransferResult == 1) {
+        const double elapsed = secondsSince(started);
+        SDL_Log("%s client to client: %.2f MB/s file, %lu bytes received", transportName, FILE_SIZE / elapsed / (1 << 20), receivedFileBytes);
+    } else
+        SDL_Log("%s client to client: the file transfer has failed", transportName);
+
+    netClean(receiver);
+    disconnectClient();
+}
+
+int main(void) {
+    assert(!SDL_Init(SDL_INIT_TIMER));
+    cryptoInit();
+    SDLNet_Init();
+
+    const Transport* transports[] = {&TRANSPORT_SDL, &TRANSPORT_NATIVE, &TRANSPORT_MEMORY};
+    const char* transportNames[] = {"sdl_net", "native", "memory"};
+
+    for (unsigned i = 0; i < 3; i++) {
+        transport = transports[i];
+        transportName = transportNames[i];
+        basePort = BASE_PORT + i * (HANDSHAKES + 3);
+
+        benchmarkHandshakes();
+        benchmarkMessages();
+        benchmarkFileTransfer();
+        benchmarkClientToClient();
+    }
+
+    SDLNet_Quit();
+    cryptoClean();
+    SDL_Quit();
+    return 0;
+}
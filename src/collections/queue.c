@@ -17,40 +17,70 @@
  */
 
 #include <SDL_stdinc.h>
+#include <SDL_mutex.h>
 #include <assert.h>
 #include <stdbool.h>
 #include "../utils/rwMutex.h"
 #include "queue.h"
 
 STATIC_CONST_UNSIGNED VOID_PTR_SIZE = sizeof(void*);
+STATIC_CONST_UNSIGNED INITIAL_CAPACITY = 8;
 
 struct Queue_t {
-    void** values;
+    void** values; // a ring buffer which grows when gets full, so pushes and pops don't reallocate it every time
+    unsigned capacity;
+    unsigned head; // index of the top value
     atomic unsigned size;
     QueueDeallocator nullable deallocator;
     RWMutex* rwMutex;
     atomic bool destroyed;
     QueueCurrentTimeMillisGetter nullable currentTimeMillisGetter;
+    SDL_mutex* waitMutex; // the waiters block on the condition till something is pushed, rather than spinning
+    SDL_cond* pushed;
 };
 
 Queue* queueInitExtra(QueueDeallocator nullable deallocator, QueueCurrentTimeMillisGetter nullable currentTimeMillisGetter) {
     Queue* queue = SDL_malloc(sizeof *queue);
     queue->values = NULL;
+    queue->capacity = 0;
+    queue->head = 0;
     queue->size = 0;
     queue->deallocator = deallocator;
     queue->rwMutex = rwMutexInit();
     queue->destroyed = false;
     queue->currentTimeMillisGetter = currentTimeMillisGetter;
+    queue->waitMutex = SDL_CreateMutex();
+    queue->pushed = SDL_CreateCond();
     return queue;
 }
 
+static inline unsigned valueIndex(const Queue* queue, unsigned position) { return (queue->head + position) % queue->capacity; }
+
+static void grow(Queue* queue) { // must be called with the mutex locked
+    const unsigned newCapacity = queue->capacity ? queue->capacity * 2 : INITIAL_CAPACITY;
+    void** newValues = SDL_malloc(newCapacity * VOID_PTR_SIZE);
+
+    for (unsigned i = 0; i < queue->size; i++) // unwraps the values so the top one is at the beginning
+        newValues[i] = queue->values[valueIndex(queue, i)];
+
+    SDL_free(queue->values);
+    queue->values = newValues;
+    queue->capacity = newCapacity;
+    queue->head = 0;
+}
+
 void queuePush(Queue* queue, const void* value) {
-    assert(queue && !queue->destroyed && queue->size < 0xfffffffe);
+    assert(queue && !queue->destroyed && queue->size < 0x7fffffff);
 
     RW_MUTEX_WRITE_LOCKED(queue->rwMutex,
-        queue->values = SDL_realloc(queue->values, ++(queue->size) * VOID_PTR_SIZE);
-        queue->values[queue->size - 1] = (void*) value;
+        if (queue->size == queue->capacity) grow(queue);
+        queue->values[valueIndex(queue, queue->size)] = (void*) value;
+        queue->size++;
     )
+
+    SDL_LockMutex(queue->waitMutex); // so the waiter either sees the value or gets woken up
+    SDL_CondSignal(queue->pushed);
+    SDL_UnlockMutex(queue->waitMutex);
 }
 
 void* queuePop(Queue* queue) {
@@ -58,39 +88,49 @@ void* queuePop(Queue* queue) {
     rwMutexWriteLock(queue->rwMutex);
     assert(queue->values);
 
-    void* value = queue->values[0];
+    void* value = queue->values[queue->head];
+    queue->head = valueIndex(queue, 1);
+    queue->size--;
 
-    const unsigned newSize = queue->size - 1;
-    if (!newSize) {
-        SDL_free(queue->values);
-        queue->values = NULL;
-        queue->size = 0;
-        rwMutexWriteUnlock(queue->rwMutex);
-        return value;
-    }
+    rwMutexWriteUnlock(queue->rwMutex);
+    return value;
+}
 
-    void** temp = SDL_malloc(newSize * VOID_PTR_SIZE);
-    SDL_memcpy(temp, &(queue->values[1]), newSize * VOID_PTR_SIZE);
+static bool tryPop(Queue* queue, void** value) { // returns false if the queue is empty
+    bool popped = false;
 
-    SDL_free(queue->values);
-    queue->values = temp;
-    queue->size = newSize;
+    RW_MUTEX_WRITE_LOCKED(queue->rwMutex,
+        if (queue->size) {
+            *value = queue->values[queue->head];
+            queue->head = valueIndex(queue, 1);
+            queue->size--;
+            popped = true;
+        }
+    )
 
-    rwMutexWriteUnlock(queue->rwMutex);
-    return value;
+    return popped;
 }
 
 void* nullable queueWaitAndPop(Queue* queue, int timeout) {
     assert(queue && !queue->destroyed);
     if (timeout >= 0) assert(queue->currentTimeMillisGetter);
 
-    const unsigned long startMillis = (*(queue->currentTimeMillisGetter))();
-
-    while (timeout >= 0 ? !queue->destroyed && (*(queue->currentTimeMillisGetter))() - startMillis < (unsigned long) timeout : true)
-        if (queueSize(queue)) // TODO: add mutex lock here
-            return queuePop(queue); // TODO: assert not null
+    const unsigned long deadline = timeout >= 0 ? (*(queue->currentTimeMillisGetter))() + (unsigned long) timeout : 0;
+    void* value = NULL;
+    unsigned long now;
+
+    SDL_LockMutex(queue->waitMutex);
+    while (!tryPop(queue, &value)) {
+        if (timeout < 0)
+            SDL_CondWait(queue->pushed, queue->waitMutex);
+        else if ((now = (*(queue->currentTimeMillisGetter))()) < deadline)
+            SDL_CondWaitTimeout(queue->pushed, queue->waitMutex, (unsigned) (deadline - now));
+        else
+            break;
+    }
+    SDL_UnlockMutex(queue->waitMutex);
 
-    return NULL;
+    return value;
 }
 
 void* nullable queuePeek(Queue* queue) {
@@ -99,7 +139,7 @@ void* nullable queuePeek(Queue* queue) {
 
     RW_MUTEX_READ_LOCKED(queue->rwMutex,
         if (queue->size)
-            result = queue->values[0];
+            result = queue->values[queue->head];
     )
 
     return result;
@@ -114,19 +154,17 @@ unsigned queueSize(const Queue* queue) {
 
 static void destroyValuesIfNotEmpty(Queue* queue) {
     if (!queue->deallocator) return;
-    assert(queue->size && queue->values || !(queue->size) && !(queue->values));
-    for (unsigned i = 0; i < queue->size; (*(queue->deallocator))(queue->values[i++]));
+    assert(!(queue->size) || queue->values);
+    for (unsigned i = 0; i < queue->size; (*(queue->deallocator))(queue->values[valueIndex(queue, i++)]));
 }
 
-void queueClear(Queue* queue) {
+void queueClear(Queue* queue) { // keeps the allocated capacity
     assert(queue && !queue->destroyed);
 
     RW_MUTEX_WRITE_LOCKED(queue->rwMutex,
         destroyValuesIfNotEmpty(queue);
         queue->size = 0;
-
-        SDL_free(queue->values);
-        queue->values = NULL;
+        queue->head = 0;
     )
 }
 
@@ -137,5 +175,7 @@ void queueDestroy(Queue* queue) {
     destroyValuesIfNotEmpty(queue);
     SDL_free(queue->values);
     rwMutexDestroy(queue->rwMutex);
+    SDL_DestroyCond(queue->pushed);
+    SDL_DestroyMutex(queue->waitMutex);
     SDL_free(queue);
 }
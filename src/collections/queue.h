@@ -33,7 +33,7 @@ inline Queue* queueInit(QueueDeallocator nullable deallocator)
 
 void queuePush(Queue* queue, const void* value);
 void* queuePop(Queue* queue); // returns stored value that must be deallocated by a caller as reference to the value gets deleted, the queue must not be empty
-void* nullable queueWaitAndPop(Queue* queue, int timeout); // works (blocks the caller thread) as the plain pop if the queue is not empty, waits until smth is pushed into it and then returns the newly pushed value if the queue is empty, timeout can be negative in which case the function will wait indefinitely, when timeout exceeds without receiving any value then null will be returned
+void* nullable queueWaitAndPop(Queue* queue, int timeout); // works (blocks the caller thread) as the plain pop if the queue is not empty, waits (without spinning) until smth is pushed into it and then returns the newly pushed value if the queue is empty, timeout can be negative in which case the function will wait indefinitely, when timeout exceeds without receiving any value then null will be returned (as well as when the pushed value is null)
 void* nullable queuePeek(Queue* queue); // returns the top value if the queue is not empty and null if it is but doesn't remove the top value
 void queueDropTop(Queue* queue); // drops the top value and deallocates it
 unsigned queueSize(const Queue* queue); // Queue is const here 'cause it's mutex isn't modified
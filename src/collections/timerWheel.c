@@ -0,0 +1,187 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <SDL_stdinc.h>
+#include <SDL_mutex.h>
+#include <assert.h>
+#include <limits.h>
+#include "timerWheel.h"
+
+STATIC_CONST_UNSIGNED SLOT_BITS = 6;
+STATIC_CONST_UNSIGNED SLOTS = 1 << SLOT_BITS; // 64 per level, a slot of the level i spans 64^i ticks
+STATIC_CONST_UNSIGNED LEVELS = 4; // 64^4 ticks = 16777216, which is 46 hours with 10 milliseconds long ticks; timers that are further get re-placed as the wheel turns
+STATIC_CONST_UNSIGNED NONE = 0xffffffff;
+
+typedef struct {
+    unsigned next; // in the same slot, the slot's timers make a doubly linked list so any one of them is unlinked in constant time
+    unsigned previous;
+    unsigned slot; // NONE if the timer isn't armed
+    unsigned long expiration; // in ticks
+} Timer;
+
+struct TimerWheel_t {
+    unsigned count;
+    unsigned resolution;
+    unsigned long tick; // the last processed one
+    unsigned armed;
+    unsigned heads[LEVELS * SLOTS]; // first timers of the slots
+    Timer* timers;
+    SDL_mutex* mutex;
+};
+
+TimerWheel* timerWheelInit(unsigned timers, unsigned resolution, unsigned long now) {
+    assert(timers > 0 && timers < NONE && resolution > 0);
+
+    TimerWheel* wheel = SDL_malloc(sizeof *wheel);
+    wheel->count = timers;
+    wheel->resolution = resolution;
+    wheel->tick = now / resolution;
+    wheel->armed = 0;
+    wheel->timers = SDL_malloc(timers * sizeof(Timer));
+    wheel->mutex = SDL_CreateMutex();
+
+    for (unsigned i = 0; i < LEVELS * SLOTS; wheel->heads[i++] = NONE);
+    for (unsigned i = 0; i < timers; wheel->timers[i++].slot = NONE);
+
+    return wheel;
+}
+
+static void attach(TimerWheel* wheel, unsigned index) { // these functions are called with the mutex locked; the timer must not have expired, if it expires in the current tick it's put into the slot which is being processed
+    Timer* timer = &(wheel->timers[index]);
+    assert(timer->expiration >= wheel->tick);
+
+    const unsigned long span = 1ul << (SLOT_BITS * LEVELS), delta = timer->expiration - wheel->tick;
+    const unsigned long placed = delta < span ? timer->expiration : wheel->tick + span - 1; // where it gets placed, the timers that are further than the wheel spans wait in the last slot
+
+    unsigned level = 0;
+    while (level < LEVELS - 1 && placed - wheel->tick >= 1ul << (SLOT_BITS * (level + 1))) level++;
+
+    timer->slot = level * SLOTS + (unsigned) ((placed >> (SLOT_BITS * level)) & (SLOTS - 1));
+    timer->previous = NONE;
+    timer->next = wheel->heads[timer->slot];
+
+    if (timer->next != NONE) wheel->timers[timer->next].previous = index;
+    wheel->heads[timer->slot] = index;
+}
+
+static void detach(TimerWheel* wheel, unsigned index) {
+    Timer* timer = &(wheel->timers[index]);
+    assert(timer->slot != NONE);
+
+    if (timer->previous != NONE) wheel->timers[timer->previous].next = timer->next;
+    else wheel->heads[timer->slot] = timer->next;
+
+    if (timer->next != NONE) wheel->timers[timer->next].previous = timer->previous;
+    timer->slot = NONE;
+}
+
+void timerWheelArm(TimerWheel* wheel, unsigned timer, unsigned long deadline) {
+    assert(wheel && timer < wheel->count);
+    SDL_LockMutex(wheel->mutex);
+
+    if (wheel->timers[timer].slot != NONE) detach(wheel, timer);
+    else wheel->armed++;
+
+    const unsigned long expiration = deadline / wheel->resolution + 1; // the first tick which begins after the deadline
+    wheel->timers[timer].expiration = expiration > wheel->tick ? expiration : wheel->tick + 1; // the current tick has been processed already
+    attach(wheel, timer);
+
+    SDL_UnlockMutex(wheel->mutex);
+}
+
+void timerWheelCancel(TimerWheel* wheel, unsigned timer) {
+    assert(wheel && timer < wheel->count);
+    SDL_LockMutex(wheel->mutex);
+
+    if (wheel->timers[timer].slot != NONE) {
+        detach(wheel, timer);
+        wheel->armed--;
+    }
+
+    SDL_UnlockMutex(wheel->mutex);
+}
+
+bool timerWheelArmed(TimerWheel* wheel, unsigned timer) {
+    assert(wheel && timer < wheel->count);
+    SDL_LockMutex(wheel->mutex);
+    const bool armed = wheel->timers[timer].slot != NONE;
+    SDL_UnlockMutex(wheel->mutex);
+    return armed;
+}
+
+static void cascade(TimerWheel* wheel, unsigned level) { // moves the timers of the upper level's slot, which the wheel has come to, to the lower levels
+    const unsigned slot = level * SLOTS + (unsigned) ((wheel->tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+
+    unsigned index;
+    while ((index = wheel->heads[slot]) != NONE) {
+        detach(wheel, index);
+        attach(wheel, index);
+    }
+}
+
+unsigned timerWheelAdvance(TimerWheel* wheel, unsigned long now, unsigned* expired) {
+    assert(wheel && expired);
+    SDL_LockMutex(wheel->mutex);
+
+    const unsigned long target = now / wheel->resolution;
+    unsigned count = 0;
+
+    while (wheel->tick < target && wheel->armed) {
+        wheel->tick++;
+
+        for (unsigned level = 1; level < LEVELS && !(wheel->tick & ((1ul << (SLOT_BITS * level)) - 1)); level++) // the upper levels are cascaded when the lower ones wrap around
+            cascade(wheel, level);
+
+        unsigned index;
+        while ((index = wheel->heads[wheel->tick & (SLOTS - 1)]) != NONE) {
+            assert(wheel->timers[index].expiration == wheel->tick);
+            detach(wheel, index);
+
+            wheel->armed--;
+            expired[count++] = index;
+        }
+    }
+
+    if (wheel->tick < target) wheel->tick = target; // nothing is armed, so the rest of the ticks are skipped rather than walked through
+
+    SDL_UnlockMutex(wheel->mutex);
+    return count;
+}
+
+unsigned long timerWheelNextExpiration(TimerWheel* wheel) {
+    assert(wheel);
+    SDL_LockMutex(wheel->mutex);
+
+    unsigned long next = ULONG_MAX;
+    for (unsigned long tick = wheel->tick + 1; wheel->armed && tick <= wheel->tick + SLOTS; tick++) {
+        if (wheel->heads[tick & (SLOTS - 1)] == NONE && tick & (SLOTS - 1)) continue; // the upper levels' timers may come down only when the lowest one wraps around
+
+        next = tick * wheel->resolution;
+        break;
+    }
+
+    SDL_UnlockMutex(wheel->mutex);
+    return next;
+}
+
+void timerWheelDestroy(TimerWheel* wheel) {
+    assert(wheel);
+    SDL_DestroyMutex(wheel->mutex);
+    SDL_free(wheel->timers);
+    SDL_free(wheel);
+}
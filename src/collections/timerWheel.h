@@ -0,0 +1,33 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "defs.h"
+
+struct TimerWheel_t;
+typedef struct TimerWheel_t TimerWheel; // thread-safe, a hierarchical timing wheel: arming, re-arming & cancelling a timer take constant time regardless of how many timers are armed
+
+TimerWheel* timerWheelInit(unsigned timers, unsigned resolution, unsigned long now); // timers are identified by indexes in range [0, timers), resolution is the tick's length in milliseconds, now is the current time in milliseconds
+void timerWheelArm(TimerWheel* wheel, unsigned timer, unsigned long deadline); // re-arms the timer if it's armed already, the timer expires within a tick after the deadline (in milliseconds) passes, never before that
+void timerWheelCancel(TimerWheel* wheel, unsigned timer); // does nothing if the timer isn't armed
+bool timerWheelArmed(TimerWheel* wheel, unsigned timer);
+unsigned timerWheelAdvance(TimerWheel* wheel, unsigned long now, unsigned* expired); // moves the wheel to the current time, the timers that have expired get disarmed & their indexes get put into the buffer which must fit all the timers, returns how many of them have expired
+unsigned long timerWheelNextExpiration(TimerWheel* wheel); // the time before which advancing won't expire anything, so the caller can block till then; ULONG_MAX if nothing is armed
+void timerWheelDestroy(TimerWheel* wheel);
@@ -40,6 +40,7 @@ const unsigned CRYPTO_HEADER_SIZE = crypto_secretstream_xchacha20poly1305_HEADER
 const unsigned CRYPTO_SIGNATURE_SIZE = crypto_sign_BYTES; // 64
 const unsigned CRYPTO_STREAMS_STATES_SIZE = sizeof(StreamState) * 2; // 104
 const unsigned CRYPTO_HASH_SIZE = crypto_generichash_BYTES; // 32
+const unsigned CRYPTO_IN_PLACE_OFFSET = sizeof(byte); // 1, the stream cipher puts the encrypted tag before the encrypted bytes
 STATIC_CONST_UNSIGNED SERVER_SIGN_PUBLIC_KEY_SIZE = CRYPTO_KEY_SIZE;
 STATIC_CONST_UNSIGNED ENCRYPTED_ADDITIONAL_BYTES_SIZE = crypto_secretstream_xchacha20poly1305_ABYTES; // 17
 STATIC_CONST_UNSIGNED MAC_SIZE = crypto_secretbox_MACBYTES; // 16
@@ -259,13 +260,8 @@ const byte* cryptoClientKey(const CryptoKeys* keys) {
     return keys->clientKey;
 }
 
-byte* nullable cryptoEncrypt(CryptoCoderStreams* coderStreams, const byte* bytes, unsigned bytesSize, bool server) {
-    assert(this);
-    assert(coderStreams && bytes && bytesSize > 0);
-
+static bool encrypt(CryptoCoderStreams* coderStreams, byte* encrypted, const byte* bytes, unsigned bytesSize, bool server) { // encrypted may start IN_PLACE_OFFSET bytes before the bytes as the tag gets written before the bytes are read
     unsigned long long generatedEncryptedSize = 0; // same as unsigned long
-    const unsigned long encryptedSize = cryptoEncryptedSize(bytesSize);
-    byte* encrypted = SDL_malloc(encryptedSize);
 
     const int result = crypto_secretstream_xchacha20poly1305_push(
         server ? serverEncryptionStateAsServer(coderStreams) : &(coderStreams->clientEncryptionState),
@@ -278,23 +274,32 @@ byte* nullable cryptoEncrypt(CryptoCoderStreams* coderStreams, const byte* bytes
         TAG_INTERMEDIATE
     );
 
-    if (result != 0) {
-        SDL_free(encrypted);
-        return NULL;
-    } else {
-        assert(generatedEncryptedSize == encryptedSize);
+    if (result != 0) return false;
+    assert(generatedEncryptedSize == cryptoEncryptedSize(bytesSize));
+    return true;
+}
+
+byte* nullable cryptoEncrypt(CryptoCoderStreams* coderStreams, const byte* bytes, unsigned bytesSize, bool server) {
+    assert(this);
+    assert(coderStreams && bytes && bytesSize > 0);
+
+    byte* encrypted = SDL_malloc(cryptoEncryptedSize(bytesSize));
+    if (encrypt(coderStreams, encrypted, bytes, bytesSize, server))
         return encrypted;
-    }
+
+    SDL_free(encrypted);
+    return NULL;
 }
 
-byte* nullable cryptoDecrypt(CryptoCoderStreams* coderStreams, const byte* bytes, unsigned bytesSize, bool server) {
+bool cryptoEncryptInPlace(CryptoCoderStreams* coderStreams, byte* buffer, unsigned bytesSize, bool server) {
     assert(this);
-    assert(coderStreams && bytes && bytesSize > ENCRYPTED_ADDITIONAL_BYTES_SIZE);
+    assert(coderStreams && buffer && bytesSize > 0);
+    return encrypt(coderStreams, buffer, buffer + CRYPTO_IN_PLACE_OFFSET, bytesSize, server);
+}
 
+static bool decrypt(CryptoCoderStreams* coderStreams, byte* decrypted, const byte* bytes, unsigned bytesSize, bool server) { // decrypted may start IN_PLACE_OFFSET bytes after the bytes as the mac gets verified before anything is written
     unsigned long long generatedDecryptedSize = 0; // same as unsigned long
     byte tag;
-    const unsigned long decryptedSize = bytesSize - ENCRYPTED_ADDITIONAL_BYTES_SIZE;
-    byte* decrypted = SDL_malloc(decryptedSize);
 
     const int result = crypto_secretstream_xchacha20poly1305_pull(
         server ? serverDecryptionStateAsServer(coderStreams) : &(coderStreams->clientDecryptionState),
@@ -307,13 +312,27 @@ byte* nullable cryptoDecrypt(CryptoCoderStreams* coderStreams, const byte* bytes
         0
     );
 
-    if (result != 0 || tag != TAG_INTERMEDIATE) {
-        SDL_free(decrypted);
-        return NULL;
-    } else {
-        assert(generatedDecryptedSize == decryptedSize);
+    if (result != 0 || tag != TAG_INTERMEDIATE) return false;
+    assert(generatedDecryptedSize == bytesSize - ENCRYPTED_ADDITIONAL_BYTES_SIZE);
+    return true;
+}
+
+byte* nullable cryptoDecrypt(CryptoCoderStreams* coderStreams, const byte* bytes, unsigned bytesSize, bool server) {
+    assert(this);
+    assert(coderStreams && bytes && bytesSize > ENCRYPTED_ADDITIONAL_BYTES_SIZE);
+
+    byte* decrypted = SDL_malloc(bytesSize - ENCRYPTED_ADDITIONAL_BYTES_SIZE);
+    if (decrypt(coderStreams, decrypted, bytes, bytesSize, server))
         return decrypted;
-    }
+
+    SDL_free(decrypted);
+    return NULL;
+}
+
+bool cryptoDecryptInPlace(CryptoCoderStreams* coderStreams, byte* buffer, unsigned bytesSize, bool server) {
+    assert(this);
+    assert(coderStreams && buffer && bytesSize > ENCRYPTED_ADDITIONAL_BYTES_SIZE);
+    return decrypt(coderStreams, buffer + CRYPTO_IN_PLACE_OFFSET, buffer, bytesSize, server);
 }
 
 void cryptoFillWithRandomBytes(byte* filled, unsigned size) {
@@ -322,6 +341,11 @@ void cryptoFillWithRandomBytes(byte* filled, unsigned size) {
     randombytes_buf(filled, size);
 }
 
+bool cryptoCompare(const byte* first, const byte* second, unsigned size) {
+    assert(size > 0);
+    return !sodium_memcmp(first, second, size);
+}
+
 unsigned cryptoSingleEncryptedSize(unsigned unencryptedSize)
 { return MAC_SIZE + unencryptedSize + NONCE_SIZE; }
 
@@ -27,6 +27,7 @@ extern const unsigned CRYPTO_SIGNATURE_SIZE;
 extern const unsigned CRYPTO_STREAMS_STATES_SIZE;
 extern const unsigned CRYPTO_HASH_SIZE;
 extern const unsigned CRYPTO_PADDING_BLOCK_SIZE;
+extern const unsigned CRYPTO_IN_PLACE_OFFSET;
 
 struct CryptoKeys_t;
 typedef struct CryptoKeys_t CryptoKeys;
@@ -63,7 +64,10 @@ const byte* cryptoServerKey(const CryptoKeys* keys);
 const byte* cryptoClientKey(const CryptoKeys* keys);
 byte* nullable cryptoEncrypt(CryptoCoderStreams* coderStreams, const byte* bytes, unsigned bytesSize, bool server); // returns encryptedSize()-sized encrypted bytes
 byte* nullable cryptoDecrypt(CryptoCoderStreams* coderStreams, const byte* bytes, unsigned bytesSize, bool server); // consumes what is returned by encrypt
+bool cryptoEncryptInPlace(CryptoCoderStreams* coderStreams, byte* buffer, unsigned bytesSize, bool server); // expects an encryptedSize(bytesSize)-sized buffer with the bytes to be encrypted placed at IN_PLACE_OFFSET, overwrites the buffer with the encrypted bytes, returns true on success
+bool cryptoDecryptInPlace(CryptoCoderStreams* coderStreams, byte* buffer, unsigned bytesSize, bool server); // the opposite of encryptInPlace, the decrypted bytes get placed at IN_PLACE_OFFSET, returns true on success
 void cryptoFillWithRandomBytes(byte* filled, unsigned size);
+bool cryptoCompare(const byte* first, const byte* second, unsigned size); // constant-time, returns true if the bytes are equal
 unsigned cryptoSingleEncryptedSize(unsigned unencryptedSize);
 byte* nullable cryptoEncryptSingle(const byte* key, const byte* bytes, unsigned bytesSize); // used to encrypt a single message, returns mac (tag) + encrypted bytes + nonce
 byte* nullable cryptoDecryptSingle(const byte* key, const byte* bytes, unsigned bytesSize); // used to decrypt a single message, consumes what is returned by encrypt
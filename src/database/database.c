@@ -481,7 +481,7 @@ CryptoCoderStreams* nullable databaseGetConversation(unsigned userId) {
     );
     assert(sqlSize > 0 && sqlSize <= bufferSize);
 
-    byte encryptedStreamsStates[CRYPTO_STREAMS_STATES_SIZE];
+    byte encryptedStreamsStates[cryptoSingleEncryptedSize(CRYPTO_STREAMS_STATES_SIZE)];
     bool found = false;
 
     executeSingle(
@@ -604,6 +604,44 @@ bool databaseAddMessage(const DatabaseMessage* message) {
     return true;
 }
 
+bool databaseAddMessages(const DatabaseMessage* const* messages, unsigned count) {
+    assert(this && messages && count);
+    rwMutexWriteLock(this->rwMutex);
+
+    const unsigned bufferSize = 0xff;
+    char sql[bufferSize];
+
+    const unsigned sqlSize = (unsigned) SDL_snprintf(
+        sql, bufferSize,
+        "insert into %s (%s, %s, %s, %s) values (?, ?, ?, ?)",
+        MESSAGES_TABLE, TIMESTAMP_COLUMN, CONVERSATION_COLUMN, FROM_COLUMN, TEXT_COLUMN
+    );
+    assert(sqlSize > 0 && sqlSize <= bufferSize);
+
+    executeSingleMinimal("begin transaction", 17); // otherwise each insert is a separate transaction with its own sync
+
+    sqlite3_stmt* statement;
+    assert(!sqlite3_prepare(this->db, sql, (int) sqlSize, &statement, NULL)); // prepared once for the whole batch
+
+    for (unsigned i = 0; i < count; i++) {
+        byte* encryptedText = cryptoEncryptSingle(this->key, (byte*) messages[i]->text, messages[i]->size);
+        assert(encryptedText);
+
+        addMessageBinder((const void*[2]) {messages[i], encryptedText}, statement);
+        assert(sqlite3_step(statement) == SQLITE_DONE);
+
+        assert(!sqlite3_reset(statement));
+        assert(!sqlite3_clear_bindings(statement));
+        SDL_free(encryptedText);
+    }
+
+    assert(!sqlite3_finalize(statement));
+    executeSingleMinimal("commit", 6);
+
+    rwMutexWriteUnlock(this->rwMutex);
+    return true;
+}
+
 static void getMessagesBinder(const unsigned* conversation, sqlite3_stmt* statement)
 { assert(!sqlite3_bind_int(statement, 1, (int) *conversation)); }
 
@@ -57,6 +57,7 @@ CryptoCoderStreams* nullable databaseGetConversation(unsigned userId);
 unsigned long databaseGetConversationTimestamp(unsigned userId); // check for existence first
 void databaseRemoveConversation(unsigned userId); // check for existence first
 bool databaseAddMessage(const DatabaseMessage* message); // check for existence first; from (user id) inside the message may be null if the message came from the current user
+bool databaseAddMessages(const DatabaseMessage* const* messages, unsigned count); // same as addMessage but for several messages at once, which are inserted within a single transaction
 List* nullable databaseGetMessages(unsigned conversation); // consumes a conversationId (userId), returns an array of messages <DatabaseMessage*> (which is expected to be deallocated by the caller) on success; inside each message there's fromId unsigned int in bytes (sizeof 4)
 void databaseRemoveMessages(unsigned conversation); // check for existence first
 unsigned long databaseGetMostRecentMessageTimestamp(unsigned conversation); // may return zero if no messages are presented in db
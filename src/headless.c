@@ -0,0 +1,596 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include "render/render.h"
+#include "lifecycle.h"
+#include "user.h"
+#include "conversationMessage.h"
+
+// Stands in for the render module in the headless build (see HEADLESS in CMakeLists.txt): there's no window, the pages & dialogs are driven by commands which are read line by line from the standard input,
+// the users & the messages are printed to the standard output and the system messages (prefixed with '*' or with '!' if they're errors) to the standard error. Every command blocks until the logic module has
+// finished with it, the app quits when the commands run out or right after the first failed one. The commands are:
+//     login <username> <password>     register <username> <password>
+//     users                           - re-fetches the users list & prints it as <id> <name> <online|offline> <conversation|->
+//     open <username>                 - opens the conversation with the user, creating it first (which the user must accept) if it doesn't exist
+//     messages                        - prints the opened conversation's messages, including the ones fetched from the server at logging in, as <date> <sender|you> <text>
+//     send <text>                     file <path>                         back                                delete <username>
+//     broadcast <text>                - admins only
+//     accept <yes|no>                 - whether the invites to conversations & file exchanges get accepted, yes by default
+//     wait <millis>                   - lets the messages & the invites arrive
+//     exit
+// Lines starting with '#' are ignored.
+
+STATIC_CONST_UNSIGNED MAX_LINE_SIZE = 1 << 10;
+STATIC_CONST_UNSIGNED COMMAND_TIMEOUT = 60000; // enough for a file of the max size to be sent
+STATIC_CONST_UNSIGNED POLL_PERIOD = 50; // the users list doesn't notify about its changes, so the conditions depending on it are re-checked periodically
+
+const unsigned RENDER_MAX_MESSAGE_SYSTEM_TEXT_SIZE = 75;
+
+typedef enum : unsigned {
+    STATE_INITIAL = 0,
+    STATE_LOG_IN = 1,
+    STATE_REGISTER = 2,
+    STATE_USERS_LIST = 3,
+    STATE_CONVERSATION = 4,
+    STATE_FILE_CHOOSER = 5,
+    STATE_ADMIN_ACTIONS = 6
+} States;
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection" // they're all used despite what the SAT says
+THIS(
+    unsigned usernameSize;
+    unsigned passwordSize;
+    unsigned maxMessageSize;
+    unsigned maxFilePathSize;
+    bool adminMode;
+    bool fullyInitialized;
+    bool started; // the first command waits for the splash to pass
+    List* nullable usersList; // <User*> allocated elsewhere
+    List* nullable conversationMessagesList; // <ConversationMessage*> allocated elsewhere
+    RenderCredentialsReceivedCallback onCredentialsReceived;
+    RenderCredentialsRandomFiller credentialsRandomFiller;
+    RenderLogInRegisterPageQueriedByUserCallback onLoginRegisterPageQueriedByUser;
+    RenderUserForConversationChosenCallback onUserForConversationChosen;
+    RenderOnReturnFromConversationPageRequested onReturnFromConversationPageRequested;
+    RenderMillisToDateTimeConverter millisToDateTimeConverter;
+    RenderOnSendClicked onSendClicked;
+    RenderOnUpdateUsersListClicked onUpdateUsersListClicked;
+    RenderOnFileChooserRequested onFileChooserRequested;
+    RenderFileChooseResultHandler fileChooseResultHandler;
+    RenderOnBroadcastMessageSendRequested onBroadcastMessageSendRequested;
+    SDL_mutex* mutex; // guards the fields below as the logic module changes them from its threads while the commands wait for them
+    SDL_cond* changed;
+    States state;
+    bool loading;
+    bool acceptInvites;
+    bool registered;
+    bool drained;
+    unsigned errors; // counters of the system messages, a command compares them with their values before it
+    unsigned fileResults;
+    unsigned awaitedErrors;
+    unsigned awaitedFileResults;
+    unsigned awaitedUserId;
+)
+#pragma clang diagnostic pop
+
+void renderInit(
+    unsigned usernameSize,
+    unsigned passwordSize,
+    RenderCredentialsReceivedCallback onCredentialsReceived,
+    RenderCredentialsRandomFiller credentialsRandomFiller,
+    RenderLogInRegisterPageQueriedByUserCallback onLoginRegisterPageQueriedByUser,
+    RenderUserForConversationChosenCallback onUserForConversationChosen,
+    __attribute_maybe_unused__ unsigned conversationNameSize,
+    __attribute_maybe_unused__ RenderOnServerShutdownRequested onServerShutdownRequested,
+    RenderOnReturnFromConversationPageRequested onReturnFromConversationPageRequested,
+    RenderMillisToDateTimeConverter millisToDateTimeConverter,
+    RenderOnSendClicked onSendClicked,
+    RenderOnUpdateUsersListClicked onUpdateUsersListClicked,
+    unsigned maxFilePathSize,
+    RenderOnFileChooserRequested onFileChooserRequested,
+    RenderFileChooseResultHandler fileChooseResultHandler,
+    __attribute_maybe_unused__ RenderOnAutoLoggingInChanged onAutoLoggingInChanged,
+    __attribute_maybe_unused__ RenderAutoLoggingInSupplier autoLoggingInSupplier,
+    __attribute_maybe_unused__ RenderOnAdminActionsPageRequested onAdminActionsPageRequested,
+    RenderOnBroadcastMessageSendRequested onBroadcastMessageSendRequested,
+    __attribute_maybe_unused__ RenderFilePresenceChecker filePresenceChecker
+) {
+    assert(!this && usernameSize > 0 && passwordSize > 0);
+    this = SDL_malloc(sizeof *this);
+
+    this->usernameSize = usernameSize;
+    this->passwordSize = passwordSize;
+    this->maxMessageSize = 0;
+    this->maxFilePathSize = maxFilePathSize;
+    this->adminMode = false;
+    this->fullyInitialized = false;
+    this->started = false;
+    this->usersList = NULL;
+    this->conversationMessagesList = NULL;
+    this->onCredentialsReceived = onCredentialsReceived;
+    this->credentialsRandomFiller = credentialsRandomFiller;
+    this->onLoginRegisterPageQueriedByUser = onLoginRegisterPageQueriedByUser;
+    this->onUserForConversationChosen = onUserForConversationChosen;
+    this->onReturnFromConversationPageRequested = onReturnFromConversationPageRequested;
+    this->millisToDateTimeConverter = millisToDateTimeConverter;
+    this->onSendClicked = onSendClicked;
+    this->onUpdateUsersListClicked = onUpdateUsersListClicked;
+    this->onFileChooserRequested = onFileChooserRequested;
+    this->fileChooseResultHandler = fileChooseResultHandler;
+    this->onBroadcastMessageSendRequested = onBroadcastMessageSendRequested;
+
+    this->mutex = SDL_CreateMutex();
+    this->changed = SDL_CreateCond();
+    this->state = STATE_INITIAL;
+    this->loading = false;
+    this->acceptInvites = true;
+    this->registered = false;
+    this->drained = false;
+    this->errors = 0;
+    this->fileResults = 0;
+    this->awaitedErrors = 0;
+    this->awaitedFileResults = 0;
+    this->awaitedUserId = 0;
+}
+
+void renderPostInit(
+    unsigned maxMessageSize,
+    bool adminMode,
+    __attribute_maybe_unused__ RenderThemes theme,
+    List* usersList,
+    List* messagesList,
+    StringsLanguages language
+) {
+    assert(this && !this->fullyInitialized && maxMessageSize);
+
+    this->maxMessageSize = maxMessageSize;
+    this->adminMode = adminMode;
+    this->usersList = usersList;
+    this->conversationMessagesList = messagesList;
+    stringsSetLanguage(language); // for the system messages
+
+    this->fullyInitialized = true;
+}
+
+void renderInputBegan(void) { assert(this); }
+void renderProcessEvent(__attribute_maybe_unused__ SDL_Event* event) { assert(this); }
+void renderInputEnded(void) { assert(this); }
+
+void renderSetWindowTitle(__attribute_maybe_unused__ const char* title) { assert(this); }
+void renderAlterConversationMessageBuffer(__attribute_maybe_unused__ const char* text, __attribute_maybe_unused__ unsigned size) { assert(this); } // there's no clipboard to paste from
+void renderAlterFilePathBuffer(__attribute_maybe_unused__ const char* filePath, __attribute_maybe_unused__ unsigned size) { assert(this); }
+
+static void setState(States state) {
+    assert(this);
+    SDL_LockMutex(this->mutex);
+    this->state = state;
+    SDL_CondBroadcast(this->changed);
+    SDL_UnlockMutex(this->mutex);
+}
+
+void renderShowLogIn(void) { setState(STATE_LOG_IN); }
+void renderShowRegister(void) { setState(STATE_REGISTER); }
+void renderShowUsersList(__attribute_maybe_unused__ const char* currentUserName) { setState(STATE_USERS_LIST); }
+void renderShowConversation(__attribute_maybe_unused__ const char* conversationName) { setState(STATE_CONVERSATION); }
+void renderShowFileChooser(void) { setState(STATE_FILE_CHOOSER); }
+void renderShowAdminActions(void) { setState(STATE_ADMIN_ACTIONS); }
+
+static States currentState(void) {
+    assert(this);
+    SDL_LockMutex(this->mutex);
+    const States state = this->state;
+    SDL_UnlockMutex(this->mutex);
+    return state;
+}
+
+bool renderIsConversationShown(void) { return currentState() == STATE_CONVERSATION; }
+bool renderIsFileChooserShown(void) { return currentState() == STATE_FILE_CHOOSER; }
+
+static bool replyToInvite(const char* text) { // called from the logic module's thread in place of a dialog, which would block it until the user answers
+    SDL_LockMutex(this->mutex);
+    const bool accepted = this->acceptInvites;
+    SDL_UnlockMutex(this->mutex);
+
+    fprintf(stderr, "* %s (%s)\n", text, stringsString(accepted ? STRINGS_ACCEPT : STRINGS_DECLINE));
+    return accepted;
+}
+
+bool renderShowInviteDialog(const char* fromUserName) {
+    assert(this);
+
+    char text[MAX_LINE_SIZE];
+    SDL_snprintf(text, MAX_LINE_SIZE, "%s%.*s", stringsString(STRINGS_YOU_ARE_INVITED_TO_CREATE_CONVERSATION_BY_USER), (int) this->usernameSize, fromUserName);
+    return replyToInvite(text);
+}
+
+bool renderShowFileExchangeRequestDialog(const char* fromUserName, unsigned fileSize, const char* filename) {
+    assert(this);
+
+    char text[MAX_LINE_SIZE];
+    SDL_snprintf(
+        text, MAX_LINE_SIZE,
+        "%s %.*s %s %u %s (%s)",
+        stringsString(STRINGS_FILE_EXCHANGE_REQUESTED_BY_USER),
+        (int) this->usernameSize,
+        fromUserName,
+        stringsString(STRINGS_WITH_SIZE_OF),
+        fileSize,
+        stringsString(STRINGS_BYTES),
+        filename
+    );
+    return replyToInvite(text);
+}
+
+void renderSetControlsBlocking(__attribute_maybe_unused__ bool blocking) { assert(this); } // commands are issued only after the loading has finished anyway
+
+static void postSystemMessage(const char* text, unsigned size, bool error, bool fileResult) {
+    assert(this);
+    SDL_LockMutex(this->mutex);
+
+    fprintf(stderr, "%c %.*s\n", error ? '!' : '*', (int) size, text);
+    this->errors += error;
+    this->fileResults += fileResult;
+
+    SDL_CondBroadcast(this->changed);
+    SDL_UnlockMutex(this->mutex);
+}
+
+static void postString(Strings string, bool error) { postSystemMessage(stringsString(string), SDL_strlen(stringsString(string)), error, false); }
+
+void renderShowSystemMessage(const char* text, unsigned size) {
+    assert(size > 0 && size <= RENDER_MAX_MESSAGE_SYSTEM_TEXT_SIZE - 1);
+    postSystemMessage(text, size, false, false);
+}
+
+void renderShowSystemError(void) { postString(STRINGS_ERROR_TEXT, true); }
+void renderShowDisconnectedError(void) { postString(STRINGS_DISCONNECTED, true); }
+void renderShowUnableToConnectToTheServerError(void) { postString(STRINGS_UNABLE_TO_CONNECT_TO_THE_SERVER, true); }
+void renderShowUserIsOfflineError(void) { postString(STRINGS_USER_IS_OFFLINE, true); }
+void renderShowUnableToDecryptDatabaseError(void) { postString(STRINGS_UNABLE_TO_DECRYPT_DATABASE, true); }
+void renderShowUnableToCreateConversation(void) { postString(STRINGS_UNABLE_TO_CREATE_CONVERSATION, true); }
+void renderShowConversationDoesntExist(void) { postString(STRINGS_CONVERSATION_DOESNT_EXIST, true); }
+void renderShowConversationAlreadyExists(void) { postString(STRINGS_CONVERSATION_ALREADY_EXISTS, true); }
+void renderShowCannotOpenFileError(void) { postString(STRINGS_CANNOT_OPEN_FILE, true); }
+void renderShowEmptyFilePathError(void) { postString(STRINGS_EMPTY_FILE_PATH, true); }
+void renderShowFileIsEmptyError(void) { postString(STRINGS_FILE_IS_EMPTY, true); }
+void renderShowFileIsTooBig(void) { postString(STRINGS_FILE_IS_TOO_BIG, true); }
+void renderShowFilenameIsTooLong(void) { postString(STRINGS_FILENAME_IS_TOO_LONG, true); }
+
+void renderShowUnableToTransmitFileError(void) {
+    const char* text = stringsString(STRINGS_UNABLE_TO_TRANSMIT_FILE);
+    postSystemMessage(text, SDL_strlen(text), true, true);
+}
+
+void renderShowFileTransmittedSystemMessage(void) {
+    const char* text = stringsString(STRINGS_FILE_TRANSMITTED);
+    postSystemMessage(text, SDL_strlen(text), false, true);
+}
+
+void renderShowRegistrationSucceededSystemMessage(void) {
+    postString(STRINGS_REGISTRATION_SUCCEEDED, false);
+
+    SDL_LockMutex(this->mutex);
+    this->registered = true;
+    SDL_UnlockMutex(this->mutex);
+}
+
+static void setLoading(bool loading) {
+    assert(this);
+    SDL_LockMutex(this->mutex);
+    this->loading = loading;
+    SDL_CondBroadcast(this->changed);
+    SDL_UnlockMutex(this->mutex);
+}
+
+void renderShowInfiniteProgressBar(void) { setLoading(true); }
+void renderHideInfiniteProgressBar(void) { setLoading(false); }
+
+static bool waitUntil(bool (*condition)(void)) { // the condition is checked with the mutex locked, returns false if it hasn't been met in time
+    const unsigned long deadline = SDL_GetTicks64() + COMMAND_TIMEOUT;
+    bool met;
+
+    SDL_LockMutex(this->mutex);
+    while (!(met = (*condition)()) && SDL_GetTicks64() < deadline)
+        SDL_CondWaitTimeout(this->changed, this->mutex, POLL_PERIOD);
+    SDL_UnlockMutex(this->mutex);
+
+    return met;
+}
+
+static const User* nullable findUserByName(const char* name) { // the list is only inspected while nothing is being loaded, as it's refilled then
+    for (unsigned i = 0; i < listSize(this->usersList); i++) {
+        const User* user = listGet(this->usersList, i);
+        if (!SDL_strncmp(user->name, name, this->usernameSize)) return user;
+    }
+    return NULL;
+}
+
+static const User* nullable findUserById(unsigned id) {
+    for (unsigned i = 0; i < listSize(this->usersList); i++) {
+        const User* user = listGet(this->usersList, i);
+        if (user->id == id) return user;
+    }
+    return NULL;
+}
+
+static bool started(void) { return this->state != STATE_INITIAL || this->loading; } // either the log in page is shown or the auto logging in has begun
+static bool idle(void) { return !this->loading; }
+static bool registrationFinished(void) { return !this->loading && this->state == STATE_LOG_IN; } // the server disconnects the client after the registration
+static bool drained(void) { return this->drained; }
+
+static bool conversationCreated(void) { // or the creation has failed
+    if (this->loading) return false;
+    if (this->errors != this->awaitedErrors) return true;
+
+    const User* user = findUserById(this->awaitedUserId);
+    return user && user->conversationExists;
+}
+
+static bool fileExchangeFinished(void) { return !this->loading && (this->errors != this->awaitedErrors || this->fileResults != this->awaitedFileResults); }
+
+static void markDrained(void*) {
+    SDL_LockMutex(this->mutex);
+    this->drained = true;
+    SDL_CondBroadcast(this->changed);
+    SDL_UnlockMutex(this->mutex);
+}
+
+static bool drain(void) { // waits for the logic module's pending asynchronous actions, like sending messages, to be performed
+    SDL_LockMutex(this->mutex);
+    this->drained = false;
+    SDL_UnlockMutex(this->mutex);
+
+    lifecycleAsync(&markDrained, NULL, 0); // the actions are performed in order
+    return waitUntil(&drained);
+}
+
+static bool loggedIn(void) {
+    const States state = currentState();
+    return state == STATE_USERS_LIST || state == STATE_CONVERSATION;
+}
+
+static bool logIn(char* arguments, bool logIn) {
+    char* password = SDL_strchr(arguments, ' ');
+    if (!password) return false;
+
+    const unsigned usernameSize = password - arguments, passwordSize = SDL_strlen(++password);
+    if (!usernameSize || usernameSize > this->usernameSize || !passwordSize || passwordSize > this->passwordSize) return false;
+
+    SDL_LockMutex(this->mutex);
+    this->registered = false;
+    SDL_UnlockMutex(this->mutex);
+
+    (*(this->onLoginRegisterPageQueriedByUser))(logIn);
+    (*(this->onCredentialsReceived))(arguments, usernameSize, password, passwordSize, logIn);
+    (*(this->credentialsRandomFiller))(arguments, usernameSize + 1 + passwordSize); // they're copied
+
+    if (logIn) return waitUntil(&idle) && loggedIn();
+
+    const bool finished = waitUntil(&registrationFinished);
+    SDL_LockMutex(this->mutex);
+    const bool registered = this->registered;
+    SDL_UnlockMutex(this->mutex);
+    return finished && registered;
+}
+
+static void printUsers(void) {
+    for (unsigned i = 0; i < listSize(this->usersList); i++) {
+        const User* user = listGet(this->usersList, i);
+        printf("%u\t%.*s\t%s\t%s\n", user->id, (int) this->usernameSize, user->name, user->online ? "online" : "offline", user->conversationExists ? "conversation" : "-");
+    }
+}
+
+static bool updateUsers(void) {
+    if (!loggedIn()) return false;
+
+    (*(this->onUpdateUsersListClicked))();
+    if (!waitUntil(&idle)) return false;
+
+    printUsers();
+    return true;
+}
+
+static bool returnToUsersList(void) {
+    if (!loggedIn()) return false;
+    if (currentState() == STATE_CONVERSATION) (*(this->onReturnFromConversationPageRequested))();
+    return true;
+}
+
+static bool openConversation(const char* name) {
+    if (!returnToUsersList()) return false;
+
+    const User* user = findUserByName(name);
+    if (!user) return false;
+
+    const unsigned id = user->id;
+    if (!user->conversationExists) {
+        SDL_LockMutex(this->mutex);
+        this->awaitedErrors = this->errors;
+        this->awaitedUserId = id;
+        SDL_UnlockMutex(this->mutex);
+
+        (*(this->onUserForConversationChosen))(id, RENDER_CONVERSATION_START); // the user gets invited, the conversation is created once they accept
+        if (!waitUntil(&conversationCreated)) return false;
+
+        SDL_LockMutex(this->mutex);
+        const bool failed = this->errors != this->awaitedErrors;
+        SDL_UnlockMutex(this->mutex);
+        if (failed) return false;
+    }
+
+    (*(this->onUserForConversationChosen))(id, RENDER_CONVERSATION_CONTINUE);
+    return waitUntil(&idle) && currentState() == STATE_CONVERSATION;
+}
+
+static bool deleteConversation(const char* name) {
+    if (!returnToUsersList()) return false;
+
+    const User* user = findUserByName(name);
+    if (!user) return false;
+
+    SDL_LockMutex(this->mutex);
+    const unsigned errors = this->errors;
+    SDL_UnlockMutex(this->mutex);
+
+    (*(this->onUserForConversationChosen))(user->id, RENDER_CONVERSATION_DELETE);
+    if (!waitUntil(&idle)) return false;
+
+    SDL_LockMutex(this->mutex);
+    const bool deleted = this->errors == errors;
+    SDL_UnlockMutex(this->mutex);
+    return deleted;
+}
+
+static bool printMessages(void) {
+    if (currentState() != STATE_CONVERSATION) return false;
+
+    for (unsigned i = 0; i < listSize(this->conversationMessagesList); i++) {
+        const ConversationMessage* message = listGet(this->conversationMessagesList, i);
+        char* dateTime = (*(this->millisToDateTimeConverter))(message->timestamp);
+
+        message->from
+            ? printf("%s\t%.*s\t%.*s\n", dateTime, (int) this->usernameSize, message->from, (int) message->size, message->text)
+            : printf("%s\t%s\t%.*s\n", dateTime, stringsString(STRINGS_YOU), (int) message->size, message->text);
+
+        SDL_free(dateTime);
+    }
+    return true;
+}
+
+static bool sendMessage(const char* text) {
+    const unsigned size = SDL_strlen(text);
+    if (currentState() != STATE_CONVERSATION || !size || size > this->maxMessageSize) return false;
+
+    (*(this->onSendClicked))(text, size); // gets sent asynchronously, the messages are drained before the app quits
+    return true;
+}
+
+static bool sendFile(const char* path) {
+    const unsigned size = SDL_strlen(path);
+    if (currentState() != STATE_CONVERSATION || size > this->maxFilePathSize) return false;
+
+    SDL_LockMutex(this->mutex);
+    this->awaitedErrors = this->errors;
+    this->awaitedFileResults = this->fileResults;
+    SDL_UnlockMutex(this->mutex);
+
+    (*(this->onFileChooserRequested))();
+    (*(this->fileChooseResultHandler))(path, size);
+    const bool finished = waitUntil(&fileExchangeFinished);
+
+    SDL_LockMutex(this->mutex);
+    const bool transmitted = finished && this->errors == this->awaitedErrors;
+    SDL_UnlockMutex(this->mutex);
+
+    (*(this->fileChooseResultHandler))(NULL, 0); // back to the conversation
+    return waitUntil(&idle) && transmitted;
+}
+
+static bool sendBroadcast(const char* text) {
+    const unsigned size = SDL_strlen(text);
+    if (!this->adminMode || !loggedIn() || !size || size > RENDER_MAX_MESSAGE_SYSTEM_TEXT_SIZE - 1) return false;
+
+    (*(this->onBroadcastMessageSendRequested))(text, size);
+    return true;
+}
+
+static bool setAcceptingInvites(const char* value) {
+    const bool yes = !SDL_strcmp(value, "yes");
+    if (!yes && SDL_strcmp(value, "no")) return false;
+
+    SDL_LockMutex(this->mutex);
+    this->acceptInvites = yes;
+    SDL_UnlockMutex(this->mutex);
+    return true;
+}
+
+static bool waitCommand(const char* millis) { // not 'pause' as that's taken by unistd.h
+    const long value = SDL_strtol(millis, NULL, 10);
+    if (value <= 0) return false;
+
+    SDL_Delay((unsigned) value);
+    return waitUntil(&idle);
+}
+
+static bool executeCommand(char* line, bool* quit) { // returns false if the command has failed
+    char* arguments = SDL_strchr(line, ' ');
+    if (arguments) *(arguments++) = 0;
+
+    if (!SDL_strcmp(line, "exit")) {
+        *quit = true;
+        return true;
+    }
+
+    if (!arguments) {
+        if (!SDL_strcmp(line, "users")) return updateUsers();
+        if (!SDL_strcmp(line, "messages")) return printMessages();
+        if (!SDL_strcmp(line, "back")) return returnToUsersList();
+        return false;
+    }
+
+    if (!SDL_strcmp(line, "login")) return logIn(arguments, true);
+    if (!SDL_strcmp(line, "register")) return logIn(arguments, false);
+    if (!SDL_strcmp(line, "open")) return openConversation(arguments);
+    if (!SDL_strcmp(line, "delete")) return deleteConversation(arguments);
+    if (!SDL_strcmp(line, "send")) return sendMessage(arguments);
+    if (!SDL_strcmp(line, "file")) return sendFile(arguments);
+    if (!SDL_strcmp(line, "broadcast")) return sendBroadcast(arguments);
+    if (!SDL_strcmp(line, "accept")) return setAcceptingInvites(arguments);
+    if (!SDL_strcmp(line, "wait")) return waitCommand(arguments);
+    return false;
+}
+
+void renderDraw(void) { // executes the next command instead of drawing a frame, so the lifecycle's loop isn't paced
+    assert(this && this->fullyInitialized);
+
+    if (!this->started) {
+        waitUntil(&started);
+        this->started = true;
+    }
+
+    char line[MAX_LINE_SIZE];
+    bool quit = !fgets(line, (int) MAX_LINE_SIZE, stdin);
+
+    if (!quit) {
+        for (char* end = line + SDL_strlen(line); end > line && (end[-1] == '\n' || end[-1] == '\r'); *(--end) = 0);
+        const bool succeeded = !*line || *line == '#' || (waitUntil(&idle) && executeCommand(line, &quit));
+
+        if (!succeeded) {
+            fprintf(stderr, "failed: %s\n", line); // just the command's name as the arguments are split off
+            quit = true;
+        }
+        fflush(stdout);
+    }
+
+    if (!quit) return;
+    drain(); // the messages which are still being sent
+    SDL_PushEvent(&((SDL_Event) {.type = SDL_QUIT})); // as if the window was closed
+}
+
+void renderClean(void) {
+    if (!this) return;
+
+    SDL_DestroyCond(this->changed);
+    SDL_DestroyMutex(this->mutex);
+
+    SDL_free(this);
+    this = NULL;
+}
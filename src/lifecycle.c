@@ -27,7 +27,6 @@
 #include "lifecycle.h"
 
 static const unsigned UI_UPDATE_PERIOD = 1000 / 60; // 16.7, at most 60 frames per second
-static const unsigned NET_UPDATE_PERIOD = 1000 / 2; // 500, at most 2 updates per second
 
 typedef struct {
     LifecycleAsyncActionFunction function;
@@ -41,7 +40,6 @@ THIS(
     atomic bool running;
     Queue* asyncActionsQueue; // <AsyncAction*>
     SDL_Thread* asyncActionsThread;
-    SDL_TimerID netUpdateThreadId;
 )
 #pragma clang diagnostic pop
 
@@ -59,34 +57,30 @@ void lifecycleAsync(LifecycleAsyncActionFunction function, void* nullable parame
 
 static void asyncActionsThreadLooper(void) {
     while (this->running) {
-        if (!queueSize(this->asyncActionsQueue)) {
-            lifecycleSleep(100);
-            continue;
+        AsyncAction* action = queueWaitAndPop(this->asyncActionsQueue, -1); // blocks till an action is queued, a null one is queued to wake the looper up when the app is being closed
+        if (!action || !(this->running)) {
+            SDL_free(action);
+            break;
         }
 
-        AsyncAction* action = queuePop(this->asyncActionsQueue);
         if (action->delayMillis > 0) lifecycleSleep(action->delayMillis);
         (*(action->function))(action->parameter);
         SDL_free(action);
     }
 }
 
-static unsigned netUpdateLopper(void) {
-    if (this->running) {
-        logicNetListen(); // gets called in another thread (not even in asyncActionsThread) so the incoming messages can be processed while sending/receiving files and/or setting up conversation
-        return NET_UPDATE_PERIOD;
-    } else
-        return 0;
-}
-
 bool lifecycleInit(void) {
     this = SDL_malloc(sizeof *this);
     this->running = true;
     this->asyncActionsQueue = queueInit((QueueDeallocator) &SDL_free);
     this->asyncActionsThread = SDL_CreateThread((SDL_ThreadFunction) &asyncActionsThreadLooper, "asyncActionsThread", NULL);
 
+#ifdef HEADLESS
+    assert(!SDL_Init(SDL_INIT_EVENTS | SDL_INIT_TIMER)); // no display is needed
+#else
     SDL_SetHint(SDL_HINT_VIDEO_HIGHDPI_DISABLED, "1"); // TODO: optimize ui for highDpi displays
     assert(!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER));
+#endif
 
     renderInit(
         NET_USERNAME_SIZE,
@@ -120,8 +114,6 @@ bool lifecycleInit(void) {
         logicLanguage()
     );
 
-    this->netUpdateThreadId = SDL_AddTimer(NET_UPDATE_PERIOD, (SDL_TimerCallback) &netUpdateLopper, NULL);
-
     return true;
 }
 
@@ -146,9 +138,10 @@ static bool processEvents(void) {
 }
 
 void lifecycleLoop(void) {
-    unsigned long startMillis, differenceMillis;
     while (this->running) {
-        startMillis = logicCurrentTimeMillis();
+#ifndef HEADLESS
+        const unsigned long startMillis = logicCurrentTimeMillis();
+#endif
 
         if (processEvents()) {
             this->running = false;
@@ -158,18 +151,22 @@ void lifecycleLoop(void) {
 
         renderDraw();
 
-        differenceMillis = logicCurrentTimeMillis() - startMillis;
+#ifndef HEADLESS // there a 'frame' blocks till the next command is executed, so it isn't paced
+        const unsigned long differenceMillis = logicCurrentTimeMillis() - startMillis;
         if ((unsigned long) UI_UPDATE_PERIOD > differenceMillis)
             lifecycleSleep((unsigned long) UI_UPDATE_PERIOD - differenceMillis);
 
 //        SDL_Log("fps: %u", (unsigned) (1000.0f / (float) (logicCurrentTimeMillis() - startMillis)));
+#endif
     }
 }
 
 void lifecycleClean(void) {
     if (!this) return;
 
-    SDL_RemoveTimer(this->netUpdateThreadId);
+    this->running = false;
+    SDL_QuitSubSystem(SDL_INIT_TIMER); // waits for a timer's callback which may be queueing an action right now, the timers that are still pending never fire
+    queuePush(this->asyncActionsQueue, NULL);
     SDL_WaitThread(this->asyncActionsThread, NULL);
     queueDestroy(this->asyncActionsQueue);
 
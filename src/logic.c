@@ -31,6 +31,7 @@
 #include "options.h"
 #include "collections/list.h"
 #include "collections/queue.h"
+#include "utils/lz.h"
 #include "logic.h"
 
 const unsigned LOGIC_MAX_FILE_PATH_SIZE = 0x1ff; // 511, (1 << 9) - 1
@@ -38,6 +39,20 @@ STATIC_CONST_UNSIGNED MAX_FILE_SIZE = (1 << 20) * 20; // 1024^2 * 20 = 20971520
 
 STATIC_CONST_STRING FILES_DIR = "files";
 
+STATIC_CONST_UNSIGNED RECONNECTION_BASE_DELAY = 500; // millis
+STATIC_CONST_UNSIGNED RECONNECTION_MAX_DELAY = 5000;
+STATIC_CONST_UNSIGNED RECONNECTION_MAX_ATTEMPTS = 10;
+STATIC_CONST_UNSIGNED MAX_FILE_TRANSFERS = 16; // as many as the net module can handle at once
+STATIC_CONST_UNSIGNED FILE_COMPRESSION_READ_AHEAD = 4; // a compressed chunk carries up to that many raw chunks' worth of the file
+STATIC_CONST_UNSIGNED FILE_COMPRESSION_SAMPLE_SIZE = 1 << 12; // the beginning of the file that gets compressed to decide whether to propose the compression
+STATIC_CONST_UNSIGNED COMPRESSED_CHUNK_HEAD_SIZE = 1 + sizeof(int); // [mode][raw size]
+#ifdef HEADLESS
+STATIC_CONST_UNSIGNED SPLASH_DURATION = 0; // nothing to show
+#else
+STATIC_CONST_UNSIGNED SPLASH_DURATION = 1000; // millis
+#endif
+STATIC_CONST_UNSIGNED MAX_PARALLEL_MESSAGES_FETCHES = 8; // missing messages of that many conversations are fetched at once, so catching up doesn't take a round trip per conversation
+
 typedef enum : unsigned {
     STATE_UNAUTHENTICATED = 0,
     STATE_AWAITING_AUTHENTICATION = 1,
@@ -45,10 +60,30 @@ typedef enum : unsigned {
     STATE_EXCHANGING_MESSAGES = 3
 } States;
 
+typedef enum : byte {
+    CHUNK_MODE_RAW = 0, // [mode][the file's bytes]
+    CHUNK_MODE_COMPRESSED = 1 // [mode][raw size][the file's bytes compressed]
+} ChunkModes; // of chunks of the transfers which both sides have agreed to compress
+
+typedef struct {
+    bool active;
+    unsigned id; // assigned by the net module, 0 until the outgoing transfer's invite is about to be sent
+    unsigned peerId;
+    bool outgoing;
+    SDL_RWops* rwops;
+    void* nullable hashState; // of the received bytes
+    unsigned fileSize;
+    unsigned bytesCounter;
+    byte* nullable hash; // of the received file, calculated by the sender
+    char* nullable filePath; // of the received file, it gets removed if the transfer fails
+    bool compressed; // whether the received chunks are compressed
+    byte* nullable compressionBuffer; // the sent file's bytes read ahead to be compressed into a chunk
+} FileTransfer;
+
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection" // they're all used despite what the SAT says
 THIS(
-    atomic bool netInitialized;
+    NetConnection* atomic netConnection; // null while disconnected; it's cleaned up only on the async thread (or in logicClean after that thread has stopped), so the async tasks can use it without a lock
     List* usersList; // <User*>
     List* messagesList; // <ConversationMessage*>
     bool adminMode;
@@ -56,17 +91,24 @@ THIS(
     char* currentUserName;
     atomic unsigned toUserId; // the id of the user, the current user (logged in via this client) wanna speak to
     atomic bool databaseInitialized;
-    SDL_RWops* nullable rwops;
-    atomic unsigned fileBytesCounter;
+    FileTransfer fileTransfers[MAX_FILE_TRANSFERS]; // files are sent & received concurrently, each one with its own handle & hash
+    SDL_mutex* fileTransfersMutex; // the table is accessed by the async thread & by the net module's threads
     bool autoLoggingIn;
-    void* fileHashState;
     atomic unsigned missingMessagesFetchers;
     Queue* userIdsToFetchMessagesFrom;
     OptionsThemes theme;
+    char* nullable pendingCredentials; // username followed by password, kept until the connection gets established
+    bool pendingLogIn; // or registration
+    char* nullable sessionCredentials; // the same but kept while the user is logged in, for re-authenticating after reconnection
+    atomic unsigned reconnectionAttempts; // zero if not reconnecting
+    atomic unsigned stateBeforeDisconnection; // restored after the session is resumed
+    atomic bool resumingConversation; // the conversation page stays opened while the users list and the missing messages are being re-synchronized
+    atomic bool usersListOutdated; // set if the server has pushed the presence of a user who isn't in the list, the list is re-fetched then on the next conversation's creation or deletion instead of being patched
 )
 #pragma clang diagnostic pop
 
 static long fetchHostId(void);
+static bool abortFileTransfers(void);
 
 static void showLoginPageOrPerformAutoLoggingIn(void) {
     if (!this->autoLoggingIn) {
@@ -91,16 +133,23 @@ void logicInit(void) {
     assert(NET_MAX_MESSAGE_BODY_SIZE >= RENDER_MAX_MESSAGE_SYSTEM_TEXT_SIZE);
 
     this = SDL_malloc(sizeof *this);
-    this->netInitialized = false;
+    this->netConnection = NULL;
     this->usersList = userInitList();
     this->messagesList = conversationMessageInitList();
     this->state = STATE_UNAUTHENTICATED;
     this->currentUserName = SDL_calloc(NET_USERNAME_SIZE, sizeof(char));
     this->databaseInitialized = false;
-    this->rwops = NULL;
-    this->fileHashState = NULL;
+    SDL_memset(this->fileTransfers, 0, sizeof this->fileTransfers);
+    this->fileTransfersMutex = SDL_CreateMutex();
     this->missingMessagesFetchers = 0;
     this->userIdsToFetchMessagesFrom = queueInit(NULL);
+    this->pendingCredentials = NULL;
+    this->pendingLogIn = false;
+    this->sessionCredentials = NULL;
+    this->reconnectionAttempts = 0;
+    this->stateBeforeDisconnection = STATE_UNAUTHENTICATED;
+    this->resumingConversation = false;
+    this->usersListOutdated = false;
 
     cryptoInit();
 
@@ -109,7 +158,7 @@ void logicInit(void) {
     this->autoLoggingIn = optionsCredentials() != NULL;
     this->theme = optionsTheme();
 
-    lifecycleAsync((LifecycleAsyncActionFunction) &showLoginPageOrPerformAutoLoggingIn, NULL, 1000);
+    lifecycleAsync((LifecycleAsyncActionFunction) &showLoginPageOrPerformAutoLoggingIn, NULL, SPLASH_DURATION);
 }
 
 bool logicIsAdminMode(void) {
@@ -122,12 +171,6 @@ bool logicIsDarkTheme(void) {
     return this->theme;
 }
 
-void logicNetListen(void) {
-    if (!this) return; // logic module might haven't been initialized by the time lifecycle module's netThread has started periodically calling this function to update connection
-    if (!this->netInitialized) return;
-    netListen();
-}
-
 List* logicUsersList(void) {
     assert(this);
     return this->usersList;
@@ -162,8 +205,29 @@ static unsigned maxUnencryptedMessageBodySize(void) { return NET_MAX_MESSAGE_BOD
 static int findUserComparator(const unsigned* xId, const User* const* user)
 { return *xId < (*user)->id ? -1 : (*xId > (*user)->id ? 1 : 0); }
 
-static const User* nullable findUser(unsigned id)
-{ return listBinarySearch(this->usersList, &id, (ListComparator) &findUserComparator); } // TODO: add mutex to Crypto objects
+static const User* nullable findUser(unsigned id) // the list is empty until it's fetched, while the presence pushes may arrive right after logging in
+{ return listSize(this->usersList) ? listBinarySearch(this->usersList, &id, (ListComparator) &findUserComparator) : NULL; } // TODO: add mutex to Crypto objects
+
+static byte* nullable decryptReceivedMessage(unsigned fromId, const byte* encryptedMessage, unsigned encryptedSize, unsigned* size) { // returns null if there's no conversation with the sender
+    const unsigned paddedSize = encryptedSize - cryptoEncryptedSize(0);
+    assert(paddedSize > 0 && paddedSize <= maxUnencryptedMessageBodySize());
+
+    // TODO: test conversation setup and file exchanging with 3 users: 2 try to setup/exchange and the 3rd one tries to interfere
+
+    CryptoCoderStreams* coderStreams = databaseGetConversation(fromId);
+    if (!coderStreams) return NULL; // TODO: assert
+
+    byte* paddedMessage = cryptoDecrypt(coderStreams, encryptedMessage, encryptedSize, false);
+    assert(paddedMessage); // situation: user1 updating users list & fetching messages, meanwhile user2 sends a paddedMessage, so we have the following: user1 updated all needed info and didn't receive the new paddedMessage from user2, user1 doesn't know that there's a new missing paddedMessage on a server, then without updating messages on user1's side, user2 sends him a new paddedMessage, what will happen next? - user1 receives the second new paddedMessage from user2 and tries to decrypt it - it may fail due to 'ratchet' mechanism in the stream cipher. Besides, if user1 after receiving the second paddedMessage will try to re-fetch messages, he won't receive the first missing paddedMessage - only those after the second paddedMessage
+    cryptoCoderStreamsDestroy(coderStreams); // tested this situation ----/\ and everything works fine
+    // TODO: to avoid possibility of this problem appearing can be implemented the following mechanism: periodically check for missing messages presence (like with checking for a new paddedMessage) and update if needed
+
+    byte* message = cryptoRemovePadding(size, paddedMessage, paddedSize);
+    assert(message && *size);
+
+    SDL_free(paddedMessage);
+    return message;
+}
 
 static void processReceivedMessage(void** parameters) {
     assert(this && this->databaseInitialized);
@@ -180,22 +244,9 @@ static void processReceivedMessage(void** parameters) {
     const User* user = findUser(fromId);
     if (!user) return; // thanks to caching messages while users information is synchronizing, losing messages here is unlikely to happen, but theoretically it is still possible - it would be an error though as the sender is required to instantiate a conversation with the recipient first and the recipient's logic won't let to do that as it would drop/ignore conversation creation requests/invites from the sender - TODO: assert(user found)?
 
-    const unsigned paddedSize = encryptedSize - cryptoEncryptedSize(0);
-    assert(paddedSize > 0 && paddedSize <= maxUnencryptedMessageBodySize());
-
-    // TODO: test conversation setup and file exchanging with 3 users: 2 try to setup/exchange and the 3rd one tries to interfere
-
-    CryptoCoderStreams* coderStreams = databaseGetConversation(fromId);
-    if (!coderStreams) return; // TODO: assert
-
-    byte* paddedMessage = cryptoDecrypt(coderStreams, encryptedMessage, encryptedSize, false);
-    assert(paddedMessage); // situation: user1 updating users list & fetching messages, meanwhile user2 sends a paddedMessage, so we have the following: user1 updated all needed info and didn't receive the new paddedMessage from user2, user1 doesn't know that there's a new missing paddedMessage on a server, then without updating messages on user1's side, user2 sends him a new paddedMessage, what will happen next? - user1 receives the second new paddedMessage from user2 and tries to decrypt it - it may fail due to 'ratchet' mechanism in the stream cipher. Besides, if user1 after receiving the second paddedMessage will try to re-fetch messages, he won't receive the first missing paddedMessage - only those after the second paddedMessage
-    cryptoCoderStreamsDestroy(coderStreams); // tested this situation ----/\ and everything works fine
-    // TODO: to avoid possibility of this problem appearing can be implemented the following mechanism: periodically check for missing messages presence (like with checking for a new paddedMessage) and update if needed
-
     unsigned size;
-    byte* message = cryptoRemovePadding(&size, paddedMessage, paddedSize);
-    assert(message && size);
+    byte* message = decryptReceivedMessage(fromId, encryptedMessage, encryptedSize, &size);
+    if (!message) return;
 
     DatabaseMessage* dbMessage = databaseMessageCreate(timestamp, fromId, fromId, message, size);
     assert(databaseAddMessage(dbMessage));
@@ -204,7 +255,6 @@ static void processReceivedMessage(void** parameters) {
     if (fromId == this->toUserId)
         listAddFront(this->messagesList, conversationMessageCreate(timestamp, user->name, NET_USERNAME_SIZE, (const char*) message, size));
 
-    SDL_free(paddedMessage);
     SDL_free(message);
 }
 
@@ -236,12 +286,30 @@ static void finishLoading(void) {
     renderSetControlsBlocking(false);
 }
 
+static void dropCredentials(char** credentials) {
+    logicCredentialsRandomFiller(*credentials, NET_USERNAME_SIZE + NET_UNHASHED_PASSWORD_SIZE);
+    SDL_free(*credentials);
+    *credentials = NULL;
+}
+
+static void fetchUsers(void) { if (this->netConnection) netFetchUsers(this->netConnection); } // asynchronously, so the connection may have been lost in between
+static void shutdownServer(void) { if (this->netConnection) netShutdownServer(this->netConnection); }
+
 static void onLogInResult(bool successful) { // TODO: add broadcasting to all users feature for admin
     assert(this);
     if (successful) {
-        this->state = STATE_AUTHENTICATED;
-        lifecycleAsync((LifecycleAsyncActionFunction) &netFetchUsers, NULL, 0);
+        if (this->reconnectionAttempts) { // the session is resumed, the local data (database, users & messages lists) is kept untouched, only what's been missed gets fetched
+            this->reconnectionAttempts = 0;
+            this->state = this->stateBeforeDisconnection;
+            this->resumingConversation = this->state == STATE_EXCHANGING_MESSAGES;
+        } else
+            this->state = STATE_AUTHENTICATED;
+
+        lifecycleAsync((LifecycleAsyncActionFunction) &fetchUsers, NULL, 0);
     } else {
+        this->reconnectionAttempts = 0;
+        if (this->sessionCredentials) dropCredentials(&(this->sessionCredentials)); // also if they've been changed while the client was disconnected
+
         this->state = STATE_UNAUTHENTICATED;
         renderShowLogIn();
         renderShowSystemError();
@@ -262,10 +330,9 @@ static void onRegisterResult(bool successful) {
     renderHideInfiniteProgressBar();
 }
 
-static void onDisconnected(void) {
-    assert(this);
-
-    this->netInitialized = false;
+static void abandonSession(void) {
+    this->reconnectionAttempts = 0;
+    if (this->sessionCredentials) dropCredentials(&(this->sessionCredentials));
     this->state = STATE_UNAUTHENTICATED;
 
     finishLoading();
@@ -273,20 +340,114 @@ static void onDisconnected(void) {
     renderShowDisconnectedError();
 }
 
+static unsigned reconnectionDelay(unsigned attempt) { // exponential backoff with jitter, so the clients which lost their connections simultaneously don't reconnect all at once
+    unsigned delay = RECONNECTION_BASE_DELAY;
+    for (unsigned i = 0; i < attempt && delay < RECONNECTION_MAX_DELAY; delay *= 2, i++);
+    delay = min(delay, RECONNECTION_MAX_DELAY);
+
+    unsigned random;
+    cryptoFillWithRandomBytes((byte*) &random, sizeof random);
+    return delay / 2 + random % (delay / 2 + 1); // somewhere in [delay/2, delay]
+}
+
+static void reconnect(void);
+
+static unsigned onReconnectionDelayPassed(__attribute_maybe_unused__ unsigned interval, __attribute_maybe_unused__ void* parameter) { // called from SDL's timer thread
+    lifecycleAsync((LifecycleAsyncActionFunction) &reconnect, NULL, 0); // dropped if the app is being closed, the async thread also checks that again before running it
+    return 0; // fires once
+}
+
+static void scheduleReconnection(void) {
+    if (this->reconnectionAttempts == RECONNECTION_MAX_ATTEMPTS) {
+        abandonSession();
+        return;
+    }
+
+    assert(SDL_AddTimer(reconnectionDelay(this->reconnectionAttempts++), (SDL_TimerCallback) &onReconnectionDelayPassed, NULL)); // waits on a timer instead of the async thread, so the other actions aren't held up behind the delay & closing the app doesn't wait it out
+}
+
+static void processDisconnection(void) {
+    assert(this && this->netConnection);
+    netClean(this->netConnection); // after the tasks that were queued before the disconnection, which may still be using it
+    if (abortFileTransfers()) renderShowUnableToTransmitFileError();
+
+    const bool loggedIn = this->state == STATE_AUTHENTICATED || this->state == STATE_EXCHANGING_MESSAGES;
+    if (!this->sessionCredentials || (!loggedIn && !this->reconnectionAttempts)) {
+        abandonSession();
+        return;
+    }
+
+    if (!this->reconnectionAttempts) {
+        this->stateBeforeDisconnection = this->state;
+        beginLoading(); // the current page stays as is, the controls are blocked until the session is resumed
+    }
+
+    this->state = STATE_AWAITING_AUTHENTICATION;
+    scheduleReconnection();
+}
+
+static void onDisconnected(void) { lifecycleAsync((LifecycleAsyncActionFunction) &processDisconnection, NULL, 0); }
+
+static void processConnectionFailure(void) {
+    assert(this && this->netConnection && this->pendingCredentials);
+    netClean(this->netConnection);
+
+    if (this->reconnectionAttempts)
+        scheduleReconnection();
+    else {
+        this->state = STATE_UNAUTHENTICATED;
+        renderShowUnableToConnectToTheServerError();
+
+        if (this->autoLoggingIn)
+            renderShowLogIn();
+
+        finishLoading();
+    }
+
+    dropCredentials(&(this->pendingCredentials));
+}
+
+static void onConnected(bool successful) {
+    assert(this && this->pendingCredentials);
+
+    if (!successful) {
+        lifecycleAsync((LifecycleAsyncActionFunction) &processConnectionFailure, NULL, 0);
+        return;
+    }
+
+    const char* username = this->pendingCredentials;
+    const char* password = this->pendingCredentials + NET_USERNAME_SIZE;
+    this->pendingLogIn ? netLogIn(this->netConnection, username, password) : netRegister(this->netConnection, username, password);
+
+    if (this->pendingLogIn && !this->sessionCredentials) {
+        this->sessionCredentials = this->pendingCredentials; // dropped if the log in fails
+        this->pendingCredentials = NULL;
+        return;
+    }
+
+    dropCredentials(&(this->pendingCredentials));
+}
+
 static void fetchMissingMessagesFromUser(unsigned id) {
     assert(this && this->databaseInitialized);
-    this->missingMessagesFetchers++;
 
     const unsigned long timestamp = databaseGetMostRecentMessageTimestamp(id),
         minimalPossibleTimestamp = databaseGetConversationTimestamp(id) + 1;
 
     assert(timestamp < logicCurrentTimeMillis());
-    netFetchMessages(id, timestamp < minimalPossibleTimestamp ? minimalPossibleTimestamp : timestamp);
+    netFetchMessages(this->netConnection, id, timestamp < minimalPossibleTimestamp ? minimalPossibleTimestamp : timestamp);
+}
+
+static void fetchNextMissingMessages(void) { // the queue & the counter are only touched from the async thread
+    assert(queueSize(this->userIdsToFetchMessagesFrom));
+    this->missingMessagesFetchers++;
+    fetchMissingMessagesFromUser((unsigned) (long) queuePop(this->userIdsToFetchMessagesFrom));
 }
 
 static void processFetchedUsers(List* userInfosList) {
     assert(this && this->databaseInitialized && !this->missingMessagesFetchers);
     listClear(this->usersList);
+    this->usersListOutdated = false;
 
     const unsigned size = listSize(userInfosList);
     const NetUserInfo* info;
@@ -298,7 +459,7 @@ static void processFetchedUsers(List* userInfosList) {
         info = listGet(userInfosList, i);
         id = netUserInfoId(info);
 
-        if (id != netCurrentUserId()) {
+        if (id != netCurrentUserId(this->netConnection)) {
             conversationExists = databaseConversationExists(id);
 
             listAddBack(this->usersList, userCreate(
@@ -318,23 +479,55 @@ static void processFetchedUsers(List* userInfosList) {
     }
     listDestroy(userInfosList);
 
-    renderShowUsersList(this->currentUserName);
+    if (!this->resumingConversation) renderShowUsersList(this->currentUserName);
+    this->resumingConversation = false;
 
     if (!queueSize(this->userIdsToFetchMessagesFrom)) {
-        netSetIgnoreUsualMessages(false);
+        netSetIgnoreUsualMessages(this->netConnection, false);
         finishLoading(); // if at least one conversation exists, then begin outdated/missing messages fetching, otherwise do nothing and release locks
     } else
-        fetchMissingMessagesFromUser((unsigned) (long) queuePop(this->userIdsToFetchMessagesFrom));
+        for (unsigned i = 0; i < MAX_PARALLEL_MESSAGES_FETCHES && queueSize(this->userIdsToFetchMessagesFrom); fetchNextMissingMessages(), i++); // the rest are fetched as these finish
+}
+
+static void patchUserPresence(unsigned* parameters) {
+    assert(this);
+    const unsigned id = parameters[0];
+    const bool connected = parameters[1];
+    SDL_free(parameters);
+
+    User* user = (User*) findUser(id); // the list's items are only modified from the async thread
+    if (user)
+        user->online = connected; // patched in place, the rest of the list stays as is
+    else if (id != netCurrentUserId(this->netConnection))
+        this->usersListOutdated = true; // either registered after the list was fetched or the list is being fetched right now
+}
+
+static void onPresenceChanged(unsigned id, bool connected) {
+    unsigned* parameters = SDL_malloc(2 * sizeof(int));
+    parameters[0] = id;
+    parameters[1] = connected;
+    lifecycleAsync((LifecycleAsyncActionFunction) &patchUserPresence, parameters, 0); // after the list gets filled if it's being fetched
 }
 
 static void onUsersFetched(List* userInfosList) {
     List* xUserInfosList = listCopy(userInfosList, (ListItemDuplicator) &netUserInfoCopy);
-    netSetIgnoreUsualMessages(true);
+    netSetIgnoreUsualMessages(this->netConnection, true);
     lifecycleAsync((LifecycleAsyncActionFunction) &processFetchedUsers, xUserInfosList, 0);
 }
 
-static void fetchMissingMessagesFromUserWrapper(const void* id)
-{ fetchMissingMessagesFromUser((unsigned) (long) id); }
+static void finishMessagesFetch(void) { // called on the async thread once the last message of a conversation has been fetched & stored, begins fetching from the next one if any
+    assert(this->missingMessagesFetchers);
+    this->missingMessagesFetchers--;
+
+    if (queueSize(this->userIdsToFetchMessagesFrom)) {
+        fetchNextMissingMessages(); // keeps the pipeline full
+        return;
+    }
+
+    if (this->missingMessagesFetchers) return;
+    netSetIgnoreUsualMessages(this->netConnection, false);
+    finishLoading();
+}
 
 static void onNextMessageFetched(
     unsigned from,
@@ -349,20 +542,63 @@ static void onNextMessageFetched(
     if (size > 0) onMessageReceived(timestamp, from, message, size);
 
     assert(this->missingMessagesFetchers);
+    if (last) lifecycleAsync((LifecycleAsyncActionFunction) &finishMessagesFetch, NULL, 0); // after the messages fetched before it are stored
+}
 
-    if (!last) return;
-    this->missingMessagesFetchers--;
-    assert(this->missingMessagesFetchers < 0u - 1u); // check overflow
+typedef struct {
+    unsigned count;
+    bool last;
+    NetFetchedMessage messages[]; // with copied messages' bytes
+} FetchedMessagesBatch;
 
-    if (queueSize(this->userIdsToFetchMessagesFrom))
-        lifecycleAsync((LifecycleAsyncActionFunction) &fetchMissingMessagesFromUserWrapper, queuePop(this->userIdsToFetchMessagesFrom), 0);
+static void processFetchedMessagesBatch(FetchedMessagesBatch* batch) {
+    assert(this && this->databaseInitialized);
 
-    assert(this->missingMessagesFetchers == queueSize(this->userIdsToFetchMessagesFrom));
+    DatabaseMessage* dbMessages[batch->count ? batch->count : 1];
+    unsigned stored = 0;
 
-    if (this->missingMessagesFetchers) return;
-    queueClear(this->userIdsToFetchMessagesFrom);
-    netSetIgnoreUsualMessages(false);
-    finishLoading();
+    for (unsigned i = 0; i < batch->count; i++) {
+        const NetFetchedMessage* fetched = &(batch->messages[i]);
+
+        const User* user = findUser(fetched->from);
+        if (!user) continue; // see processReceivedMessage
+
+        unsigned size;
+        byte* message = decryptReceivedMessage(fetched->from, fetched->message, fetched->size, &size);
+        if (!message) continue;
+
+        dbMessages[stored++] = databaseMessageCreate(fetched->timestamp, fetched->from, fetched->from, message, size);
+
+        if (fetched->from == this->toUserId)
+            listAddFront(this->messagesList, conversationMessageCreate(fetched->timestamp, user->name, NET_USERNAME_SIZE, (const char*) message, size));
+
+        SDL_free(message);
+    }
+
+    if (stored) assert(databaseAddMessages((const DatabaseMessage* const*) dbMessages, stored)); // a single transaction for the whole batch instead of one per message
+    for (unsigned i = 0; i < stored; databaseMessageDestroy(dbMessages[i++]));
+    for (unsigned i = 0; i < batch->count; SDL_free((byte*) batch->messages[i++].message));
+
+    const bool last = batch->last;
+    SDL_free(batch);
+
+    if (last) finishMessagesFetch(); // after the messages are stored, so the next fetch starts from the most recent one
+}
+
+static void onMessagesBatchFetched(__attribute_maybe_unused__ unsigned conversation, const NetFetchedMessage* messages, unsigned count, bool last) {
+    assert(this && this->missingMessagesFetchers);
+
+    FetchedMessagesBatch* batch = SDL_malloc(sizeof *batch + count * sizeof(NetFetchedMessage));
+    batch->count = count;
+    batch->last = last;
+
+    for (unsigned i = 0; i < count; i++) {
+        batch->messages[i] = messages[i];
+        batch->messages[i].message = SDL_malloc(messages[i].size);
+        SDL_memcpy((byte*) batch->messages[i].message, messages[i].message, messages[i].size);
+    }
+
+    lifecycleAsync((LifecycleAsyncActionFunction) &processFetchedMessagesBatch, batch, 0); // the whole batch is processed in one go
 }
 
 static void tryLoadPreviousMessages(unsigned id) {
@@ -379,7 +615,7 @@ static void tryLoadPreviousMessages(unsigned id) {
     bool fromCurrentUser;
     for (unsigned i = 0; i < listSize(messages); i++) {
         dbMessage = listGet(messages, i);
-        fromCurrentUser = databaseMessageFrom(dbMessage) == netCurrentUserId();
+        fromCurrentUser = databaseMessageFrom(dbMessage) == netCurrentUserId(this->netConnection);
 
         listAddBack(this->messagesList, conversationMessageCreate(
             databaseMessageTimestamp(dbMessage),
@@ -393,7 +629,25 @@ static void tryLoadPreviousMessages(unsigned id) {
     listDestroy(messages);
 }
 
-static inline void updateUsersList(void) { logicOnUpdateUsersListClicked(); }
+static void refetchUsersList(void) {
+    assert(this && this->databaseInitialized && !this->missingMessagesFetchers);
+    beginLoading();
+
+    listClear(this->usersList);
+    renderShowUsersList(this->currentUserName);
+
+    lifecycleAsync((LifecycleAsyncActionFunction) &fetchUsers, NULL, 0);
+}
+
+static void updateUsersList(unsigned id) { // after a conversation with the user has been either created or deleted
+    User* user = this->netConnection && netPresencePushed(this->netConnection) && !this->usersListOutdated ? (User*) findUser(id) : NULL;
+    if (user) {
+        user->conversationExists = databaseConversationExists(id); // the rest is kept up to date by the server's pushes
+        return;
+    }
+
+    refetchUsersList();
+}
 
 static void replyToConversationSetUpInvite(unsigned* fromId) {
     assert(this && fromId);
@@ -409,19 +663,36 @@ static void replyToConversationSetUpInvite(unsigned* fromId) {
     const User* user = findUser(xFromId);
     if (!user) goto releaseLocks; // if local users list hasn't been synchronized yet
 
-    CryptoCoderStreams* coderStreams = netReplyToConversationSetUpInvite(renderShowInviteDialog(user->name), xFromId);
-    if (coderStreams)
-        this->toUserId = xFromId, // not only in python there's indentation based scoping, here's an emulation though
-        this->state = STATE_EXCHANGING_MESSAGES,
+    const bool accepted = renderShowInviteDialog(user->name);
+    if (!netReplyToConversationSetUpInvite(this->netConnection, accepted, xFromId) && accepted) // the rest of the setup proceeds in the background, onConversationSetUp is called at the end
+        renderShowUnableToCreateConversation();
+
+    releaseLocks:
+    finishLoading();
+}
 
-        assert(databaseAddConversation(xFromId, coderStreams, logicCurrentTimeMillis())),
+static void finishConversationSetUp(void** parameters) {
+    unsigned* id = parameters[0];
+    CryptoCoderStreams* nullable coderStreams = parameters[1];
+    assert(this && this->databaseInitialized);
+
+    if (coderStreams)
+        assert(databaseAddConversation(*id, coderStreams, logicCurrentTimeMillis())),
         cryptoCoderStreamsDestroy(coderStreams),
-        updateUsersList();
+        updateUsersList(*id);
     else
         renderShowUnableToCreateConversation();
 
-    releaseLocks:
-    finishLoading();
+    SDL_free(id);
+    SDL_free(parameters);
+}
+
+static void onConversationSetUp(unsigned peerId, CryptoCoderStreams* nullable coderStreams) {
+    void** parameters = SDL_malloc(2 * sizeof(void*));
+    (parameters[0] = SDL_malloc(sizeof(int))) && (*((unsigned*) parameters[0]) = peerId);
+    parameters[1] = coderStreams;
+
+    lifecycleAsync((LifecycleAsyncActionFunction) &finishConversationSetUp, parameters, 0);
 }
 
 static void onConversationSetUpInviteReceived(unsigned fromId) {
@@ -438,9 +709,89 @@ void logicOnFileChooserRequested(void) {
     renderShowFileChooser();
 }
 
-static byte* nullable calculateOpenedFileChecksum(void) {
-    assert(this->rwops);
+static FileTransfer* nullable reserveFileTransfer(unsigned id, unsigned peerId, bool outgoing, SDL_RWops* rwops, unsigned fileSize) { // returns null if there are too many of them
+    SDL_LockMutex(this->fileTransfersMutex);
+
+    FileTransfer* transfer = NULL;
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS && !transfer; i++) {
+        if (this->fileTransfers[i].active) continue;
+        transfer = &(this->fileTransfers[i]);
+
+        SDL_memset(transfer, 0, sizeof *transfer);
+        transfer->active = true;
+        transfer->id = id;
+        transfer->peerId = peerId;
+        transfer->outgoing = outgoing;
+        transfer->rwops = rwops;
+        transfer->fileSize = fileSize;
+    }
 
+    SDL_UnlockMutex(this->fileTransfersMutex);
+    return transfer;
+}
+
+static FileTransfer* nullable findFileTransfer(unsigned id) { // the found transfer stays in place until it's taken, which happens only after the net module has finished with it
+    SDL_LockMutex(this->fileTransfersMutex);
+
+    FileTransfer* transfer = NULL;
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS && !transfer; i++)
+        if (this->fileTransfers[i].active && this->fileTransfers[i].id == id)
+            transfer = &(this->fileTransfers[i]);
+
+    SDL_UnlockMutex(this->fileTransfersMutex);
+    return transfer;
+}
+
+static bool takeFileTransfer(FileTransfer* transfer, FileTransfer* taken) { // frees the slot, returns false if it has already been taken by someone else
+    SDL_LockMutex(this->fileTransfersMutex);
+
+    const bool active = transfer->active;
+    if (active) {
+        *taken = *transfer;
+        transfer->active = false;
+    }
+
+    SDL_UnlockMutex(this->fileTransfersMutex);
+    return active;
+}
+
+static bool closeFileTransfer(FileTransfer* transfer, bool successful) { // closes the taken transfer's file, removes the received one if it's broken; returns the final result
+    assert(!SDL_RWclose(transfer->rwops));
+    successful = successful && transfer->bytesCounter == transfer->fileSize;
+
+    if (transfer->hashState) {
+        byte* hash = cryptoHashMultipart(transfer->hashState, NULL, 0);
+        successful = successful && !SDL_memcmp(transfer->hash, hash, CRYPTO_HASH_SIZE);
+        SDL_free(hash);
+    }
+
+    if (!transfer->outgoing && !successful) unlink(transfer->filePath);
+    SDL_free(transfer->filePath);
+    SDL_free(transfer->hash);
+    SDL_free(transfer->compressionBuffer);
+    return successful;
+}
+
+static bool abortFileTransfers(void) { // the net module's transfer ids are valid only until it gets cleaned up; returns true if there were any
+    FileTransfer taken[MAX_FILE_TRANSFERS];
+    unsigned count = 0;
+
+    SDL_LockMutex(this->fileTransfersMutex);
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS; i++) {
+        FileTransfer* transfer = &(this->fileTransfers[i]);
+        if (!transfer->active || !transfer->id) continue; // those without ids are being begun & get aborted by their initiators
+
+        taken[count++] = *transfer;
+        transfer->active = false;
+    }
+    SDL_UnlockMutex(this->fileTransfersMutex);
+
+    for (unsigned i = 0; i < count; i++)
+        closeFileTransfer(&(taken[i]), false);
+    return count > 0;
+}
+
+static byte* nullable calculateOpenedFileChecksum(SDL_RWops* rwops) {
     const unsigned bufferSize = maxUnencryptedMessageBodySize();
     byte buffer[bufferSize];
     SDL_memset(buffer, 0, bufferSize);
@@ -449,13 +800,13 @@ static byte* nullable calculateOpenedFileChecksum(void) {
     bool read = false;
     unsigned count;
 
-    while ((count = SDL_RWread(this->rwops, buffer, 1, bufferSize)) > 0) {
+    while ((count = SDL_RWread(rwops, buffer, 1, bufferSize)) > 0) {
         read = true;
         cryptoHashMultipart(state, buffer, count);
         SDL_memset(buffer, 0, bufferSize);
     }
 
-    SDL_RWseek(this->rwops, 0, RW_SEEK_SET);
+    SDL_RWseek(rwops, 0, RW_SEEK_SET);
 
     byte* hash = NULL;
     if (!read)
@@ -466,35 +817,44 @@ static byte* nullable calculateOpenedFileChecksum(void) {
     return hash;
 }
 
+static bool fileWorthCompressing(SDL_RWops* rwops) { // compresses the beginning of the opened file, already compressed ones (media, archives) aren't worth spending time on
+    byte sample[FILE_COMPRESSION_SAMPLE_SIZE], compressed[FILE_COMPRESSION_SAMPLE_SIZE];
+
+    const unsigned read = SDL_RWread(rwops, sample, 1, sizeof sample);
+    SDL_RWseek(rwops, 0, RW_SEEK_SET);
+    if (!read) return false;
+
+    unsigned consumed = 0;
+    const unsigned compressedSize = lzCompress(sample, read, compressed, sizeof compressed, &consumed);
+    return consumed == read && compressedSize < read - read / 8; // saves at least an eighth
+}
+
 static void beginFileExchange(void** parameters) {
     assert(this);
-    this->fileBytesCounter = 0;
 
-    const unsigned fileSize = (long) parameters[0];
+    FileTransfer* transfer = parameters[0];
+    const unsigned filenameSize = (long) parameters[1];
+    char* filename = parameters[2];
+    SDL_free(parameters);
 
-    byte* hash = calculateOpenedFileChecksum();
+    const bool compress = fileWorthCompressing(transfer->rwops); // the receiver may still refuse the compression
+    byte* hash = calculateOpenedFileChecksum(transfer->rwops);
     assert(hash);
 
-    if (!netBeginFileExchange(
-        this->toUserId,
-        fileSize,
-        hash,
-        parameters[2],
-        (long) parameters[1]
-    ) || this->fileBytesCounter != fileSize) // blocks the thread until file is fully transmitted or error occurred or receiver declined the exchanging
-        renderShowUnableToTransmitFileError();
-    else
-        renderShowFileTransmittedSystemMessage();
-
-    SDL_free(parameters[2]);
-    SDL_free(parameters);
+    SDL_LockMutex(this->fileTransfersMutex);
+    const unsigned id = transfer->id = this->netConnection ? netNextFileTransferId(this->netConnection) : 0;
+    SDL_UnlockMutex(this->fileTransfersMutex);
 
-    assert(!SDL_RWclose(this->rwops));
-    this->rwops = NULL;
+    if (!id || !netBeginFileExchange(this->netConnection, id, transfer->peerId, transfer->fileSize, hash, filename, filenameSize, compress)) { // the result arrives in onFileExchangeFinished
+        FileTransfer taken;
+        if (takeFileTransfer(transfer, &taken)) closeFileTransfer(&taken, false);
+        renderShowUnableToTransmitFileError();
+    }
 
+    SDL_free(filename);
     SDL_free(hash);
 
-    finishLoading();
+    finishLoading(); // the file is being sent in background while the user does other things
 }
 
 static const char* nullable xBasename(const char* path) {
@@ -534,20 +894,18 @@ void logicFileChooseResultHandler(const char* nullable filePath, unsigned size)
         return;
     }
 
-    assert(!this->rwops);
-    this->rwops = SDL_RWFromFile(filePath, "rb");
+    SDL_RWops* rwops = SDL_RWFromFile(filePath, "rb");
 
-    if (!this->rwops) {
+    if (!rwops) {
         finishLoading();
         renderShowCannotOpenFileError();
         return;
     }
 
-    const long fileSize = SDL_RWsize(this->rwops);
+    const long fileSize = SDL_RWsize(rwops);
 
     if (fileSize < 0 || !fileSize) {
-        assert(!SDL_RWclose(this->rwops));
-        this->rwops = NULL;
+        assert(!SDL_RWclose(rwops));
 
         finishLoading();
         renderShowFileIsEmptyError();
@@ -555,8 +913,7 @@ void logicFileChooseResultHandler(const char* nullable filePath, unsigned size)
     }
 
     if (fileSize > MAX_FILE_SIZE) {
-        assert(!SDL_RWclose(this->rwops));
-        this->rwops = NULL;
+        assert(!SDL_RWclose(rwops));
 
         finishLoading();
         renderShowFileIsTooBig();
@@ -566,10 +923,28 @@ void logicFileChooseResultHandler(const char* nullable filePath, unsigned size)
     const char* filename = xBasename(filePath);
     assert(filename);
     const unsigned long filenameSize = SDL_strlen(filename);
-    assert(filenameSize && filenameSize <= NET_MAX_FILENAME_SIZE);
+    assert(filenameSize);
+
+    if (filenameSize > NET_MAX_FILENAME_SIZE) {
+        assert(!SDL_RWclose(rwops));
+
+        finishLoading();
+        renderShowFilenameIsTooLong();
+        return;
+    }
+
+    FileTransfer* transfer = reserveFileTransfer(0, this->toUserId, true, rwops, (unsigned) fileSize);
+
+    if (!transfer) {
+        assert(!SDL_RWclose(rwops));
+
+        finishLoading();
+        renderShowUnableToTransmitFileError();
+        return;
+    }
 
     void** parameters = SDL_malloc(3 * sizeof(void*));
-    parameters[0] = (void*) fileSize;
+    parameters[0] = transfer;
     parameters[1] = (void*) filenameSize;
     (parameters[2] = SDL_malloc(filenameSize)) && SDL_memcpy(parameters[2], filename, filenameSize);
 
@@ -578,24 +953,25 @@ void logicFileChooseResultHandler(const char* nullable filePath, unsigned size)
 
 static void replyToFileExchangeRequest(void** parameters) {
     assert(this);
-    this->fileBytesCounter = 0;
 
     const unsigned
-        fromId = *((unsigned*) parameters[0]),
-        fileSize = *((unsigned*) parameters[1]),
-        filenameSize = *((unsigned*) parameters[3]);
+        transferId = *((unsigned*) parameters[0]),
+        fromId = *((unsigned*) parameters[1]),
+        fileSize = *((unsigned*) parameters[2]),
+        filenameSize = *((unsigned*) parameters[4]);
+    const bool compressed = (long) parameters[6];
 
     byte originalHash[CRYPTO_HASH_SIZE];
-    SDL_memcpy(originalHash, parameters[2], CRYPTO_HASH_SIZE); // TODO: excessive copy operations
+    SDL_memcpy(originalHash, parameters[3], CRYPTO_HASH_SIZE); // TODO: excessive copy operations
 
     char filename[filenameSize];
-    SDL_memcpy(filename, parameters[4], filenameSize);
+    SDL_memcpy(filename, parameters[5], filenameSize);
 
-    for (byte i = 0; i < 5; SDL_free(parameters[i++]));
+    for (byte i = 0; i < 6; SDL_free(parameters[i++]));
     SDL_free(parameters);
 
     const User* user = findUser(fromId);
-    if (!user) {
+    if (!user || !this->netConnection) {
         finishLoading();
         return;
     }
@@ -604,7 +980,7 @@ static void replyToFileExchangeRequest(void** parameters) {
     assert(this);
 
     if (!accepted) {
-        assert(!netReplyToFileExchangeInvite(fromId, fileSize, false)); // blocks the thread again
+        if (this->netConnection) assert(!netReplyToFileExchangeInvite(this->netConnection, transferId, false));
         finishLoading();
         renderShowUnableToTransmitFileError();
         return;
@@ -627,132 +1003,202 @@ static void replyToFileExchangeRequest(void** parameters) {
     char filePath[LOGIC_MAX_FILE_PATH_SIZE];
     const unsigned written = SDL_snprintf(
         filePath, LOGIC_MAX_FILE_PATH_SIZE,
-        "%s/%lu_%s",
+        "%s/%lu_%u_%s", // the transfer id keeps names of files received at the same millisecond apart
         filesDir,
         logicCurrentTimeMillis(),
+        transferId,
         filename
     );
     assert(written > 0 && written <= LOGIC_MAX_FILE_PATH_SIZE);
 
-    assert(!this->rwops);
-    this->rwops = SDL_RWFromFile(filePath, "wb");
+    SDL_RWops* rwops = SDL_RWFromFile(filePath, "wb");
+    FileTransfer* transfer = rwops ? reserveFileTransfer(transferId, fromId, false, rwops, fileSize) : NULL;
+
+    if (!transfer) {
+        if (rwops) {
+            assert(!SDL_RWclose(rwops));
+            unlink(filePath);
+        }
 
-    if (!this->rwops) {
-        assert(!netReplyToFileExchangeInvite(fromId, fileSize, false)); // blocks the thread again
+        if (this->netConnection) assert(!netReplyToFileExchangeInvite(this->netConnection, transferId, false));
         finishLoading();
         renderShowUnableToTransmitFileError();
         return;
     }
 
-    assert(!this->fileHashState);
-    const bool exchangeResult = netReplyToFileExchangeInvite(fromId, fileSize, true); // blocks the thread again
-    assert(!SDL_RWclose(this->rwops));
-    this->rwops = NULL;
-
-    bool hashesEqual = false;
-    if (this->fileHashState) {
-        byte* hash = cryptoHashMultipart(this->fileHashState, NULL, 0);
-        this->fileHashState = NULL;
-
-        hashesEqual = !SDL_memcmp(originalHash, hash, CRYPTO_HASH_SIZE);
-        SDL_free(hash);
-    }
+    (transfer->hash = SDL_malloc(CRYPTO_HASH_SIZE)) && SDL_memcpy(transfer->hash, originalHash, CRYPTO_HASH_SIZE);
+    transfer->hashState = cryptoHashMultipart(NULL, NULL, 0);
+    (transfer->filePath = SDL_malloc(written + 1)) && SDL_memcpy(transfer->filePath, filePath, written + 1);
+    transfer->compressed = compressed;
 
-    if (!exchangeResult || this->fileBytesCounter != fileSize || !hashesEqual) {
+    if (!this->netConnection || !netReplyToFileExchangeInvite(this->netConnection, transferId, true)) { // the result arrives in onFileExchangeFinished
+        FileTransfer taken;
+        if (takeFileTransfer(transfer, &taken)) closeFileTransfer(&taken, false);
         renderShowUnableToTransmitFileError();
-        unlink(filePath);
-    } else
-        renderShowFileTransmittedSystemMessage();
+    }
 
-    assert(!this->rwops);
-    finishLoading();
+    finishLoading(); // the file is being received in background
 }
 
 static void onFileExchangeInviteReceived(
+    unsigned transferId,
     unsigned fromId,
     unsigned fileSize,
     const byte* originalHash,
     const char* filename,
-    unsigned filenameSize
+    unsigned filenameSize,
+    bool compressed
 ) {
     assert(this);
     beginLoading();
 
-    void** parameters = SDL_malloc(5 * sizeof(void*));
-    (parameters[0] = SDL_malloc(sizeof(int))) && (*((unsigned*) parameters[0]) = fromId);
-    (parameters[1] = SDL_malloc(sizeof(int))) && (*((unsigned*) parameters[1]) = fileSize);
-    (parameters[2] = SDL_malloc(CRYPTO_HASH_SIZE)) && SDL_memcpy(parameters[2], originalHash, CRYPTO_HASH_SIZE);
-    (parameters[3] = SDL_malloc(sizeof(int))) && (*((unsigned*) parameters[3]) = filenameSize);
-    (parameters[4] = SDL_malloc(filenameSize)) && SDL_memcpy(parameters[4], filename, filenameSize);
+    void** parameters = SDL_malloc(7 * sizeof(void*));
+    (parameters[0] = SDL_malloc(sizeof(int))) && (*((unsigned*) parameters[0]) = transferId);
+    (parameters[1] = SDL_malloc(sizeof(int))) && (*((unsigned*) parameters[1]) = fromId);
+    (parameters[2] = SDL_malloc(sizeof(int))) && (*((unsigned*) parameters[2]) = fileSize);
+    (parameters[3] = SDL_malloc(CRYPTO_HASH_SIZE)) && SDL_memcpy(parameters[3], originalHash, CRYPTO_HASH_SIZE);
+    (parameters[4] = SDL_malloc(sizeof(int))) && (*((unsigned*) parameters[4]) = filenameSize);
+    (parameters[5] = SDL_malloc(filenameSize)) && SDL_memcpy(parameters[5], filename, filenameSize);
+    parameters[6] = (void*) (long) compressed;
 
     lifecycleAsync((LifecycleAsyncActionFunction) &replyToFileExchangeRequest, parameters, 0);
 }
 
-static unsigned nextFileChunkSupplier(unsigned index, byte* encryptedBuffer) { // TODO: notify user when a new message has been received
-    assert(this && this->rwops);
-    const unsigned targetSize = maxUnencryptedMessageBodySize();
+static void finishFileExchange(void** parameters) {
+    assert(this);
 
-    byte unencryptedBuffer[targetSize];
-    const unsigned actualSize = SDL_RWread(this->rwops, unencryptedBuffer, 1, targetSize);
-    if (!actualSize) goto finish;
+    const unsigned transferId = (long) parameters[0];
+    const bool successful = (long) parameters[1];
+    SDL_free(parameters);
 
-    CryptoCoderStreams* coderStreams = databaseGetConversation(this->toUserId);
+    FileTransfer* transfer = findFileTransfer(transferId), taken;
+    if (!transfer || !takeFileTransfer(transfer, &taken)) return; // aborted on disconnection
+
+    closeFileTransfer(&taken, successful)
+        ? renderShowFileTransmittedSystemMessage()
+        : renderShowUnableToTransmitFileError();
+}
+
+static void onFileExchangeFinished(unsigned transferId, bool successful) {
+    assert(this);
+
+    void** parameters = SDL_malloc(2 * sizeof(void*));
+    parameters[0] = (void*) (long) transferId;
+    parameters[1] = (void*) (long) successful;
+
+    lifecycleAsync((LifecycleAsyncActionFunction) &finishFileExchange, parameters, 0); // as the file's hash gets verified
+}
+
+static unsigned compressFileChunk(FileTransfer* transfer, byte* chunk, unsigned chunkSize, unsigned* consumed) { // fills the chunk with either raw or compressed bytes of the file, whichever carries more of it; returns the chunk's size, 0 at the end of the file
+    assert(chunkSize > COMPRESSED_CHUNK_HEAD_SIZE);
+
+    const unsigned readAheadSize = chunkSize * FILE_COMPRESSION_READ_AHEAD;
+    if (!transfer->compressionBuffer) transfer->compressionBuffer = SDL_malloc(readAheadSize); // the chunk size stays the same throughout the transfer
+
+    const unsigned read = SDL_RWread(transfer->rwops, transfer->compressionBuffer, 1, readAheadSize);
+    if (!read) return 0;
+
+    unsigned size = COMPRESSED_CHUNK_HEAD_SIZE + lzCompress(transfer->compressionBuffer, read, chunk + COMPRESSED_CHUNK_HEAD_SIZE, chunkSize - COMPRESSED_CHUNK_HEAD_SIZE, consumed);
+
+    if (*consumed > chunkSize - 1) {
+        chunk[0] = CHUNK_MODE_COMPRESSED;
+        *(unsigned*) (chunk + 1) = *consumed;
+    } else { // incompressible bytes go as is
+        *consumed = min(read, chunkSize - 1);
+        chunk[0] = CHUNK_MODE_RAW;
+        SDL_memcpy(chunk + 1, transfer->compressionBuffer, *consumed);
+        size = 1 + *consumed;
+    }
+
+    SDL_RWseek(transfer->rwops, (long) *consumed - (long) read, RW_SEEK_CUR); // the unconsumed bytes go into the next chunk
+    return size;
+}
+
+static unsigned nextFileChunkSupplier(unsigned transferId, unsigned index, byte* encryptedBuffer, unsigned bufferSize, bool compressed) { // TODO: notify user when a new message has been received
+    assert(this);
+    assert(bufferSize > cryptoEncryptedSize(0));
+    const unsigned targetSize = bufferSize - cryptoEncryptedSize(0); // bufferSize is negotiated with the receiver
+
+    FileTransfer* transfer = findFileTransfer(transferId);
+    if (!transfer) return 0;
+
+    byte* chunk = encryptedBuffer + CRYPTO_IN_PLACE_OFFSET; // the chunk gets encrypted right in the buffer
+    unsigned consumed = 0;
+
+    const unsigned actualSize = compressed // the compression goes before the encryption as encrypted bytes are incompressible
+        ? compressFileChunk(transfer, chunk, targetSize, &consumed)
+        : (consumed = SDL_RWread(transfer->rwops, chunk, 1, targetSize));
+    if (!actualSize) return 0;
+
+    CryptoCoderStreams* coderStreams = databaseGetConversation(transfer->peerId); // chunks are encrypted independently of each other, so transfers can interleave
     assert(coderStreams);
 
     const unsigned encryptedSize = cryptoEncryptedSize(actualSize);
-    assert(encryptedSize <= NET_MAX_MESSAGE_BODY_SIZE);
-
-    byte* encryptedChunk = cryptoEncrypt(coderStreams, unencryptedBuffer, actualSize, false);
-    assert(encryptedChunk);
-    SDL_memcpy(encryptedBuffer, encryptedChunk, encryptedSize);
-    SDL_free(encryptedChunk);
+    assert(encryptedSize <= bufferSize);
 
+    assert(cryptoEncryptInPlace(coderStreams, encryptedBuffer, actualSize, false));
     cryptoCoderStreamsDestroy(coderStreams);
 
-    if (!index) assert(!this->fileBytesCounter);
-    this->fileBytesCounter += actualSize;
+    if (!index) assert(!transfer->bytesCounter);
+    transfer->bytesCounter += consumed;
     return encryptedSize;
+}
+
+static const byte* nullable decompressFileChunk(const FileTransfer* transfer, const byte* chunk, unsigned* size) { // takes the size of the chunk made by compressFileChunk & replaces it with the count of the file's bytes it carries, which are returned either inside the chunk or in a new buffer; returns null if the chunk is malformed
+    if (*size > 1 && chunk[0] == CHUNK_MODE_RAW) {
+        (*size)--;
+        return chunk + 1;
+    }
+
+    if (*size <= COMPRESSED_CHUNK_HEAD_SIZE || chunk[0] != CHUNK_MODE_COMPRESSED) return NULL;
+
+    const unsigned rawSize = *(unsigned*) (chunk + 1);
+    if (!rawSize || rawSize > transfer->fileSize || transfer->bytesCounter > transfer->fileSize - rawSize) return NULL; // a forged size can't make the receiver allocate more than the rest of the file
+
+    byte* raw = SDL_malloc(rawSize);
+    if (lzDecompress(chunk + COMPRESSED_CHUNK_HEAD_SIZE, *size - COMPRESSED_CHUNK_HEAD_SIZE, raw, rawSize) != rawSize) {
+        SDL_free(raw);
+        return NULL;
+    }
 
-    finish:
-    assert(index);
-    // this->rwops is freed elsewhere
-    return 0;
+    *size = rawSize;
+    return raw;
 }
 
 static void nextFileChunkReceiver(
-    unsigned fromId,
+    unsigned transferId,
     unsigned index,
     unsigned receivedBytesCount,
     const byte* encryptedBuffer
 ) {
-    assert(this && this->rwops);
+    assert(this);
+
+    FileTransfer* transfer = findFileTransfer(transferId);
+    if (!transfer || receivedBytesCount <= cryptoEncryptedSize(0)) return;
 
     const unsigned decryptedSize = receivedBytesCount - cryptoEncryptedSize(0);
-    assert(decryptedSize && decryptedSize <= maxUnencryptedMessageBodySize());
+    assert(decryptedSize <= netMaxMessageBodySize(this->netConnection) - cryptoEncryptedSize(0));
 
-    CryptoCoderStreams* coderStreams = databaseGetConversation(fromId);
+    CryptoCoderStreams* coderStreams = databaseGetConversation(transfer->peerId);
     assert(coderStreams);
 
     byte* decrypted = cryptoDecrypt(coderStreams, encryptedBuffer, receivedBytesCount, false);
-    assert(decrypted);
-
-    assert(SDL_RWwrite(this->rwops, decrypted, 1, decryptedSize) == decryptedSize);
+    cryptoCoderStreamsDestroy(coderStreams);
+    if (!decrypted) return; // the transfer then fails the hash check
 
-    if (!index) {
-        assert(!this->fileHashState);
-        this->fileHashState = cryptoHashMultipart(NULL, NULL, 0);
-    } else
-        assert(this->fileHashState);
-    cryptoHashMultipart(this->fileHashState, decrypted, decryptedSize);
+    if (!index) assert(!transfer->bytesCounter);
 
-    SDL_free(decrypted);
-
-    cryptoCoderStreamsDestroy(coderStreams);
+    unsigned size = decryptedSize;
+    const byte* bytes = transfer->compressed ? decompressFileChunk(transfer, decrypted, &size) : decrypted;
 
-    if (!index) assert(!this->fileBytesCounter);
-    this->fileBytesCounter += decryptedSize;
+    if (bytes) { // the original bytes get hashed, so the hash check verifies the decompression too
+        assert(SDL_RWwrite(transfer->rwops, bytes, 1, size) == size);
+        cryptoHashMultipart(transfer->hashState, bytes, size);
+        transfer->bytesCounter += size;
+    }
 
-    // this->fileHashState and this->rwops are freed elsewhere
+    if (bytes != decrypted && bytes != decrypted + 1) SDL_free((byte*) bytes);
+    SDL_free(decrypted);
 }
 
 void logicOnAdminActionsPageRequested(bool enter) {
@@ -762,10 +1208,10 @@ void logicOnAdminActionsPageRequested(bool enter) {
 }
 
 void logicOnBroadcastMessageSendRequested(const char* text, unsigned size) {
-    assert(this && this->netInitialized);
+    assert(this && this->netConnection);
     assert(!size || size <= NET_MAX_MESSAGE_BODY_SIZE && size <= RENDER_MAX_MESSAGE_SYSTEM_TEXT_SIZE);
     if (!size) return;
-    netSendBroadcast((const byte*) text, size);
+    netSendBroadcast(this->netConnection, (const byte*) text, size);
 }
 
 bool logicFilePresenceChecker(const char* file) { return !access(file, F_OK | R_OK); }
@@ -817,6 +1263,54 @@ void logicProcessEvent(SDL_Event* event) {
 
 // TODO: add possibility for admin to remove users from database; to disable/enable registration; to ban/unban users; to kick connected users
 
+static bool beginConnecting(const char* username, const char* password, bool logIn) { // returns false if connecting couldn't even begin
+    this->pendingCredentials = SDL_malloc(NET_USERNAME_SIZE + NET_UNHASHED_PASSWORD_SIZE);
+    SDL_memcpy(this->pendingCredentials, username, NET_USERNAME_SIZE);
+    SDL_memcpy(this->pendingCredentials + NET_USERNAME_SIZE, password, NET_UNHASHED_PASSWORD_SIZE);
+    this->pendingLogIn = logIn;
+
+    if (netInit(
+        &(this->netConnection), // set before the connecting begins as the connection may fail before netInit returns
+        optionsHost(),
+        optionsPort(),
+        NULL,
+        optionsServerSignPublicKey(),
+        optionsServerSignPublicKeySize(),
+        &onMessageReceived,
+        &onLogInResult,
+        &onErrorReceived,
+        &onRegisterResult,
+        &onDisconnected,
+        &logicCurrentTimeMillis,
+        &onUsersFetched,
+        &onConversationSetUpInviteReceived,
+        &onConversationSetUp,
+        &onFileExchangeInviteReceived,
+        &nextFileChunkSupplier,
+        &nextFileChunkReceiver,
+        &onFileExchangeFinished,
+        &onNextMessageFetched,
+        &onMessagesBatchFetched,
+        &onPresenceChanged,
+        &onBroadcastMessageReceived,
+        &onConnected,
+        NULL // the infinite progress bar is shown while connecting
+    )) return true; // the connection itself gets established asynchronously, the result arrives in onConnected
+
+    dropCredentials(&(this->pendingCredentials));
+    return false;
+}
+
+static void reconnect(void) {
+    assert(this && this->sessionCredentials && !this->netConnection);
+
+    this->missingMessagesFetchers = 0; // fetches that were interrupted by the disconnection are restarted from the most recent stored messages
+    queueClear(this->userIdsToFetchMessagesFrom);
+
+    if (!beginConnecting(this->sessionCredentials, this->sessionCredentials + NET_USERNAME_SIZE, true))
+        scheduleReconnection();
+}
+
 static void processCredentials(void** data) {
     const char* username = data[0];
     const char* password = data[1];
@@ -858,27 +1352,7 @@ static void processCredentials(void** data) {
         this->databaseInitialized = true;
 
     netInit:
-    this->netInitialized = netInit(
-        optionsHost(),
-        optionsPort(),
-        optionsServerSignPublicKey(),
-        optionsServerSignPublicKeySize(),
-        &onMessageReceived,
-        &onLogInResult,
-        &onErrorReceived,
-        &onRegisterResult,
-        &onDisconnected,
-        &logicCurrentTimeMillis,
-        &onUsersFetched,
-        &onConversationSetUpInviteReceived,
-        &onFileExchangeInviteReceived,
-        &nextFileChunkSupplier,
-        &nextFileChunkReceiver,
-        &onNextMessageFetched,
-        &onBroadcastMessageReceived
-    );
-
-    if (!this->netInitialized) {
+    if (!beginConnecting(username, password, logIn)) {
         this->state = STATE_UNAUTHENTICATED;
         renderShowUnableToConnectToTheServerError();
 
@@ -886,8 +1360,7 @@ static void processCredentials(void** data) {
             renderShowLogIn();
 
         finishLoading();
-    } else
-        logIn ? netLogIn(username, password) : netRegister(username, password);
+    }
 
     cleanup:
     logicCredentialsRandomFiller(data[0], NET_USERNAME_SIZE);
@@ -908,7 +1381,7 @@ void logicOnCredentialsReceived(
 ) {
     assert(this && usernameSize <= NET_USERNAME_SIZE && passwordSize <= NET_UNHASHED_PASSWORD_SIZE);
     if (this->state != STATE_UNAUTHENTICATED) return;
-    assert(!this->netInitialized);
+    assert(!this->netConnection);
 
     this->state = STATE_AWAITING_AUTHENTICATION;
     beginLoading();
@@ -941,16 +1414,8 @@ static void startConversation(void** parameters) {
 
     if (databaseConversationExists(*id))
         renderShowConversationAlreadyExists();
-    else {
-        CryptoCoderStreams* coderStreams = NULL;
-
-        if ((coderStreams = netCreateConversation(*id))) // blocks the thread until either an error has happened or the conversation has been created
-            assert(databaseAddConversation(*id, coderStreams, logicCurrentTimeMillis())),
-            cryptoCoderStreamsDestroy(coderStreams),
-            updateUsersList();
-        else
-            renderShowUnableToCreateConversation();
-    }
+    else if (!netCreateConversation(this->netConnection, *id)) // returns once the invite is queued, the conversation gets added in onConversationSetUp, so several ones can be set up at once
+        renderShowUnableToCreateConversation();
 
     SDL_free(id);
     SDL_free(parameters);
@@ -1003,10 +1468,9 @@ static void deleteConversation(unsigned* id) {
     } else
         renderShowConversationDoesntExist();
 
-    SDL_free(id);
-
     finishLoading();
-    updateUsersList();
+    updateUsersList(*id);
+    SDL_free(id);
 }
 
 void logicOnUserForConversationChosen(unsigned id, RenderConversationChooseVariants chooseVariant) {
@@ -1034,10 +1498,10 @@ void logicOnUserForConversationChosen(unsigned id, RenderConversationChooseVaria
 
 void logicOnServerShutdownRequested(void) {
     assert(this);
-    if (!this->netInitialized) return;
+    if (!this->netConnection) return;
 
     beginLoading();
-    lifecycleAsync((LifecycleAsyncActionFunction) &netShutdownServer, NULL, 0);
+    lifecycleAsync((LifecycleAsyncActionFunction) &shutdownServer, NULL, 0);
 }
 
 void logicOnReturnFromConversationPageRequested(void) {
@@ -1112,7 +1576,7 @@ static void sendMessage(void** params) {
     assert(size && size <= logicMaxMessagePlainPayloadSize());
 
     const byte* text = params[0];
-    DatabaseMessage* dbMessage = databaseMessageCreate(logicCurrentTimeMillis(), this->toUserId, netCurrentUserId(), text, size);
+    DatabaseMessage* dbMessage = databaseMessageCreate(logicCurrentTimeMillis(), this->toUserId, netCurrentUserId(this->netConnection), text, size);
     assert(databaseAddMessage(dbMessage));
     databaseMessageDestroy(dbMessage);
 
@@ -1128,7 +1592,7 @@ static void sendMessage(void** params) {
     SDL_free(paddedText);
     cryptoCoderStreamsDestroy(coderStreams);
 
-    netSend(NET_FLAG_PROCEED, encryptedText, encryptedSize, this->toUserId);
+    netSend(this->netConnection, NET_FLAG_PROCEED, encryptedText, encryptedSize, this->toUserId);
     SDL_free(encryptedText);
 
     SDL_free(params[0]);
@@ -1153,13 +1617,7 @@ void logicOnSendClicked(const char* text, unsigned size) {
 }
 
 void logicOnUpdateUsersListClicked(void) {
-    assert(this && this->databaseInitialized && !this->missingMessagesFetchers);
-    beginLoading();
-
-    listClear(this->usersList);
-    renderShowUsersList(this->currentUserName);
-
-    lifecycleAsync((LifecycleAsyncActionFunction) &netFetchUsers, NULL, 0);
+    refetchUsersList(); // even if the presence is pushed, as the user asks for a resync, after a missed push for instance
 }
 
 unsigned logicMaxMessagePlainPayloadSize(void) { return (maxUnencryptedMessageBodySize() / CRYPTO_PADDING_BLOCK_SIZE) * CRYPTO_PADDING_BLOCK_SIZE; } // integer (not fractional division) // 136
@@ -1185,12 +1643,14 @@ static long fetchHostId(void) {
 void logicClean(void) {
     assert(this);
 
-    if (this->netInitialized) netClean();
+    if (this->netConnection) netClean(this->netConnection);
+    if (this->pendingCredentials) dropCredentials(&(this->pendingCredentials)); // the app was closed while connecting
+    if (this->sessionCredentials) dropCredentials(&(this->sessionCredentials));
 
     queueDestroy(this->userIdsToFetchMessagesFrom);
 
-    assert(!this->rwops);
-    assert(!this->fileHashState);
+    abortFileTransfers(); // after the net module has stopped
+    SDL_DestroyMutex(this->fileTransfersMutex);
 
     if (this->databaseInitialized) databaseClean();
     optionsClean();
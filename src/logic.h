@@ -27,7 +27,6 @@ extern const unsigned LOGIC_MAX_FILE_PATH_SIZE;
 void logicInit(void);
 bool logicIsAdminMode(void);
 bool logicIsDarkTheme(void);
-void logicNetListen(void); // causes net module to listen for connection updates
 List* logicUsersList(void); // returns permanent users list in which actual user objects will be inserted/updated/removed later by the net module
 List* logicMessagesList(void); // same as usersList but for conversation messages between users
 byte logicLanguage(void);
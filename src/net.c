@@ -17,11 +17,10 @@
  */
 
 #include <SDL.h>
-#include <SDL_net.h>
 #include <assert.h>
 #include <endian.h>
 #include "collections/list.h"
-#include "collections/queue.h"
+#include "collections/timerWheel.h"
 #include "utils/rwMutex.h"
 #include "net.h"
 
@@ -32,26 +31,48 @@ staticAssert(sizeof(char) == 1 && sizeof(int) == 4 && sizeof(long) == 8 && sizeo
 #endif
 
 typedef enum : unsigned {
-    STATE_SERVER_PUBLIC_KEY_RECEIVED = 1,
-    STATE_CLIENT_PUBLIC_KEY_SENT = 2,
-    STATE_SERVER_CODER_HEADER_RECEIVED = 3,
-    STATE_CLIENT_CODER_HEADER_SENT = 4,
+    STATE_DISCONNECTED = 0,
+    STATE_CONNECTED = 1,
+    STATE_SERVER_PUBLIC_KEY_RECEIVED = 2,
+    STATE_CLIENT_PUBLIC_KEY_SENT = 3,
+    STATE_SERVER_CODER_HEADER_RECEIVED = 4,
+    STATE_CLIENT_CODER_HEADER_SENT = 5,
     STATE_SECURE_CONNECTION_ESTABLISHED = STATE_CLIENT_CODER_HEADER_SENT,
-    STATE_AUTHENTICATED = 5,
+    STATE_AUTHENTICATED = 6,
     STATE_FINISHED_WITH_ERROR = 7
 } States;
 
+STATIC_CONST_UNSIGNED CONNECTION_STEPS = STATE_SECURE_CONNECTION_ESTABLISHED + 1; // states up to the established secure connection & the negotiation
+
 STATIC_CONST_UNSIGNED INT_SIZE = sizeof(int);
 STATIC_CONST_UNSIGNED LONG_SIZE = sizeof(long);
 
-STATIC_CONST_UNSIGNED MAX_MESSAGE_SIZE = 1 << 8; // 256
+STATIC_CONST_UNSIGNED MAX_MESSAGE_SIZE = 1 << 8; // 256, supported by every server
+STATIC_CONST_UNSIGNED MAX_NEGOTIABLE_MESSAGE_SIZE = 1 << 16; // 65536, the largest message size the client proposes to the server
 STATIC_CONST_UNSIGNED TOKEN_TRAILING_SIZE = 16;
 STATIC_CONST_UNSIGNED TOKEN_UNSIGNED_VALUE_SIZE = 2 * INT_SIZE; // 8
 STATIC_CONST_UNSIGNED TOKEN_SIZE = TOKEN_UNSIGNED_VALUE_SIZE + 40 + TOKEN_TRAILING_SIZE; // 64
 STATIC_CONST_UNSIGNED MESSAGE_HEAD_SIZE = INT_SIZE * 6 + LONG_SIZE + TOKEN_SIZE; // 96
+STATIC_CONST_UNSIGNED MAX_VARINT_SIZE = 10; // an unsigned long takes up to 10 bytes when encoded by 7 bits per byte
+STATIC_CONST_UNSIGNED MAX_COMPACT_MESSAGE_HEAD_SIZE = MAX_VARINT_SIZE + (INT_SIZE + 1) * 6; // 40 // timestamp & flag, size, index, count, from, to, each int taking up to 5 bytes
+STATIC_CONST_UNSIGNED COMPACT_FRAME_BIT = 1u << 31; // set in the size prefix of frames whose messages have compact headers, encrypted messages are far smaller than that
+STATIC_CONST_UNSIGNED NEGOTIATION_FEATURE_COMPACT_HEADER = 1 << 0; // the token is omitted from headers as the server binds it to the connection once the user is logged in, the server's token is verified once during the negotiation; the rest of the fields are encoded as varints, index & count are omitted when count == 1
+STATIC_CONST_UNSIGNED NEGOTIATION_FEATURE_BATCHED_FETCH = 1 << 1; // the server packs as many fetched messages as fit into each frame instead of sending a frame per message
+STATIC_CONST_UNSIGNED NEGOTIATION_FEATURE_PRESENCE = 1 << 2; // the server pushes users' connects & disconnects once the user is logged in, so the users list stays up to date without being re-fetched
+STATIC_CONST_UNSIGNED NEGOTIATION_FEATURE_HEARTBEAT = 1 << 3; // the server echoes pings, so the round trip time gets measured & a silent connection is known to be dead rather than idle
 const unsigned NET_MAX_MESSAGE_BODY_SIZE = MAX_MESSAGE_SIZE - MESSAGE_HEAD_SIZE; // 160
 
 STATIC_CONST_UNSIGNED long TIMEOUT = 15000; // in milliseconds
+STATIC_CONST_UNSIGNED NEGOTIATION_TIMEOUT = 3000; // in milliseconds, older servers might not reply at all, so the client waits for the reply at most that long
+STATIC_CONST_UNSIGNED NEGOTIATION_MIN_TIMEOUT = 250; // in milliseconds, but usually only that long, as the servers which do reply do it about as fast as they've performed the handshake
+STATIC_CONST_UNSIGNED NEGOTIATION_HANDSHAKES_TIMEOUT = 4; // the handshake takes a couple of round trips, the negotiation takes one, this leaves room for the jitter
+STATIC_CONST_UNSIGNED OUTBOX_SIZE = 1 << 18; // 262144, how many bytes of encrypted messages can be waiting to be sent at once, holds several messages of the largest negotiable size
+STATIC_CONST_UNSIGNED RECEIVE_BUFFER_SIZE = 1 << 18; // 262144, received bytes are read in large chunks into it, holds several messages of the largest negotiable size
+STATIC_CONST_UNSIGNED LISTEN_POLL_TIMEOUT = 100; // in milliseconds, how long the listening thread blocks waiting for the socket before checking whether it needs to stop
+STATIC_CONST_UNSIGNED TIMER_RESOLUTION = 10; // in milliseconds, deadlines of conversation setups & of file transfers are met that precisely
+STATIC_CONST_UNSIGNED HEARTBEAT_TIMEOUT = 15000; // in milliseconds, the default one, the connection is considered dead if nothing arrives within it
+STATIC_CONST_UNSIGNED HEARTBEAT_PINGS_PER_TIMEOUT = 4; // so several pongs get lost before the connection is considered dead
+STATIC_CONST_UNSIGNED RTT_SCALE = 8; // the smoothed round trip time & its variation are kept in eighths of milliseconds, so the smoothing doesn't round the small ones away
 
 typedef enum : int {
     FLAG_PROCEED = 0x00000000,
@@ -66,7 +87,11 @@ typedef enum : int {
     FLAG_ERROR = 0x00000009,
 
     FLAG_FETCH_USERS = 0x0000000c,
-    FLAG_FETCH_MESSAGES = 0x0000000d,
+    FLAG_FETCH_MESSAGES = 0x0000000d, // the request's body is [mode][after timestamp][conversation id]; in the batched mode the server replies with frames [mode][conversation id][records count][records...] where a record is [timestamp][from][size][message], the last frame has index == count - 1
+    FLAG_PRESENCE = 0x0000000e, // pushed by the server with the body consisting of [user id][connected] records, one for every user whose state has changed since the previous push
+    FLAG_PING = 0x0000000f, // sent by the client with the body consisting of the sending time, the server echoes the message back (the pong)
+
+    FLAG_NEGOTIATE = 0x00000010, // sent by the client right after the secure connection is established with the body containing the proposed max message size (the header included) and the bit set of the supported features; the server replies with the same flag, the agreed size (not greater than the proposed one) and the features it supports among the proposed ones or, if it's an older one, with an error or doesn't reply at all, in which case MAX_MESSAGE_SIZE is used with no features
 
     // firstly current user (A, is treated as a client) invites another user (B, is treated as a server) by sending him an invite; if B declines the invite he replies with a message containing this flag and body size = 0
     FLAG_EXCHANGE_KEYS = 0x000000a0, // if B accepts the invite, he replies with his public key, which A treats as a server key (allowing not to rewrite that part of the crypto api)
@@ -86,6 +111,21 @@ typedef enum : int {
 
 const int NET_FLAG_PROCEED = FLAG_PROCEED;
 
+static const int STATS_FLAGS[] = { // frames are counted per flag in this order, the ones with other flags are counted after them
+    FLAG_PROCEED, FLAG_BROADCAST, FLAG_LOG_IN, FLAG_LOGGED_IN, FLAG_REGISTER, FLAG_REGISTERED, FLAG_ERROR, FLAG_FETCH_USERS, FLAG_FETCH_MESSAGES, FLAG_PRESENCE,
+    FLAG_PING, FLAG_NEGOTIATE, FLAG_EXCHANGE_KEYS, FLAG_EXCHANGE_KEYS_DONE, FLAG_EXCHANGE_HEADERS, FLAG_EXCHANGE_HEADERS_DONE, FLAG_FILE_ASK, FLAG_FILE, FLAG_SHUTDOWN
+};
+STATIC_CONST_UNSIGNED STATS_FLAGS_COUNT = sizeof STATS_FLAGS / sizeof *STATS_FLAGS + 1; // the other flags included
+
+staticAssert(sizeof STATS_FLAGS / sizeof *STATS_FLAGS + 1 == sizeof ((NetStats*) NULL)->flags / sizeof *((NetStats*) NULL)->flags);
+
+typedef struct {
+    atomic unsigned long framesSent;
+    atomic unsigned long bytesSent;
+    atomic unsigned long framesReceived;
+    atomic unsigned long bytesReceived;
+} FlagCounters;
+
 STATIC_CONST_UNSIGNED TO_SERVER = 0x7ffffffe;
 
 const unsigned NET_USERNAME_SIZE = 16;
@@ -97,20 +137,85 @@ STATIC_CONST_UNSIGNED FROM_SERVER = 0x7fffffff;
 STATIC_CONST_UNSIGNED INVITE_ASK = 1;
 STATIC_CONST_UNSIGNED INVITE_DENY = 2;
 
-const unsigned NET_MAX_FILENAME_SIZE = NET_MAX_MESSAGE_BODY_SIZE - 40; // 120 // 40 = INT_SIZE + CRYPTO_HASH_SIZE + INT_SIZE
+STATIC_CONST_UNSIGNED FILE_EXCHANGE_EXTENSION_SIZE = 16; // the last bytes of a file exchange invite: the magic, the sender's max message body size, the sender's stream id & the sender's window
+STATIC_CONST_UNSIGNED FILE_EXCHANGE_EXTENSION_MAGIC = 0x02584500; // bytes 0, 'E', 'X', 2 - the leading zero distinguishes it from a filename, which takes the extension's place in invites from older clients and which are zero-filled after the filename ends
+STATIC_CONST_UNSIGNED FILE_EXCHANGE_ACK_MAGIC = 0x80414b00; // bytes 0, 'K', 'A', 0x80 - starts acknowledgements, which are as large as replies to invites, files of that size are never sent
+STATIC_CONST_UNSIGNED FILE_EXCHANGE_WINDOW = 32; // how many chunks may be sent without being acknowledged, the receiver acknowledges them in quarters of that
+STATIC_CONST_UNSIGNED FILE_EXCHANGE_COMPRESSION_BIT = 1u << 31; // set in the window of an invite if the sender proposes to compress the chunks & in the window of a reply if the receiver agrees, older clients clamp the window & so never set it back
+
+const unsigned NET_MAX_FILENAME_SIZE = NET_MAX_MESSAGE_BODY_SIZE - 40 - FILE_EXCHANGE_EXTENSION_SIZE; // 104 // 40 = INT_SIZE + CRYPTO_HASH_SIZE + INT_SIZE
+STATIC_CONST_UNSIGNED LEGACY_MAX_FILENAME_SIZE = NET_MAX_MESSAGE_BODY_SIZE - 40; // 120 - older clients put the filename where the extension is now, so their invites may carry longer ones
 
 staticAssert(NET_MAX_FILENAME_SIZE < NET_MAX_MESSAGE_BODY_SIZE);
+staticAssert(MAX_COMPACT_MESSAGE_HEAD_SIZE < MESSAGE_HEAD_SIZE);
+
+STATIC_CONST_UNSIGNED FETCH_MODE_SINGLE = 1; // a frame per fetched message
+STATIC_CONST_UNSIGNED FETCH_MODE_BATCHED = 2;
+STATIC_CONST_UNSIGNED FETCHED_RECORD_HEAD_SIZE = LONG_SIZE + INT_SIZE * 2;
+STATIC_CONST_UNSIGNED PRESENCE_RECORD_SIZE = INT_SIZE + sizeof(bool);
+
+STATIC_CONST_UNSIGNED MAX_CONVERSATION_SETUPS = 64; // that many conversations can be set up in parallel
+
+typedef enum : unsigned {
+    SETUP_STEP_FINISHED = 0,
+    SETUP_STEP_INVITE_SENT = 1, // the inviter waits for the invited user's public key
+    SETUP_STEP_KEYS_EXCHANGED = 2, // the inviter waits for the invited user's stream header
+    SETUP_STEP_INVITE_RECEIVED = 3, // the invited user decides whether to accept the invite
+    SETUP_STEP_KEY_SENT = 4, // the invited user waits for the inviter's public key
+    SETUP_STEP_HEADER_SENT = 5 // the invited user waits for the inviter's stream header
+} ConversationSetupSteps;
+
+typedef struct {
+    bool active;
+    unsigned peerId;
+    unsigned step;
+    CryptoKeys* nullable keys;
+    CryptoCoderStreams* nullable coderStreams;
+} ConversationSetup; // its timer is armed for the current step
+
+STATIC_CONST_UNSIGNED MAX_FILE_TRANSFERS = 16; // that many files can be being sent & received at once
+
+typedef enum : unsigned {
+    TRANSFER_STEP_AWAITING_REPLY = 1, // the sender waits for the receiver to accept the invite
+    TRANSFER_STEP_SENDING = 2, // the writing thread puts the chunks into the outbox
+    TRANSFER_STEP_FLUSHING = 3, // all the chunks are in the outbox, the sender waits for them to be sent
+    TRANSFER_STEP_INVITE_RECEIVED = 4, // the receiver decides whether to accept the invite
+    TRANSFER_STEP_RECEIVING = 5
+} FileTransferSteps;
+
+typedef struct {
+    bool active;
+    unsigned id; // local, identifies the transfer in the callbacks
+    unsigned peerId;
+    unsigned streamId; // the sender's transfer id, it is put in front of every chunk so that transfers interleave; 0 if the sender's client doesn't support that
+    bool multiplexed; // whether the chunks carry the stream id
+    bool extended; // whether the peer's client supports the invite extension
+    unsigned step;
+    unsigned fileSize;
+    unsigned chunkSize; // the chunk's message body size, the stream id included
+    unsigned nextIndex;
+    unsigned window; // chunks the sender keeps in flight, 0 if the peer's client neither acknowledges chunks nor ends transfers explicitly
+    unsigned ackedChunks;
+    bool supplied; // the supplier has run out of chunks, the chunks' sizes don't add up to the file's size as they're encrypted & maybe compressed
+    bool compressed; // proposed by the sender in the invite, agreed by the receiver in the reply
+    unsigned long lastSequence; // of the last chunk put into the outbox
+} FileTransfer; // its timer is re-armed on every step & chunk, so the transfer expires after a period of inactivity
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "OCUnusedGlobalDeclarationInspection" // they're all used despite what the SAT says
-THIS(
+struct NetConnection_t {
+    NetConnection* atomic* slot; // the caller's pointer to the connection, netClean resets it
     char* host;
     unsigned port;
-    TCPsocket socket;
-    SDLNet_SocketSet socketSet;
+    const Transport* transport;
+    void* nullable connection; // the transport's one, null until connected
     atomic unsigned state;
     NetOnMessageReceived onMessageReceived;
-    CryptoCoderStreams* connectionCoderStreams;
+    NetOnConnected onConnected;
+    NetOnConnectionProgress nullable onConnectionProgress;
+    CryptoKeys* nullable connectionKeys; // exist only during the handshake
+    byte* nullable encryptedServerCoderHeader; // is kept between the handshake's steps
+    CryptoCoderStreams* connectionCoderStreams; // its encryption stream is used only by the sending side & the decryption one - only by the receiving side, so they're guarded by the corresponding mutexes
     byte tokenAnonymous[TOKEN_SIZE]; // constant
     byte tokenServerUnsignedValue[TOKEN_UNSIGNED_VALUE_SIZE]; // constant, unencrypted but clients don't know how token is generated
     byte token[TOKEN_SIZE];
@@ -123,24 +228,76 @@ THIS(
     NetOnUsersFetched onUsersFetched;
     List* userInfosList;
     byte* serverKeyStub;
-    atomic bool settingUpConversation;
+    ConversationSetup conversationSetups[MAX_CONVERSATION_SETUPS]; // tracked per peer, each one advances independently as the peer's messages arrive
+    SDL_mutex* conversationSetupsMutex;
+    TimerWheel* timers; // for conversation setups, whose timers have the same indexes, & for file transfers, whose timers follow them; advanced by the listening thread, armed by any one
+    unsigned long nextHeartbeatCheck; // the heartbeat is checked once per poll timeout
     NetOnConversationSetUpInviteReceived onConversationSetUpInviteReceived;
-    unsigned long inviteProcessingStartMillis;
-    RWMutex* rwMutex;
+    NetOnConversationSetUp onConversationSetUp;
+    SDL_mutex* sendMutex; // guards the sending side of the connection (the outbox & the connection's encryption stream), as well as the user id and the token which get sent in every message
+    SDL_cond* sendCondition; // signaled when messages are either put into the outbox or taken from it to be sent
+    RWMutex* receiveMutex; // guards the receiving side of the connection so that sending and receiving don't block each other
     NetOnFileExchangeInviteReceived onFileExchangeInviteReceived;
     NetNextFileChunkSupplier nextFileChunkSupplier;
     NetNextFileChunkReceiver netNextFileChunkReceiver;
-    atomic bool exchangingFile;
-    Queue* conversationSetupMessages;
-    Queue* fileExchangeMessages;
+    NetOnFileExchangeFinished onFileExchangeFinished;
+    FileTransfer fileTransfers[MAX_FILE_TRANSFERS]; // tracked per transfer, so several files can be exchanged with different users at once
+    SDL_mutex* fileTransfersMutex;
+    atomic unsigned lastFileTransferId;
+    unsigned nextPumpedTransfer; // the transfers take turns putting their chunks into the outbox
+    byte* fileChunkBuffer; // used only by the writing thread
+    unsigned pendingFileChunkSize; // the chunk in the buffer which didn't fit in the outbox, it's put there first the next time
+    unsigned pendingFileChunkBytes; // of the file in that chunk, 0 if it's the end of the transfer
+    unsigned pendingFileChunkTransfer; // the id
+    bool fileChunksPumpRequested; // guarded by the send mutex
     atomic bool fetchingUsers;
-    atomic bool fetchingMessages; // TODO: deprecated: practically unused, doesn't work properly
+    atomic unsigned fetchingMessages; // the number of conversations whose messages are being fetched at once, their replies are told apart by the conversation id each one carries
     NetOnNextMessageFetched onNextMessageFetched;
+    NetOnMessagesBatchFetched onMessagesBatchFetched;
+    NetOnPresenceChanged nullable onPresenceChanged;
     atomic bool ignoreUsualMessages; // ignore usual messages from other users (with flag proceed) while updating user infos or while re-fetching messages
     NetOnBroadcastMessageReceived onBroadcastMessageReceived;
-)
+    SDL_Thread* nullable listenThread;
+    atomic bool listening;
+    byte* outbox; // messages waiting to be sent, each one is the size of the encrypted message followed by the message itself, which gets packed & encrypted in place
+    unsigned outboxSize;
+    byte* writeBuffer; // gets swapped with the outbox so the messages, which are being sent, don't block putting new ones into the outbox
+    unsigned long enqueuedMessages; // sequence number of the last message put into the outbox
+    unsigned long sentMessages; // sequence number of the last message sent
+    atomic bool sendFailed; // once sending fails, every message after that fails too & the listening thread disconnects
+    SDL_Thread* nullable writeThread;
+    bool writing;
+    unsigned maxMessageSize; // negotiated with the server
+    unsigned features; // negotiated with the server
+    byte serverToken[TOKEN_SIZE]; // the last verified one, messages from the server with compact headers don't contain it
+    bool serverTokenVerified;
+    byte* receiveBuffer; // may contain several received frames, the last of which may be incomplete
+    unsigned receiveBufferStart; // the beginning of the first unprocessed frame
+    unsigned receiveBufferEnd; // the end of the received bytes
+    atomic unsigned heartbeatTimeout;
+    unsigned long connectedMillis; // when the secure connection was established
+    unsigned long lastReceivedMillis; // used only by the listening thread
+    unsigned long lastPingMillis; // the timeout may change between pings
+    atomic unsigned smoothedRtt; // in eighths of milliseconds, written only by the listening thread
+    atomic unsigned rttVariation; // the same
+    atomic unsigned rttSamples;
+    atomic unsigned long framesSent;
+    atomic unsigned long bytesSent;
+    atomic unsigned long framesReceived;
+    atomic unsigned long bytesReceived;
+    FlagCounters flagCounters[STATS_FLAGS_COUNT]; // the counters are atomic so updating them doesn't take any locks
+    atomic unsigned long encryptionTicks; // spent encrypting frames, in performance counter ticks
+    atomic unsigned long decryptionTicks;
+    atomic unsigned long droppedWhileFetchingUsers; // usual messages from other users
+    atomic unsigned long droppedWhileFetchingMessages;
+    atomic unsigned long droppedWhileIgnoring;
+};
 #pragma clang diagnostic pop
 
+typedef NetConnection This; // every function that touches a connection's state takes it as the first parameter, so a process can hold any number of connections
+
+static _Thread_local This* nullable currentConnection = NULL; // the one whose listening or writing thread this is, so that the callbacks shared by several connections can tell them apart
+
 #pragma pack(true)
 
 typedef struct {
@@ -165,91 +322,168 @@ STATIC_CONST_UNSIGNED USER_INFO_SIZE = INT_SIZE + sizeof(bool) + NET_USERNAME_SI
 
 staticAssert(sizeof(bool) == 1 && sizeof(NetUserInfo) == 21);
 
-static bool checkSocket(void);
+static FlagCounters* flagCounters(This* this, int flag) {
+    unsigned index = 0;
+    while (index < STATS_FLAGS_COUNT - 1 && STATS_FLAGS[index] != flag) index++;
+    return &(this->flagCounters[index]);
+}
 
-static bool waitForReceiveWithTimeout(void) {
-    const unsigned long startMillis = (*(this->currentTimeMillisGetter))();
-    while ((*(this->currentTimeMillisGetter))() - startMillis < TIMEOUT) {
-        if (checkSocket())
+static bool checkSocket(This* this, unsigned timeout);
+static bool receiveAll(This* this, byte* buffer, unsigned size);
+static void listenLooper(This* this);
+static int writeLooper(void* xThis);
+static void stopWriting(This* this);
+static bool negotiate(This* this, unsigned timeout);
+
+static bool waitForReceive(This* this, unsigned long deadline) { // blocks on the socket until either something arrives (returns true), the deadline passes or the module starts being cleaned up
+    unsigned long now;
+    while (this->listening && (now = (*(this->currentTimeMillisGetter))()) < deadline)
+        if (checkSocket(this, (unsigned) min(deadline - now, (unsigned long) LISTEN_POLL_TIMEOUT)))
             return true;
-    }
     return false;
 }
 
-static void initiateSecuredConnection(const byte* serverSignPublicKey, unsigned serverSignPublicKeySize, CryptoKeys* connectionKeys) {
-    this->connectionCoderStreams = cryptoCoderStreamsInit();
-
-    cryptoSetServerSignPublicKey(serverSignPublicKey, serverSignPublicKeySize);
-
+static bool receiveServerPublicKey(This* this, unsigned long deadline) {
     const unsigned signedPublicKeySize = CRYPTO_SIGNATURE_SIZE + CRYPTO_KEY_SIZE;
     byte serverSignedPublicKey[signedPublicKeySize];
     const byte* serverKeyStart = serverSignedPublicKey + CRYPTO_SIGNATURE_SIZE;
 
-    if (!waitForReceiveWithTimeout()) return;
-    if (SDLNet_TCP_Recv(
-        this->socket,
-        serverSignedPublicKey,
-        (int) signedPublicKeySize
-    ) != (int) signedPublicKeySize) return;
+    if (!waitForReceive(this, deadline)) return false;
+    if (!receiveAll(this, serverSignedPublicKey, signedPublicKeySize)) return false;
     assert(cryptoCheckServerSignedBytes(serverSignedPublicKey, serverKeyStart, CRYPTO_KEY_SIZE));
 
-    if (!SDL_memcmp(serverKeyStart, this->serverKeyStub, CRYPTO_KEY_SIZE)) return; // denial of service
-    this->state = STATE_SERVER_PUBLIC_KEY_RECEIVED;
-
-    if (!cryptoExchangeKeys(connectionKeys, serverSignedPublicKey + CRYPTO_SIGNATURE_SIZE)) return;
+    if (!SDL_memcmp(serverKeyStart, this->serverKeyStub, CRYPTO_KEY_SIZE)) return false; // denial of service
+    return cryptoExchangeKeys(this->connectionKeys, serverKeyStart);
+}
 
-    if (SDLNet_TCP_Send(
-        this->socket,
-        cryptoClientPublicKey(connectionKeys),
-        (int) CRYPTO_KEY_SIZE
-    ) != (int) CRYPTO_KEY_SIZE) return;
-    this->state = STATE_CLIENT_PUBLIC_KEY_SENT;
+static bool sendClientPublicKey(This* this) {
+    return (*(this->transport->send))(this->connection, cryptoClientPublicKey(this->connectionKeys), CRYPTO_KEY_SIZE);
+}
 
+static bool receiveServerCoderHeader(This* this, unsigned long deadline) {
     const unsigned encryptedCoderHeaderSize = cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE);
-    byte encryptedServerCoderHeader[encryptedCoderHeaderSize];
+    this->encryptedServerCoderHeader = SDL_malloc(encryptedCoderHeaderSize);
 
-    if (!waitForReceiveWithTimeout()) return;
-    if (SDLNet_TCP_Recv(
-        this->socket,
-        encryptedServerCoderHeader,
-        (int) encryptedCoderHeaderSize
-    ) != (int) encryptedCoderHeaderSize) return;
-    this->state = STATE_SERVER_CODER_HEADER_RECEIVED;
+    if (!waitForReceive(this, deadline)) return false;
+    return receiveAll(this, this->encryptedServerCoderHeader, encryptedCoderHeaderSize);
+}
+
+static bool sendClientCoderHeader(This* this) {
+    const unsigned encryptedCoderHeaderSize = cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE);
 
     byte* serverCoderHeader = cryptoDecryptSingle(
-        cryptoServerKey(connectionKeys),
-        encryptedServerCoderHeader,
+        cryptoServerKey(this->connectionKeys),
+        this->encryptedServerCoderHeader,
         encryptedCoderHeaderSize
     );
-    if (!serverCoderHeader) return;
+    if (!serverCoderHeader) return false;
 
     byte* clientCoderHeader = cryptoInitializeCoderStreams(
-        connectionKeys,
+        this->connectionKeys,
         this->connectionCoderStreams,
         serverCoderHeader
     );
     SDL_free(serverCoderHeader);
 
-    if (!clientCoderHeader) return;
-    byte* encryptedClientCoderHeader = cryptoEncryptSingle(cryptoClientKey(connectionKeys), clientCoderHeader, CRYPTO_HEADER_SIZE);
+    if (!clientCoderHeader) return false;
+    byte* encryptedClientCoderHeader = cryptoEncryptSingle(cryptoClientKey(this->connectionKeys), clientCoderHeader, CRYPTO_HEADER_SIZE);
     assert(encryptedClientCoderHeader);
     SDL_free(clientCoderHeader);
 
-    if (SDLNet_TCP_Send(this->socket, encryptedClientCoderHeader, (int) encryptedCoderHeaderSize) == (int) encryptedCoderHeaderSize)
-        this->state = STATE_CLIENT_CODER_HEADER_SENT;
-
+    const bool sent = (*(this->transport->send))(this->connection, encryptedClientCoderHeader, encryptedCoderHeaderSize);
     SDL_free(encryptedClientCoderHeader);
+    return sent;
+}
+
+static bool connectToServer(This* this) { // resolving the host & opening the connection are up to the transport
+    this->connection = (*(this->transport->open))(this->host, this->port);
+    return this->connection != NULL;
+}
+
+static bool advanceConnection(This* this, unsigned long deadline) { // performs the step that follows the current state, a state machine; returns false on failure
+    bool succeeded = false;
+
+    switch (this->state) {
+        case STATE_DISCONNECTED:
+            succeeded = connectToServer(this); // resolving the host & opening the connection are blocking, but they're performed in the separate thread
+            break;
+        case STATE_CONNECTED:
+            succeeded = receiveServerPublicKey(this, deadline);
+            break;
+        case STATE_SERVER_PUBLIC_KEY_RECEIVED:
+            succeeded = sendClientPublicKey(this);
+            break;
+        case STATE_CLIENT_PUBLIC_KEY_SENT:
+            succeeded = receiveServerCoderHeader(this, deadline);
+            break;
+        case STATE_SERVER_CODER_HEADER_RECEIVED:
+            succeeded = sendClientCoderHeader(this);
+            break;
+        default:
+            assert(false);
+    }
+
+    if (!succeeded) return false;
+    this->state++;
+
+    if (this->onConnectionProgress) (*(this->onConnectionProgress))(this->state, CONNECTION_STEPS);
+    return true;
+}
+
+static bool establishConnection(This* this) { // returns false on failure
+    const unsigned long began = (*(this->currentTimeMillisGetter))(), deadline = began + TIMEOUT; // for the whole handshake
+
+    this->connectionKeys = cryptoKeysInit();
+    this->connectionCoderStreams = cryptoCoderStreamsInit();
+
+    bool succeeded = true;
+    while (succeeded && this->listening && this->state != STATE_SECURE_CONNECTION_ESTABLISHED)
+        succeeded = advanceConnection(this, deadline);
+
+    cryptoKeysDestroy(this->connectionKeys);
+    this->connectionKeys = NULL;
+    SDL_free(this->encryptedServerCoderHeader);
+    this->encryptedServerCoderHeader = NULL;
+
+    if (!succeeded || !this->listening) return false;
+
+    this->writing = true;
+    this->writeThread = SDL_CreateThread(&writeLooper, "netWriteThread", this);
+    assert(this->writeThread);
+
+    const unsigned long negotiationTimeout = ((*(this->currentTimeMillisGetter))() - began) * NEGOTIATION_HANDSHAKES_TIMEOUT; // a silent server delays every connect to it, reconnections included, by the timeout
+    if (!negotiate(this, (unsigned) min(max(negotiationTimeout, (unsigned long) NEGOTIATION_MIN_TIMEOUT), (unsigned long) NEGOTIATION_TIMEOUT))) return false;
+
+    if (this->onConnectionProgress) (*(this->onConnectionProgress))(CONNECTION_STEPS, CONNECTION_STEPS);
+    return true;
 }
 
-static void destroyMessage(Message* nullable msg) {
-    if (!msg) return;
-    SDL_free(msg->body);
-    SDL_free(msg);
+static int connectAndListen(void* xThis) { // the body of the net thread
+    This* this = xThis;
+    SDL_LockMutex(this->sendMutex); // waits for netInit to finish initializing the connection
+    SDL_UnlockMutex(this->sendMutex);
+    currentConnection = this;
+
+    if (!establishConnection(this)) {
+        if (!this->listening) return 0; // the module is being cleaned up by another thread which is waiting for this one to finish
+
+        this->listening = false;
+        stopWriting(this);
+        (*(this->onConnected))(false); // the caller cleans the connection up
+        return 0;
+    }
+
+    this->connectedMillis = this->lastReceivedMillis = (*(this->currentTimeMillisGetter))();
+    (*(this->onConnected))(true);
+    listenLooper(this);
+    return 0;
 }
 
 bool netInit(
+    NetConnection* atomic* connection,
     const char* host,
     unsigned port,
+    const Transport* nullable transport,
     const byte* serverSignPublicKey,
     unsigned serverSignPublicKeySize,
     NetOnMessageReceived onMessageReceived,
@@ -260,27 +494,39 @@ bool netInit(
     NetCurrentTimeMillisGetter currentTimeMillisGetter,
     NetOnUsersFetched onUsersFetched,
     NetOnConversationSetUpInviteReceived onConversationSetUpInviteReceived,
+    NetOnConversationSetUp onConversationSetUp,
     NetOnFileExchangeInviteReceived onFileExchangeInviteReceived,
     NetNextFileChunkSupplier nextFileChunkSupplier,
     NetNextFileChunkReceiver netNextFileChunkReceiver,
+    NetOnFileExchangeFinished onFileExchangeFinished,
     NetOnNextMessageFetched onNextMessageFetched,
-    NetOnBroadcastMessageReceived onBroadcastMessageReceived
+    NetOnMessagesBatchFetched onMessagesBatchFetched,
+    NetOnPresenceChanged nullable onPresenceChanged,
+    NetOnBroadcastMessageReceived onBroadcastMessageReceived,
+    NetOnConnected onConnected,
+    NetOnConnectionProgress nullable onConnectionProgress
 ) {
-    assert(!this && onMessageReceived && onLogInResult && onErrorReceived && onDisconnected);
+    assert(connection && !*connection && onMessageReceived && onLogInResult && onErrorReceived && onDisconnected && currentTimeMillisGetter && onConnected);
 
     unsigned long byteOrderChecker = 0x0123456789abcdeful; // just for notice - u & l at the end stand for unsigned long, they're not hexits (digit for hex analogue), leading 0 & x defines hex numbering system
     assert(*((byte*) &byteOrderChecker) == 0xef); // checks whether the app is running on a x64 littleEndian architecture so the byte order won't mess up data marshalling
 
-    this = SDL_malloc(sizeof *this);
+    This* this = SDL_malloc(sizeof *this);
+    this->slot = connection;
 
-    const unsigned hostSize = SDL_strlen(host);
+    const unsigned hostSize = SDL_strlen(host) + 1;
     this->host = SDL_malloc(hostSize);
-    SDL_memcpy(this->host, host, hostSize);
+    SDL_memcpy(this->host, host, hostSize); // null-terminator included
 
     this->port = port;
-    this->socket = NULL;
-    this->socketSet = NULL;
+    this->transport = transport ? transport : &TRANSPORT_SDL;
+    this->connection = NULL;
+    this->state = STATE_DISCONNECTED;
     this->onMessageReceived = onMessageReceived;
+    this->onConnected = onConnected;
+    this->onConnectionProgress = onConnectionProgress;
+    this->connectionKeys = NULL;
+    this->encryptedServerCoderHeader = NULL;
     this->connectionCoderStreams = NULL;
     SDL_memset(this->tokenAnonymous, 0, TOKEN_SIZE);
     SDL_memset(this->tokenServerUnsignedValue, (1 << 8) - 1, TOKEN_UNSIGNED_VALUE_SIZE);
@@ -294,58 +540,95 @@ bool netInit(
     this->onUsersFetched = onUsersFetched;
     this->userInfosList = listInit(&SDL_free);
     this->serverKeyStub = SDL_calloc(CRYPTO_KEY_SIZE, sizeof(byte));
-    this->settingUpConversation = false;
+    SDL_memset(this->conversationSetups, 0, sizeof this->conversationSetups);
+    this->conversationSetupsMutex = SDL_CreateMutex();
+    this->timers = timerWheelInit(MAX_CONVERSATION_SETUPS + MAX_FILE_TRANSFERS, TIMER_RESOLUTION, (*currentTimeMillisGetter)());
+    this->nextHeartbeatCheck = 0;
     this->onConversationSetUpInviteReceived = onConversationSetUpInviteReceived;
-    this->inviteProcessingStartMillis = 0;
-    this->rwMutex = rwMutexInit();
+    this->onConversationSetUp = onConversationSetUp;
+    this->sendMutex = SDL_CreateMutex();
+    this->sendCondition = SDL_CreateCond();
+    this->receiveMutex = rwMutexInit();
     this->onFileExchangeInviteReceived = onFileExchangeInviteReceived;
     this->nextFileChunkSupplier = nextFileChunkSupplier;
     this->netNextFileChunkReceiver = netNextFileChunkReceiver;
-    this->exchangingFile = false;
-    this->conversationSetupMessages = queueInitExtra((QueueDeallocator) &destroyMessage, currentTimeMillisGetter);
-    this->fileExchangeMessages = queueInitExtra((QueueDeallocator) &destroyMessage, currentTimeMillisGetter);
+    this->onFileExchangeFinished = onFileExchangeFinished;
+    SDL_memset(this->fileTransfers, 0, sizeof this->fileTransfers);
+    this->fileTransfersMutex = SDL_CreateMutex();
+    this->lastFileTransferId = 0;
+    this->nextPumpedTransfer = 0;
+    this->fileChunkBuffer = SDL_malloc(MAX_NEGOTIABLE_MESSAGE_SIZE - MESSAGE_HEAD_SIZE);
+    this->pendingFileChunkSize = 0;
+    this->pendingFileChunkBytes = 0;
+    this->pendingFileChunkTransfer = 0;
+    this->fileChunksPumpRequested = false;
     this->fetchingUsers = false;
-    this->fetchingMessages = false;
+    this->fetchingMessages = 0;
     this->onNextMessageFetched = onNextMessageFetched;
+    this->onMessagesBatchFetched = onMessagesBatchFetched;
+    this->onPresenceChanged = onPresenceChanged;
     this->ignoreUsualMessages = false;
     this->onBroadcastMessageReceived = onBroadcastMessageReceived;
+    this->listenThread = NULL;
+    this->listening = false;
+    this->outbox = SDL_malloc(OUTBOX_SIZE);
+    this->outboxSize = 0;
+    this->writeBuffer = SDL_malloc(OUTBOX_SIZE);
+    this->enqueuedMessages = 0;
+    this->sentMessages = 0;
+    this->sendFailed = false;
+    this->writeThread = NULL;
+    this->writing = false;
+    this->maxMessageSize = MAX_MESSAGE_SIZE;
+    this->features = 0;
+    SDL_memset(this->serverToken, 0, TOKEN_SIZE);
+    this->serverTokenVerified = false;
+    this->receiveBuffer = SDL_malloc(RECEIVE_BUFFER_SIZE);
+    this->receiveBufferStart = 0;
+    this->receiveBufferEnd = 0;
+    this->heartbeatTimeout = HEARTBEAT_TIMEOUT;
+    this->connectedMillis = 0;
+    this->lastReceivedMillis = 0;
+    this->lastPingMillis = 0;
+    this->smoothedRtt = 0;
+    this->rttVariation = 0;
+    this->rttSamples = 0;
+    this->framesSent = 0;
+    this->bytesSent = 0;
+    this->framesReceived = 0;
+    this->bytesReceived = 0;
+    SDL_memset(this->flagCounters, 0, sizeof this->flagCounters);
+    this->encryptionTicks = 0;
+    this->decryptionTicks = 0;
+    this->droppedWhileFetchingUsers = 0;
+    this->droppedWhileFetchingMessages = 0;
+    this->droppedWhileIgnoring = 0;
 
-    assert(!SDLNet_Init());
-
-    IPaddress address;
-    assert(!SDLNet_ResolveHost(&address, this->host, this->port));
+    cryptoSetServerSignPublicKey(serverSignPublicKey, serverSignPublicKeySize);
 
-#if SDL_NET_MAJOR_VERSION == 2 && SDL_NET_MINOR_VERSION == 2
-    this->socket = SDLNet_TCP_Open(&address);
-#elif SDL_NET_MAJOR_VERSION == 2 && SDL_NET_MINOR_VERSION == 3
-    this->socket = SDLNet_TCP_OpenClient(&address);
-#else
-#   error "untested version"
-#endif
+    SDL_LockMutex(this->sendMutex); // the net thread mustn't finish (and clean up the module) before it's assigned
+    this->listening = true;
+    *connection = this; // before the net thread starts, as the connection may fail (and reset this) before netInit returns
+    this->listenThread = SDL_CreateThread(&connectAndListen, "netListenThread", this);
+    SDL_UnlockMutex(this->sendMutex);
 
-    if (!this->socket) {
-        netClean();
+    if (!this->listenThread) {
+        this->listening = false;
+        netClean(this);
         return false;
     }
+    return true;
+}
 
-    this->socketSet = SDLNet_AllocSocketSet(1);
-    assert(this->socketSet);
-    assert(SDLNet_TCP_AddSocket(this->socketSet, this->socket) == 1);
-
-    CryptoKeys* connectionKeys = cryptoKeysInit();
-    initiateSecuredConnection(serverSignPublicKey, serverSignPublicKeySize, connectionKeys);
-    cryptoKeysDestroy(connectionKeys);
+static bool checkServerToken(This* this, const byte* token) { // the signature of the same value is the same, so it's verified only once and then the following tokens are just compared with it; called only by the thread that reads from the socket
+    if (this->serverTokenVerified && cryptoCompare(token, this->serverToken, TOKEN_SIZE)) return true;
+    if (!cryptoCheckServerSignedBytes(token, this->tokenServerUnsignedValue, TOKEN_UNSIGNED_VALUE_SIZE)) return false;
 
-    if (this->state != STATE_SECURE_CONNECTION_ESTABLISHED) {
-        netClean();
-        return false;
-    } else
-        return true;
+    SDL_memcpy(this->serverToken, token, TOKEN_SIZE);
+    this->serverTokenVerified = true;
+    return true;
 }
 
-static bool checkServerToken(const byte* token)
-{ return cryptoCheckServerSignedBytes(token, this->tokenServerUnsignedValue, TOKEN_UNSIGNED_VALUE_SIZE); }
-
 static byte* makeCredentials(const char* username, const char* password) {
     byte* credentials = SDL_malloc(NET_USERNAME_SIZE + NET_UNHASHED_PASSWORD_SIZE);
     SDL_memcpy(credentials, username, NET_USERNAME_SIZE);
@@ -353,25 +636,23 @@ static byte* makeCredentials(const char* username, const char* password) {
     return credentials;
 }
 
-void netLogIn(const char* username, const char* password) {
+void netLogIn(This* this, const char* username, const char* password) {
     assert(this);
     byte* credentials = makeCredentials(username, password);
-    netSend(FLAG_LOG_IN, credentials, NET_USERNAME_SIZE + NET_UNHASHED_PASSWORD_SIZE, TO_SERVER);
+    netSend(this, FLAG_LOG_IN, credentials, NET_USERNAME_SIZE + NET_UNHASHED_PASSWORD_SIZE, TO_SERVER);
     SDL_free(credentials);
 }
 
-void netRegister(const char* username, const char* password) {
+void netRegister(This* this, const char* username, const char* password) {
     assert(this);
     byte* credentials = makeCredentials(username, password);
-    netSend(FLAG_REGISTER, credentials, NET_USERNAME_SIZE + NET_UNHASHED_PASSWORD_SIZE, TO_SERVER);
+    netSend(this, FLAG_REGISTER, credentials, NET_USERNAME_SIZE + NET_UNHASHED_PASSWORD_SIZE, TO_SERVER);
     SDL_free(credentials);
 }
 
 static inline unsigned wholeMessageBytesSize(unsigned size) { return MESSAGE_HEAD_SIZE + size; } // replace the pointer to body with the actual body
 
-static Message* unpackMessage(const byte* buffer) {
-    Message* msg = SDL_malloc(sizeof *msg);
-
+static void unpackMessage(byte* buffer, Message* msg) { // the body isn't copied, it points into the buffer
     SDL_memcpy(&(msg->flag), buffer, INT_SIZE);
     SDL_memcpy(&(msg->timestamp), buffer + INT_SIZE, LONG_SIZE);
     SDL_memcpy(&(msg->size), buffer + INT_SIZE + LONG_SIZE, INT_SIZE);
@@ -381,19 +662,12 @@ static Message* unpackMessage(const byte* buffer) {
     SDL_memcpy(&(msg->to), buffer + INT_SIZE * 5 + LONG_SIZE, INT_SIZE);
     SDL_memcpy(&(msg->token), buffer + INT_SIZE * 6 + LONG_SIZE, TOKEN_SIZE);
 
-    assert(msg->size <= NET_MAX_MESSAGE_BODY_SIZE);
-    if (msg->size) {
-        msg->body = SDL_malloc(msg->size);
-        SDL_memcpy(msg->body, buffer + MESSAGE_HEAD_SIZE, msg->size);
-    } else
-        msg->body = NULL;
-
-    return msg;
+    assert(msg->size <= MAX_NEGOTIABLE_MESSAGE_SIZE - MESSAGE_HEAD_SIZE);
+    msg->body = msg->size ? buffer + MESSAGE_HEAD_SIZE : NULL;
 }
 
-static byte* packMessage(const Message* msg) {
-    assert(!msg->body && !msg->size || msg->body && msg->size && msg->size <= NET_MAX_MESSAGE_BODY_SIZE);
-    byte* buffer = SDL_malloc(wholeMessageBytesSize(msg->size));
+static void packMessageInto(byte* buffer, const Message* msg) { // expects a wholeMessageBytesSize(msg->size)-sized buffer
+    assert(!msg->body && !msg->size || msg->body && msg->size && msg->size <= MAX_NEGOTIABLE_MESSAGE_SIZE - MESSAGE_HEAD_SIZE);
 
     SDL_memcpy(buffer, &(msg->flag), INT_SIZE);
     SDL_memcpy(buffer + INT_SIZE, &(msg->timestamp), LONG_SIZE);
@@ -405,11 +679,91 @@ static byte* packMessage(const Message* msg) {
     SDL_memcpy(buffer + INT_SIZE * 6 + LONG_SIZE, &(msg->token), TOKEN_SIZE);
 
     if (msg->body && msg->size) SDL_memcpy(buffer + MESSAGE_HEAD_SIZE, msg->body, msg->size);
+}
 
+static byte* packMessage(const Message* msg) {
+    byte* buffer = SDL_malloc(wholeMessageBytesSize(msg->size));
+    packMessageInto(buffer, msg);
     return buffer;
 }
 
-static void processErrors(const Message* message) {
+static unsigned varintSize(unsigned long value) {
+    unsigned size = 1;
+    for (; value >= 0x80; value >>= 7, size++);
+    return size;
+}
+
+static unsigned putVarint(byte* buffer, unsigned long value) { // returns count of written bytes
+    unsigned size = 0;
+    for (; value >= 0x80; value >>= 7)
+        buffer[size++] = (byte) (value | 0x80);
+    buffer[size++] = (byte) value;
+    return size;
+}
+
+static unsigned getVarint(const byte* buffer, unsigned available, unsigned long* value) { // returns count of read bytes or 0 if the varint is malformed
+    *value = 0;
+    for (unsigned i = 0; i < available && i < MAX_VARINT_SIZE; i++) {
+        *value |= (unsigned long) (buffer[i] & 0x7f) << (7 * i);
+        if (!(buffer[i] & 0x80)) return i + 1;
+    }
+    return 0;
+}
+
+static inline bool hasParts(const Message* msg) { return msg->count != 1; }
+
+static unsigned compactMessageBytesSize(const Message* msg) {
+    return varintSize(msg->timestamp)
+        + varintSize((unsigned) msg->flag)
+        + varintSize(msg->size)
+        + varintSize(msg->count)
+        + (hasParts(msg) ? varintSize(msg->index) : 0)
+        + varintSize(msg->from)
+        + varintSize(msg->to)
+        + msg->size;
+}
+
+static unsigned packMessageCompactInto(byte* buffer, const Message* msg) { // expects a compactMessageBytesSize(msg)-sized buffer, returns the size; the token is omitted
+    assert(!msg->body && !msg->size || msg->body && msg->size && msg->size <= MAX_NEGOTIABLE_MESSAGE_SIZE - MESSAGE_HEAD_SIZE);
+    assert(hasParts(msg) || !msg->index);
+
+    unsigned offset = putVarint(buffer, msg->timestamp);
+    offset += putVarint(buffer + offset, (unsigned) msg->flag);
+    offset += putVarint(buffer + offset, msg->size);
+    offset += putVarint(buffer + offset, msg->count);
+    if (hasParts(msg)) offset += putVarint(buffer + offset, msg->index);
+    offset += putVarint(buffer + offset, msg->from);
+    offset += putVarint(buffer + offset, msg->to);
+
+    if (msg->body && msg->size) SDL_memcpy(buffer + offset, msg->body, msg->size);
+    return offset + msg->size;
+}
+
+static void unpackMessageCompact(byte* buffer, unsigned size, Message* msg) { // the token is zeroed, the body points into the buffer
+    unsigned offset = 0, read;
+    unsigned long values[7] = {0}; // timestamp, flag, size, count, index, from, to
+
+    for (unsigned i = 0; i < 7; i++) {
+        if (i == 4 && values[3] == 1) continue; // has no parts, so index is omitted
+
+        assert((read = getVarint(buffer + offset, size - offset, &(values[i]))));
+        offset += read;
+    }
+
+    msg->timestamp = values[0];
+    msg->flag = (int) values[1];
+    msg->size = (unsigned) values[2];
+    msg->count = (unsigned) values[3];
+    msg->index = (unsigned) values[4];
+    msg->from = (unsigned) values[5];
+    msg->to = (unsigned) values[6];
+    SDL_memset(msg->token, 0, TOKEN_SIZE);
+
+    assert(offset + msg->size == size);
+    msg->body = msg->size ? buffer + offset : NULL;
+}
+
+static void processErrors(This* this, const Message* message) {
     assert(message->size == INT_SIZE && message->body);
     switch (*((int*) message->body)) {
         case FLAG_LOG_IN:
@@ -422,18 +776,37 @@ static void processErrors(const Message* message) {
             break;
         case FLAG_FETCH_MESSAGES: // ignore
             break;
+        case FLAG_NEGOTIATE: // an older server replied after the negotiation timed out, ignore
+            break;
         default:
             (*(this->onErrorReceived))(message->flag);
             break;
     }
 }
 
-static void onNextUsersBundleFetched(const Message* message);
-static void onNextMessageFetched(const Message* message);
-static void onEmptyMessagesFetchReplyReceived(const Message* message);
+static void onNextUsersBundleFetched(This* this, const Message* message);
+static void onNextMessageFetched(This* this, const Message* message);
+static void onEmptyMessagesFetchReplyReceived(This* this, const Message* message);
+static void onMessagesBatchFetched(This* this, const Message* message);
+
+static void onPongReceived(This* this, unsigned long sentMillis) { // smooths the round trip time as TCP does (RFC 6298)
+    const unsigned long now = (*(this->currentTimeMillisGetter))();
+    const unsigned sample = (unsigned) (now > sentMillis ? now - sentMillis : 0) * RTT_SCALE;
+
+    if (!this->rttSamples) {
+        this->smoothedRtt = sample;
+        this->rttVariation = sample / 2;
+    } else {
+        const unsigned smoothed = this->smoothedRtt, deviation = smoothed > sample ? smoothed - sample : sample - smoothed;
+        this->rttVariation = (this->rttVariation * 3 + deviation) / 4;
+        this->smoothedRtt = (smoothed * 7 + sample) / 8;
+    }
+
+    this->rttSamples++;
+}
 
-static void processMessagesFromServer(const Message* message) {
-    const bool checked = checkServerToken(message->token);
+static void processMessagesFromServer(This* this, const Message* message) {
+    const bool checked = checkServerToken(this, message->token);
     assert(checked);
 
     switch (message->flag) {
@@ -441,10 +814,10 @@ static void processMessagesFromServer(const Message* message) {
             assert(message->body && message->size);
             this->state = STATE_AUTHENTICATED;
 
-            RW_MUTEX_WRITE_LOCKED(this->rwMutex,
-                this->userId = message->to;
-                SDL_memcpy(this->token, message->body, TOKEN_SIZE);
-            )
+            SDL_LockMutex(this->sendMutex);
+            this->userId = message->to;
+            SDL_memcpy(this->token, message->body, TOKEN_SIZE);
+            SDL_UnlockMutex(this->sendMutex);
 
             (*(this->onLogInResult))(true);
             break;
@@ -452,678 +825,1368 @@ static void processMessagesFromServer(const Message* message) {
             (*(this->onRegisterResult))(true);
             break;
         case FLAG_FETCH_USERS: // TODO: raise assert if the users list hasn't been fully formed or add timeout
-            onNextUsersBundleFetched(message);
+            onNextUsersBundleFetched(this, message);
             break;
         case FLAG_ERROR:
-            processErrors(message);
+            processErrors(this, message);
             break;
         case FLAG_FETCH_MESSAGES:
-            onEmptyMessagesFetchReplyReceived(message);
+            assert(message->body && message->size);
+            *(message->body) == FETCH_MODE_BATCHED
+                ? onMessagesBatchFetched(this, message)
+                : onEmptyMessagesFetchReplyReceived(this, message);
             break;
         case FLAG_BROADCAST:
             assert(message->body && message->size);
             (*(this->onBroadcastMessageReceived))(message->body, message->size);
             break;
+        case FLAG_PRESENCE:
+            assert(this->features & NEGOTIATION_FEATURE_PRESENCE && message->body && message->size && !(message->size % PRESENCE_RECORD_SIZE));
+            for (unsigned i = 0; i < message->size; i += PRESENCE_RECORD_SIZE)
+                (*(this->onPresenceChanged))(*(unsigned*) (message->body + i), message->body[i + INT_SIZE]);
+            break;
+        case FLAG_PING:
+            assert(this->features & NEGOTIATION_FEATURE_HEARTBEAT && message->body && message->size == LONG_SIZE);
+            onPongReceived(this, *(unsigned long*) message->body);
+            break;
+        case FLAG_NEGOTIATE: // the reply came after the negotiation timed out, the default message size is used until reconnection then
+            break;
         default:
             assert(false);
     }
 }
 
-static void processConversationSetUpMessage(const Message* message) {
-    assert(message->body && message->size);
-    assert(message->flag == FLAG_EXCHANGE_KEYS && message->size == INVITE_ASK);
+static unsigned long enqueue(This* this, int flag, const byte* nullable body, unsigned size, unsigned xTo);
 
-    if (this->settingUpConversation || this->exchangingFile)
-        return;
+static inline bool sendWithoutWaiting(This* this, int flag, const byte* nullable body, unsigned size, unsigned xTo) // the setups' messages are sent with the setups mutex locked, so they're only queued, as waiting for the socket there would stall the other setups & the reading thread
+{ return enqueue(this, flag, body, size, xTo) != 0; }
+
+static inline unsigned conversationSetupTimer(This* this, const ConversationSetup* setup) { return (unsigned) (setup - this->conversationSetups); }
 
-    this->settingUpConversation = true;
-    this->inviteProcessingStartMillis = (*(this->currentTimeMillisGetter))();
+static void prolongConversationSetup(This* this, ConversationSetup* setup) // these functions are called with the setups mutex locked, so the expiration doesn't race with the setup's next step
+{ timerWheelArm(this->timers, conversationSetupTimer(this, setup), (*(this->currentTimeMillisGetter))() + TIMEOUT); }
 
-    (*(this->onConversationSetUpInviteReceived))(message->from);
+static ConversationSetup* nullable findConversationSetup(This* this, unsigned peerId) { // these functions are called with the setups mutex locked
+    for (unsigned i = 0; i < MAX_CONVERSATION_SETUPS; i++)
+        if (this->conversationSetups[i].active && this->conversationSetups[i].peerId == peerId)
+            return &(this->conversationSetups[i]);
+    return NULL;
 }
 
-static inline unsigned fileExchangeRequestInitialSize(void)
-{ return INT_SIZE + CRYPTO_HASH_SIZE + INT_SIZE + NET_MAX_FILENAME_SIZE; } // 160
+static ConversationSetup* nullable beginConversationSetup(This* this, unsigned peerId, unsigned step) { // returns null if a setup with this user is already in progress or if there are too many of them
+    if (findConversationSetup(this, peerId)) return NULL;
 
-static void processFileExchangeRequestMessage(const Message* message) {
-    assert(message->body && message->size);
-    assert(message->flag == FLAG_FILE_ASK && message->size == fileExchangeRequestInitialSize());
+    for (unsigned i = 0; i < MAX_CONVERSATION_SETUPS; i++) {
+        ConversationSetup* setup = &(this->conversationSetups[i]);
+        if (setup->active) continue;
 
-    if (this->settingUpConversation || this->exchangingFile) return;
-    this->exchangingFile = true;
-    this->inviteProcessingStartMillis = (*(this->currentTimeMillisGetter))();
+        setup->active = true;
+        setup->peerId = peerId;
+        setup->step = step;
+        setup->keys = NULL;
+        setup->coderStreams = NULL;
+        prolongConversationSetup(this, setup);
+        return setup;
+    }
+    return NULL;
+}
 
-    const unsigned fileSize = *(unsigned*) (message->body);
-    assert(fileSize);
+static void releaseConversationSetup(This* this, ConversationSetup* setup) {
+    if (setup->keys) cryptoKeysDestroy(setup->keys);
+    if (setup->coderStreams) cryptoCoderStreamsDestroy(setup->coderStreams);
+    timerWheelCancel(this->timers, conversationSetupTimer(this, setup));
+    setup->active = false;
+}
 
-    byte hash[CRYPTO_HASH_SIZE];
-    SDL_memcpy(hash, message->body + INT_SIZE, CRYPTO_HASH_SIZE);
+static bool exchangeKeysAsInviter(This* this, ConversationSetup* setup, const byte* akaServerPublicKey) {
+    setup->keys = cryptoKeysInit();
+    if (!cryptoExchangeKeys(setup->keys, akaServerPublicKey)) return false;
+    return sendWithoutWaiting(this, FLAG_EXCHANGE_KEYS_DONE, cryptoClientPublicKey(setup->keys), CRYPTO_KEY_SIZE, setup->peerId);
+}
 
-    const unsigned filenameSize = *(unsigned*) (message->body + INT_SIZE + CRYPTO_HASH_SIZE);
-    assert(filenameSize && filenameSize <= NET_MAX_FILENAME_SIZE);
-    char filename[filenameSize];
-    SDL_memcpy(filename, message->body + INT_SIZE + CRYPTO_HASH_SIZE + INT_SIZE, filenameSize);
+static bool exchangeHeadersAsInviter(This* this, ConversationSetup* setup, const byte* akaEncryptedServerStreamHeader) {
+    const unsigned encryptedHeaderSize = cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE);
+
+    byte* akaServerStreamHeader = cryptoDecryptSingle(cryptoServerKey(setup->keys), akaEncryptedServerStreamHeader, encryptedHeaderSize);
+    if (!akaServerStreamHeader) return false;
+
+    setup->coderStreams = cryptoCoderStreamsInit();
+    byte* akaClientStreamHeader = cryptoInitializeCoderStreams(setup->keys, setup->coderStreams, akaServerStreamHeader);
+    SDL_free(akaServerStreamHeader);
+    if (!akaClientStreamHeader) return false;
+
+    byte* akaEncryptedClientStreamHeader = cryptoEncryptSingle(cryptoClientKey(setup->keys), akaClientStreamHeader, CRYPTO_HEADER_SIZE);
+    assert(akaEncryptedClientStreamHeader);
+    SDL_free(akaClientStreamHeader);
 
-    (*(this->onFileExchangeInviteReceived))(message->from, fileSize, hash, filename, filenameSize);
+    const bool result = sendWithoutWaiting(this, FLAG_EXCHANGE_HEADERS_DONE, akaEncryptedClientStreamHeader, encryptedHeaderSize, setup->peerId);
+    SDL_free(akaEncryptedClientStreamHeader);
+    return result;
 }
 
-static Message* copyMessage(const Message* message) {
-    assert(message->body && message->size || !message->body && !message->size);
+static bool exchangeKeysAsInvited(This* this, ConversationSetup* setup, const byte* akaClientPublicKey) {
+    if (!cryptoExchangeKeysAsServer(setup->keys, akaClientPublicKey)) return false;
 
-    Message* new = SDL_malloc(sizeof(Message));
-    SDL_memcpy(new, message, sizeof *new);
+    setup->coderStreams = cryptoCoderStreamsInit();
+    byte* akaServerStreamHeader = cryptoCreateEncoderAsServer(setup->keys, setup->coderStreams);
+    if (!akaServerStreamHeader) return false;
 
-    if (message->size) {
-        new->body = SDL_malloc(message->size);
-        SDL_memcpy(new->body, message->body, message->size);
-    }
+    byte* akaEncryptedServerStreamHeader = cryptoEncryptSingle(cryptoServerKey(setup->keys), akaServerStreamHeader, CRYPTO_HEADER_SIZE);
+    assert(akaEncryptedServerStreamHeader);
+    SDL_free(akaServerStreamHeader);
 
-    return new;
+    const bool result = sendWithoutWaiting(this, FLAG_EXCHANGE_HEADERS, akaEncryptedServerStreamHeader, cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE), setup->peerId);
+    SDL_free(akaEncryptedServerStreamHeader);
+    return result;
 }
 
-static void processMessage(const Message* message) {
-    if (message->from == FROM_SERVER) {
-        processMessagesFromServer(message);
-        return;
-    }
+static bool exchangeHeadersAsInvited(ConversationSetup* setup, const byte* akaEncryptedClientStreamHeader) {
+    byte* akaClientStreamHeader = cryptoDecryptSingle(cryptoClientKey(setup->keys), akaEncryptedClientStreamHeader, cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE));
+    if (!akaClientStreamHeader) return false;
 
-    assert(this->state == STATE_AUTHENTICATED);
+    const bool decoderCreated = cryptoCreateDecoderStreamAsServer(setup->keys, setup->coderStreams, akaClientStreamHeader);
+    SDL_free(akaClientStreamHeader);
+    return decoderCreated;
+}
 
-    switch (message->flag) {
-        case FLAG_EXCHANGE_KEYS:
-            if (message->size == INVITE_ASK) {
-                processConversationSetUpMessage(message);
-                break;
-            }
-            fallthrough
-        case FLAG_EXCHANGE_KEYS_DONE: fallthrough
-        case FLAG_EXCHANGE_HEADERS: fallthrough
-        case FLAG_EXCHANGE_HEADERS_DONE:
-            queuePush(this->conversationSetupMessages, copyMessage(message));
+static bool advanceConversationSetup(This* this, ConversationSetup* setup, const Message* message) { // returns true if the setup has finished, on failure the coder streams are destroyed
+    const unsigned encryptedHeaderSize = cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE);
+    bool succeeded = false;
+    unsigned nextStep = SETUP_STEP_FINISHED;
+
+    switch (setup->step) {
+        case SETUP_STEP_INVITE_SENT: // a denial has the same flag but a different size
+            succeeded = message->flag == FLAG_EXCHANGE_KEYS && message->size == CRYPTO_KEY_SIZE
+                && exchangeKeysAsInviter(this, setup, message->body);
+            nextStep = SETUP_STEP_KEYS_EXCHANGED;
             break;
-        case FLAG_FILE_ASK:
-            if (message->size == fileExchangeRequestInitialSize()) {
-                assert(message->body);
-                processFileExchangeRequestMessage(message);
-                break;
-            }
-            fallthrough
-        case FLAG_FILE:
-            queuePush(this->fileExchangeMessages, copyMessage(message));
+        case SETUP_STEP_KEYS_EXCHANGED:
+            succeeded = message->flag == FLAG_EXCHANGE_HEADERS && message->size == encryptedHeaderSize
+                && exchangeHeadersAsInviter(this, setup, message->body);
             break;
-        case FLAG_PROCEED:
-            assert(message->body && message->size);
-            if (!this->fetchingUsers && !this->fetchingMessages && !this->ignoreUsualMessages) // messages from other users can be lost here, but as we now have a re-fetching messages mechanism, this is no longer a problem
-                (*(this->onMessageReceived))(message->timestamp, message->from, message->body, message->size); // TODO: update users list gets updated and re-fetch messages right after setup (after successful calls to createConversation and replyToConversationSetupInvite)
+        case SETUP_STEP_KEY_SENT:
+            succeeded = message->flag == FLAG_EXCHANGE_KEYS_DONE && message->size == CRYPTO_KEY_SIZE
+                && exchangeKeysAsInvited(this, setup, message->body);
+            nextStep = SETUP_STEP_HEADER_SENT;
             break;
-        case FLAG_FETCH_MESSAGES:
-            onNextMessageFetched(message);
+        case SETUP_STEP_HEADER_SENT:
+            succeeded = message->flag == FLAG_EXCHANGE_HEADERS_DONE && message->size == encryptedHeaderSize
+                && exchangeHeadersAsInvited(setup, message->body);
             break;
-        default:
+        default: // the inviter mustn't send anything while the invite hasn't been replied yet
             break;
     }
-}
-
-static void onDisconnected(void) {
-    (*(this->onDisconnected))();
-    netClean();
-}
-
-static bool checkSocket(void) {
-    RW_MUTEX_WRITE_LOCKED(this->rwMutex,
-        const bool result = SDLNet_CheckSockets(this->socketSet, 0) == 1
-            && SDLNet_SocketReady(this->socket) != 0;
-    )
-    return result;
-}
 
-static unsigned encryptedMessageMaxSize(void) { return cryptoEncryptedSize(MAX_MESSAGE_SIZE); }
+    if (!succeeded && setup->coderStreams) {
+        cryptoCoderStreamsDestroy(setup->coderStreams);
+        setup->coderStreams = NULL;
+    }
 
-static bool receivePart(void* buffer, unsigned targetSize) { // parts: size - first part, encrypted message - second part
-    RW_MUTEX_WRITE_LOCKED(this->rwMutex,
-        const int result = SDLNet_TCP_Recv(this->socket, buffer, (int) targetSize);
-    )
-    return result == (int) targetSize; // Recv returns zero on socket was disconnection or error appearing
+    setup->step = succeeded ? nextStep : SETUP_STEP_FINISHED;
+    prolongConversationSetup(this, setup);
+    return setup->step == SETUP_STEP_FINISHED;
 }
 
-static Message* nullable receive(void) {
-    unsigned size = 0;
-    if (!receivePart(&size, INT_SIZE)) return NULL; // disconnected
-    assert(size && size <= encryptedMessageMaxSize());
-
-    byte buffer[size];
-    if (!receivePart(buffer, size)) return NULL;
-
-    RW_MUTEX_WRITE_LOCKED(this->rwMutex,
-        byte* decrypted = cryptoDecrypt(this->connectionCoderStreams, buffer, size, false);
-    )
-    assert(decrypted);
+static void processConversationSetUpMessage(This* this, const Message* message) {
+    assert(message->body && message->size);
 
-    Message* message = unpackMessage(decrypted);
-    SDL_free(decrypted);
-    return message;
-}
+    bool invited = false, finished = false;
+    CryptoCoderStreams* coderStreams = NULL;
 
-static void readReceivedMessage(void) {
-    Message* message = NULL;
+    SDL_LockMutex(this->conversationSetupsMutex);
 
-    if (!(message = receive()))
-        onDisconnected();
+    if (message->flag == FLAG_EXCHANGE_KEYS && message->size == INVITE_ASK)
+        invited = beginConversationSetup(this, message->from, SETUP_STEP_INVITE_RECEIVED) != NULL; // ignored if a setup with this user is already in progress
     else {
-        processMessage(message);
-        destroyMessage(message);
+        ConversationSetup* setup = findConversationSetup(this, message->from);
+
+        if (setup && (finished = advanceConversationSetup(this, setup, message))) {
+            coderStreams = setup->coderStreams; // ownership is passed to the callback
+            setup->coderStreams = NULL;
+            releaseConversationSetup(this, setup);
+        }
     }
-}
 
-void netListen(void) {
-    assert(this);
-    while (this && checkSocket()) // read all messages that were sent during the past update frame and not only one message per update frame
-        readReceivedMessage(); // checking 'this' for nullability every time despite the assertion before is needed as the module can be re-initialized during the cycle which then will cause SIGSEGV 'cause the address inside 'this' will become invalid - re-initializing after registration is the example
-}
+    SDL_UnlockMutex(this->conversationSetupsMutex);
 
-unsigned netCurrentUserId(void) {
-    assert(this);
-    return this->userId;
+    if (invited) (*(this->onConversationSetUpInviteReceived))(message->from);
+    if (finished) (*(this->onConversationSetUp))(message->from, coderStreams);
 }
 
-static bool sendBytes(const void* buffer, unsigned targetSize) {
-    RW_MUTEX_WRITE_LOCKED(this->rwMutex,
-        const int bytesSent = SDLNet_TCP_Send(this->socket, buffer, (int) targetSize);
-    )
-    return bytesSent == (int) targetSize;
-}
+static void expireConversationSetups(This* this, const unsigned* timers, unsigned count) { // receives the expired timers, the file transfers' ones among them are skipped
+    unsigned expired[MAX_CONVERSATION_SETUPS], expiredCount = 0;
 
-bool netSend(int flag, const byte* nullable body, unsigned size, unsigned xTo) {
-    assert(this);
-    assert(body && size && size <= NET_MAX_MESSAGE_BODY_SIZE || !body && !size && flag != FLAG_PROCEED && flag != FLAG_BROADCAST);
+    SDL_LockMutex(this->conversationSetupsMutex);
 
-    Message message = {
-        flag,
-        (*(this->currentTimeMillisGetter))(),
-        size,
-        0,
-        1,
-        this->userId,
-        xTo,
-        {0},
-        size ? (byte*) body : NULL
-    };
-    RW_MUTEX_READ_LOCKED(this->rwMutex,
-        SDL_memcpy(&(message.token), this->token, TOKEN_SIZE);
-    )
+    for (unsigned i = 0; i < count; i++) {
+        if (timers[i] >= MAX_CONVERSATION_SETUPS) continue;
 
-    const unsigned packedSize = wholeMessageBytesSize(size);
+        ConversationSetup* setup = &(this->conversationSetups[timers[i]]);
+        if (!setup->active || timerWheelArmed(this->timers, timers[i])) continue; // has been released or has advanced to the next step since the timer expired
 
-    byte* packedMessage = packMessage(&message);
-    byte* encryptedMessage = cryptoEncrypt(
-        this->connectionCoderStreams,
-        packedMessage,
-        packedSize,
-        false
-    );
-    SDL_free(packedMessage);
+        if (setup->step != SETUP_STEP_INVITE_RECEIVED) // the invited user will know about it as the reply to the invite fails
+            expired[expiredCount++] = setup->peerId;
 
-    assert(encryptedMessage);
-    const unsigned encryptedSize = cryptoEncryptedSize(packedSize);
-    assert(encryptedSize <= cryptoEncryptedSize(MAX_MESSAGE_SIZE));
+        releaseConversationSetup(this, setup);
+    }
 
-    byte buffer[INT_SIZE + encryptedSize];
-    *((unsigned*) buffer) = encryptedSize;
-    SDL_memcpy(buffer + INT_SIZE, encryptedMessage, encryptedSize);
-    SDL_free(encryptedMessage);
+    SDL_UnlockMutex(this->conversationSetupsMutex);
 
-    return sendBytes(buffer, sizeof buffer);
+    for (unsigned i = 0; i < expiredCount; i++)
+        (*(this->onConversationSetUp))(expired[i], NULL);
 }
 
-void netShutdownServer(void) {
-    assert(this);
-    netSend(FLAG_SHUTDOWN, NULL, 0, TO_SERVER);
-}
+static inline unsigned fileExchangeRequestInitialSize(void)
+{ return INT_SIZE + CRYPTO_HASH_SIZE + INT_SIZE + NET_MAX_FILENAME_SIZE + FILE_EXCHANGE_EXTENSION_SIZE; } // 160
 
-static NetUserInfo* unpackUserInfo(const byte* bytes) {
-    NetUserInfo* info = SDL_malloc(sizeof *info);
+static inline unsigned fileTransferTimer(This* this, const FileTransfer* transfer) { return MAX_CONVERSATION_SETUPS + (unsigned) (transfer - this->fileTransfers); }
 
-    SDL_memcpy(&(info->id), bytes, INT_SIZE);
-    SDL_memcpy(&(info->connected), bytes + INT_SIZE, 1);
-    SDL_memcpy(&(info->name), bytes + INT_SIZE + 1, NET_USERNAME_SIZE);
+static void prolongFileTransfer(This* this, FileTransfer* transfer) // these functions are called with the transfers mutex locked
+{ timerWheelArm(this->timers, fileTransferTimer(this, transfer), (*(this->currentTimeMillisGetter))() + TIMEOUT); }
 
-    return info;
+static void releaseFileTransfer(This* this, FileTransfer* transfer) {
+    timerWheelCancel(this->timers, fileTransferTimer(this, transfer));
+    transfer->active = false;
 }
 
-void netFetchUsers(void) {
-    assert(this && !this->fetchingUsers && !this->fetchingMessages);
-    this->fetchingUsers = true;
-    netSend(FLAG_FETCH_USERS, NULL, 0, TO_SERVER);
-}
+static FileTransfer* nullable findFileTransfer(This* this, unsigned peerId, unsigned step, const unsigned* nullable streamId) { // these functions are called with the transfers mutex locked; returns the earliest begun one if the stream id isn't specified
+    FileTransfer* found = NULL;
 
-void netSendBroadcast(const byte* text, unsigned size) {
-    assert(this && size);
-    netSend(FLAG_BROADCAST, text, size, TO_SERVER);
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS; i++) {
+        FileTransfer* transfer = &(this->fileTransfers[i]);
+        if (!transfer->active || transfer->peerId != peerId || transfer->step != step) continue;
+        if (streamId && transfer->streamId != *streamId) continue;
+        if (!found || transfer->id < found->id) found = transfer;
+    }
+    return found;
 }
 
-unsigned netUserInfoId(const NetUserInfo* info) {
-    assert(info);
-    return info->id;
+static FileTransfer* nullable findFileTransferById(This* this, unsigned id) {
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS; i++)
+        if (this->fileTransfers[i].active && this->fileTransfers[i].id == id) return &(this->fileTransfers[i]);
+    return NULL;
 }
 
-bool netUserInfoConnected(const NetUserInfo* info) {
-    assert(info);
-    return info->connected;
+static FileTransfer* nullable beginFileTransfer(This* this, unsigned id, unsigned peerId, unsigned step, unsigned fileSize) { // returns null if there are too many of them
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS; i++) {
+        FileTransfer* transfer = &(this->fileTransfers[i]);
+        if (transfer->active) continue;
+
+        SDL_memset(transfer, 0, sizeof *transfer);
+        transfer->active = true;
+        transfer->id = id;
+        transfer->peerId = peerId;
+        transfer->step = step;
+        transfer->fileSize = fileSize;
+        prolongFileTransfer(this, transfer);
+        return transfer;
+    }
+    return NULL;
 }
 
-const byte* netUserInfoName(const NetUserInfo* info) {
-    assert(info);
-    return info->name;
-}
+static inline unsigned negotiatedChunkSize(This* this, unsigned peerMaxMessageBodySize) // min of the peer's and of the current user's max message body sizes
+{ return max(NET_MAX_MESSAGE_BODY_SIZE, min(peerMaxMessageBodySize, netMaxMessageBodySize(this))); }
 
-NetUserInfo* netUserInfoCopy(const NetUserInfo* info) {
-    assert(info);
-    NetUserInfo* new = SDL_malloc(sizeof *new);
+static void processFileExchangeInvite(This* this, const Message* message) {
+    assert(message->body && message->size == fileExchangeRequestInitialSize());
 
-    new->id = info->id;
-    new->connected = info->connected;
-    SDL_memcpy(new->name, info->name, NET_USERNAME_SIZE);
+    const byte* extension = message->body + fileExchangeRequestInitialSize() - FILE_EXCHANGE_EXTENSION_SIZE;
+    const bool extended = *(unsigned*) extension == FILE_EXCHANGE_EXTENSION_MAGIC;
+    const unsigned streamId = extended ? *(unsigned*) (extension + INT_SIZE * 2) : 0; // clients, which don't support multiplexing, leave it zeroed
 
-    return new;
-}
+    const unsigned fileSize = *(unsigned*) (message->body);
+    assert(fileSize);
 
-void netUserInfoDestroy(NetUserInfo* info) { SDL_free(info); }
+    byte hash[CRYPTO_HASH_SIZE];
+    SDL_memcpy(hash, message->body + INT_SIZE, CRYPTO_HASH_SIZE);
 
-void netSetIgnoreUsualMessages(bool ignore) {
-    assert(this);
-    this->ignoreUsualMessages = ignore;
-}
+    const unsigned filenameSize = *(unsigned*) (message->body + INT_SIZE + CRYPTO_HASH_SIZE);
+    assert(filenameSize && filenameSize <= (extended ? NET_MAX_FILENAME_SIZE : LEGACY_MAX_FILENAME_SIZE));
+    char filename[filenameSize];
+    SDL_memcpy(filename, message->body + INT_SIZE + CRYPTO_HASH_SIZE + INT_SIZE, filenameSize);
 
-void netFetchMessages(unsigned id, unsigned long afterTimestamp) {
-    assert(this && !this->fetchingUsers && !this->fetchingMessages);
-    this->fetchingMessages = true;
+    SDL_LockMutex(this->fileTransfersMutex);
 
-    byte body[1 + LONG_SIZE + INT_SIZE] = {0};
+    FileTransfer* transfer = NULL;
+    const bool duplicate = findFileTransfer(this, message->from, TRANSFER_STEP_INVITE_RECEIVED, &streamId)
+        || findFileTransfer(this, message->from, TRANSFER_STEP_RECEIVING, &streamId); // chunks of transfers with the same stream id would be indistinguishable
 
-    body[0] = 1;
-    *((unsigned long*) &(body[1])) = afterTimestamp;
-    *((unsigned*) &(body[1 + LONG_SIZE])) = id;
+    if (!duplicate && (transfer = beginFileTransfer(this, ++(this->lastFileTransferId), message->from, TRANSFER_STEP_INVITE_RECEIVED, fileSize))) {
+        transfer->streamId = streamId;
+        transfer->multiplexed = streamId != 0;
+        transfer->extended = extended;
+        transfer->chunkSize = extended ? negotiatedChunkSize(this, *(unsigned*) (extension + INT_SIZE)) : NET_MAX_MESSAGE_BODY_SIZE;
 
-    netSend(FLAG_FETCH_MESSAGES, body, sizeof body, TO_SERVER);
-}
+        const unsigned window = *(unsigned*) (extension + INT_SIZE * 3) & ~FILE_EXCHANGE_COMPRESSION_BIT;
+        transfer->window = streamId ? min(window, FILE_EXCHANGE_WINDOW) : 0; // zeroed by clients which don't acknowledge chunks
+        transfer->compressed = transfer->window && *(unsigned*) (extension + INT_SIZE * 3) & FILE_EXCHANGE_COMPRESSION_BIT;
+    }
+    const unsigned id = transfer ? transfer->id : 0;
+    const bool compressed = transfer && transfer->compressed;
 
-static void onNextMessageFetched(const Message* message) {
-    assert(this && this->fetchingMessages);
-    assert(message->body && message->size);
-    const bool last = message->index == message->count - 1;
+    SDL_UnlockMutex(this->fileTransfersMutex);
 
-    (*(this->onNextMessageFetched))(message->from, message->timestamp, message->size, message->body, last);
-    if (last) this->fetchingMessages = false;
+    if (id) (*(this->onFileExchangeInviteReceived))(id, message->from, fileSize, hash, filename, filenameSize, compressed);
 }
 
-static void onEmptyMessagesFetchReplyReceived(const Message* message) {
-    assert(this && this->fetchingMessages);
-    assert(message->body && message->size);
-    assert(message->count == 1);
+static void requestFileChunksPump(This* this);
 
-    (*(this->onNextMessageFetched))(*(unsigned*) (message->body + 1 + LONG_SIZE), message->timestamp, 0, NULL, true);
-    this->fetchingMessages = false;
+static void processFileExchangeAck(This* this, const Message* message) { // [magic][stream id][count of chunks received so far]
+    const unsigned streamId = *(unsigned*) (message->body + INT_SIZE), receivedChunks = *(unsigned*) (message->body + INT_SIZE * 2);
+
+    SDL_LockMutex(this->fileTransfersMutex);
+
+    FileTransfer* transfer = findFileTransfer(this, message->from, TRANSFER_STEP_SENDING, &streamId);
+    if (!transfer) transfer = findFileTransfer(this, message->from, TRANSFER_STEP_FLUSHING, &streamId);
+
+    if (!transfer || !transfer->window || receivedChunks > transfer->nextIndex) {
+        SDL_UnlockMutex(this->fileTransfersMutex);
+        return;
+    }
+
+    transfer->ackedChunks = max(transfer->ackedChunks, receivedChunks);
+    prolongFileTransfer(this, transfer);
+
+    const unsigned id = transfer->id;
+    const bool finished = transfer->step == TRANSFER_STEP_FLUSHING && transfer->ackedChunks == transfer->nextIndex; // the end of the transfer has been sent & the receiver has got everything
+    if (finished) releaseFileTransfer(this, transfer);
+
+    SDL_UnlockMutex(this->fileTransfersMutex);
+
+    if (finished)
+        (*(this->onFileExchangeFinished))(id, true);
+    else
+        requestFileChunksPump(this); // the window has moved
 }
 
-static void onNextUsersBundleFetched(const Message* message) {
-    assert(this && this->fetchingUsers);
-    assert(message->body && message->size && message->size <= NET_MAX_MESSAGE_BODY_SIZE);
-    if (!(message->index)) listClear(this->userInfosList); // TODO: test with large amount of elements & test with sleep()
+static void processFileExchangeReply(This* this, const Message* message) {
+    if (!message->body || (message->size != INT_SIZE && message->size != INT_SIZE * 2 && message->size != INT_SIZE * 3 && message->size != INT_SIZE * 4)) return; // the second int is the agreed chunk size, the third one is the stream id & the fourth one is the agreed window, older clients don't send them
 
-    for (unsigned i = 0; i < message->size; i += USER_INFO_SIZE)
-        listAddBack(this->userInfosList, unpackUserInfo(message->body + i));
+    if (message->size == INT_SIZE * 3 && *(unsigned*) message->body == FILE_EXCHANGE_ACK_MAGIC) {
+        processFileExchangeAck(this, message);
+        return;
+    }
 
-    if (message->index < message->count - 1) return; // not the last bundle
+    SDL_LockMutex(this->fileTransfersMutex);
 
-    (*(this->onUsersFetched))(this->userInfosList);
-    listClear(this->userInfosList);
-    this->fetchingUsers = false;
+    FileTransfer* transfer = findFileTransfer(this, 
+        message->from,
+        TRANSFER_STEP_AWAITING_REPLY,
+        message->size >= INT_SIZE * 3 ? (const unsigned*) (message->body + INT_SIZE * 2) : NULL
+    );
+
+    if (!transfer) {
+        SDL_UnlockMutex(this->fileTransfersMutex);
+        return;
+    }
+
+    const unsigned id = transfer->id;
+    const bool accepted = *(unsigned*) message->body == transfer->fileSize; // 0 if denied
+
+    if (accepted) {
+        transfer->chunkSize = message->size >= INT_SIZE * 2 ? negotiatedChunkSize(this, *(unsigned*) (message->body + INT_SIZE)) : NET_MAX_MESSAGE_BODY_SIZE;
+        transfer->multiplexed = message->size >= INT_SIZE * 3;
+        const unsigned window = message->size == INT_SIZE * 4 ? *(unsigned*) (message->body + INT_SIZE * 3) : 0, agreedWindow = window & ~FILE_EXCHANGE_COMPRESSION_BIT;
+        transfer->window = min(agreedWindow, FILE_EXCHANGE_WINDOW);
+        transfer->compressed = transfer->compressed && window & FILE_EXCHANGE_COMPRESSION_BIT; // the receiver may not support the compression
+        transfer->step = TRANSFER_STEP_SENDING;
+        prolongFileTransfer(this, transfer);
+    } else
+        releaseFileTransfer(this, transfer);
+
+    SDL_UnlockMutex(this->fileTransfersMutex);
+
+    if (accepted)
+        requestFileChunksPump(this);
+    else
+        (*(this->onFileExchangeFinished))(id, false);
 }
 
-static void finishSettingUpConversation(void) {
-    queueClear(this->conversationSetupMessages);
-    this->settingUpConversation = false;
+static void sendFileExchangeAck(This* this, unsigned toId, unsigned streamId, unsigned receivedChunks) { // doesn't wait for it to be sent
+    const unsigned ack[3] = {FILE_EXCHANGE_ACK_MAGIC, streamId, receivedChunks};
+    enqueue(this, FLAG_FILE_ASK, (const byte*) ack, sizeof ack, toId);
 }
 
-CryptoCoderStreams* nullable netCreateConversation(unsigned id) { // TODO: start receiving messages from users only after all users were fetched and assert that the sender's id is found locally
-    assert(this);
+static void processFileChunk(This* this, const Message* message) { // chunks of transfers with a window are [stream id][chunk], such a transfer ends with the stream id alone
+    if (!message->body || !message->size) return;
+
+    SDL_LockMutex(this->fileTransfersMutex);
 
-    assert(!this->settingUpConversation && !this->exchangingFile);
-    this->settingUpConversation = true;
-    queueClear(this->conversationSetupMessages);
+    FileTransfer* transfer = NULL;
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS && !transfer; i++) {
+        FileTransfer* xTransfer = &(this->fileTransfers[i]);
+        if (!xTransfer->active || xTransfer->peerId != message->from || xTransfer->step != TRANSFER_STEP_RECEIVING) continue;
 
-    if (!netSend(FLAG_EXCHANGE_KEYS, (byte[INVITE_ASK]) {0}, INVITE_ASK, id)) {
-        finishSettingUpConversation();
-        return NULL;
+        if (!xTransfer->multiplexed || (message->size >= INT_SIZE && *(unsigned*) message->body == xTransfer->streamId))
+            transfer = xTransfer;
     }
 
-    Message* message;
+    if (!transfer || (!transfer->window && message->size <= (transfer->multiplexed ? INT_SIZE : 0))) {
+        SDL_UnlockMutex(this->fileTransfersMutex);
+        return;
+    }
 
-    if (!(message = queueWaitAndPop(this->conversationSetupMessages, (int) TIMEOUT))
-        || message->flag != FLAG_EXCHANGE_KEYS
-        || message->size != CRYPTO_KEY_SIZE
-        || !message->body)
-    {
-        finishSettingUpConversation();
-        destroyMessage(message);
-        return NULL;
+    const unsigned id = transfer->id, streamId = transfer->streamId, prefixSize = transfer->multiplexed ? INT_SIZE : 0;
+    const bool ended = message->size == prefixSize;
+
+    const unsigned index = ended ? transfer->nextIndex : transfer->nextIndex++, receivedChunks = transfer->nextIndex;
+    const bool acknowledged = transfer->window && (ended || !(receivedChunks % max(1u, transfer->window / 4))); // the sender gets the window moved before it's exhausted
+    prolongFileTransfer(this, transfer);
+    if (ended) releaseFileTransfer(this, transfer);
+
+    SDL_UnlockMutex(this->fileTransfersMutex); // the transfer is released only by this thread, so it stays as is while its chunk is being processed
+
+    if (!ended) {
+        assert(message->size - prefixSize <= netMaxMessageBodySize(this));
+        (*(this->netNextFileChunkReceiver))(id, index, message->size - prefixSize, message->body + prefixSize);
     }
 
-    byte akaServerPublicKey[CRYPTO_KEY_SIZE];
-    SDL_memcpy(akaServerPublicKey, message->body, CRYPTO_KEY_SIZE);
-    destroyMessage(message);
+    if (acknowledged) sendFileExchangeAck(this, message->from, streamId, receivedChunks); // after the chunk has been processed, so a slow receiver slows the sender down
+    if (ended) (*(this->onFileExchangeFinished))(id, true);
+}
+
+static void expireFileTransfers(This* this, const unsigned* timers, unsigned count) { // the same
+    unsigned finished[MAX_FILE_TRANSFERS], finishedCount = 0;
+    bool results[MAX_FILE_TRANSFERS];
+
+    SDL_LockMutex(this->fileTransfersMutex);
+
+    for (unsigned i = 0; i < count; i++) {
+        if (timers[i] < MAX_CONVERSATION_SETUPS) continue;
 
-    CryptoKeys* keys = cryptoKeysInit();
+        FileTransfer* transfer = &(this->fileTransfers[timers[i] - MAX_CONVERSATION_SETUPS]);
+        if (!transfer->active || timerWheelArmed(this->timers, timers[i])) continue;
+
+        const bool sending = transfer->step == TRANSFER_STEP_SENDING || transfer->step == TRANSFER_STEP_FLUSHING;
+        if (sending && !transfer->window) continue; // finished by the writing thread, as acknowledgements never come
+
+        if (transfer->step != TRANSFER_STEP_INVITE_RECEIVED) { // the receiver will know about it as the reply to the invite fails
+            results[finishedCount] = transfer->step == TRANSFER_STEP_RECEIVING && !transfer->window; // the sender has stopped sending chunks, there's no other way to know that the transfer has ended unless the sender ends it explicitly
+            finished[finishedCount++] = transfer->id;
+        }
 
-    if (!cryptoExchangeKeys(keys, akaServerPublicKey)) {
-        finishSettingUpConversation();
-        cryptoKeysDestroy(keys);
-        return NULL;
+        releaseFileTransfer(this, transfer);
     }
 
-    if (!netSend(FLAG_EXCHANGE_KEYS_DONE, cryptoClientPublicKey(keys), CRYPTO_KEY_SIZE, id)) {
-        finishSettingUpConversation();
-        cryptoKeysDestroy(keys);
-        return NULL;
+    SDL_UnlockMutex(this->fileTransfersMutex);
+
+    for (unsigned i = 0; i < finishedCount; i++)
+        (*(this->onFileExchangeFinished))(finished[i], results[i]);
+}
+
+static bool tryEnqueue(This* this, int flag, const byte* body, unsigned size, unsigned xTo, unsigned long* sequence);
+
+static bool checkHeartbeat(This* this, unsigned long now) { // returns false if the connection is dead
+    if (!(this->features & NEGOTIATION_FEATURE_HEARTBEAT)) return true; // silence is normal then
+    if (now - this->lastReceivedMillis >= this->heartbeatTimeout) return false;
+    if (now - this->lastPingMillis < this->heartbeatTimeout / HEARTBEAT_PINGS_PER_TIMEOUT) return true;
+
+    unsigned long sequence = 0;
+    if (tryEnqueue(this, FLAG_PING, (const byte*) &now, LONG_SIZE, TO_SERVER, &sequence)) // pings wait for the next check if the outbox is full, the connection is busy anyway
+        this->lastPingMillis = now;
+    return true;
+}
+
+static bool checkDeadlines(This* this) { // called by the listening thread on every iteration; returns false if the connection is dead
+    const unsigned long now = (*(this->currentTimeMillisGetter))();
+
+    unsigned expired[MAX_CONVERSATION_SETUPS + MAX_FILE_TRANSFERS];
+    const unsigned expiredCount = timerWheelAdvance(this->timers, now, expired); // costs nothing unless a tick has passed, the expired timers are handed over without scanning the setups & the transfers
+
+    if (expiredCount) {
+        expireConversationSetups(this, expired, expiredCount);
+        expireFileTransfers(this, expired, expiredCount);
     }
 
-    const unsigned encryptedHeaderSize = cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE);
+    if (now < this->nextHeartbeatCheck) return true;
+    this->nextHeartbeatCheck = now + LISTEN_POLL_TIMEOUT;
+    return checkHeartbeat(this, now);
+}
 
-    if (!(message = queueWaitAndPop(this->conversationSetupMessages, (int) TIMEOUT))
-        || message->flag != FLAG_EXCHANGE_HEADERS
-        || message->size != encryptedHeaderSize
-        || !message->body)
-    {
-        finishSettingUpConversation();
-        destroyMessage(message);
-        cryptoKeysDestroy(keys);
-        return NULL;
+static unsigned listenTimeout(This* this) { // the listening thread blocks on the socket till the next deadline, but not longer than the poll timeout as it needs to notice that it has to stop
+    const unsigned long next = timerWheelNextExpiration(this->timers), now = (*(this->currentTimeMillisGetter))();
+    return next <= now ? 0 : (unsigned) min(next - now, (unsigned long) LISTEN_POLL_TIMEOUT);
+}
+
+static void processMessage(This* this, const Message* message) { // every message is processed right in the listening thread, the message's body is valid only until this returns
+    if (message->from == FROM_SERVER) {
+        processMessagesFromServer(this, message);
+        return;
     }
 
-    byte akaEncryptedServerStreamHeader[encryptedHeaderSize];
-    SDL_memcpy(akaEncryptedServerStreamHeader, message->body, encryptedHeaderSize);
-    destroyMessage(message);
+    assert(this->state == STATE_AUTHENTICATED);
 
-    byte* akaServerStreamHeader = cryptoDecryptSingle(cryptoServerKey(keys), akaEncryptedServerStreamHeader, encryptedHeaderSize);
-    if (!akaServerStreamHeader) {
-        finishSettingUpConversation();
-        cryptoKeysDestroy(keys);
-        return NULL;
+    switch (message->flag) {
+        case FLAG_EXCHANGE_KEYS: fallthrough
+        case FLAG_EXCHANGE_KEYS_DONE: fallthrough
+        case FLAG_EXCHANGE_HEADERS: fallthrough
+        case FLAG_EXCHANGE_HEADERS_DONE:
+            processConversationSetUpMessage(this, message);
+            break;
+        case FLAG_FILE_ASK:
+            message->size == fileExchangeRequestInitialSize()
+                ? processFileExchangeInvite(this, message)
+                : processFileExchangeReply(this, message);
+            break;
+        case FLAG_FILE:
+            processFileChunk(this, message);
+            break;
+        case FLAG_PROCEED:
+            assert(message->body && message->size);
+            if (this->fetchingUsers) this->droppedWhileFetchingUsers++; // messages from other users can be lost here, but as we now have a re-fetching messages mechanism, this is no longer a problem
+            else if (this->fetchingMessages) this->droppedWhileFetchingMessages++;
+            else if (this->ignoreUsualMessages) this->droppedWhileIgnoring++;
+            else (*(this->onMessageReceived))(message->timestamp, message->from, message->body, message->size); // TODO: update users list gets updated and re-fetch messages right after setup (after successful calls to createConversation and replyToConversationSetupInvite)
+            break;
+        case FLAG_FETCH_MESSAGES:
+            onNextMessageFetched(this, message);
+            break;
+        default:
+            break;
     }
+}
 
-    CryptoCoderStreams* coderStreams = cryptoCoderStreamsInit();
-    byte* akaClientStreamHeader = cryptoInitializeCoderStreams(keys, coderStreams, akaServerStreamHeader);
-    SDL_free(akaServerStreamHeader);
+static void onDisconnected(This* this) { // the connection isn't freed here but by its owner, so the owner's other threads, which may still be using it, don't race this one
+    this->listening = false;
+    stopWriting(this);
+    (*(this->onDisconnected))();
+}
+
+static bool checkSocket(This* this, unsigned timeout) // only the thread that reads from the connection waits on it, so it's not locked here, which lets other threads send while this one is blocked waiting
+{ return (*(this->transport->ready))(this->connection, timeout); }
 
-    if (!akaClientStreamHeader) {
-        finishSettingUpConversation();
-        cryptoCoderStreamsDestroy(coderStreams);
-        cryptoKeysDestroy(keys);
-        return NULL;
+static bool receiveAll(This* this, byte* buffer, unsigned size) { // for the handshake's fixed-size parts, which may arrive in several reads
+    for (unsigned received = 0; received < size;) {
+        const int count = (*(this->transport->receive))(this->connection, buffer + received, size - received);
+        if (count <= 0) return false;
+        received += (unsigned) count;
     }
+    return true;
+}
 
-    byte* akaEncryptedClientStreamHeader = cryptoEncryptSingle(cryptoClientKey(keys), akaClientStreamHeader, CRYPTO_HEADER_SIZE);
-    assert(akaEncryptedClientStreamHeader);
-    cryptoKeysDestroy(keys);
-    SDL_free(akaClientStreamHeader);
+static unsigned encryptedMessageMaxSize(void) { return cryptoEncryptedSize(MAX_NEGOTIABLE_MESSAGE_SIZE); } // messages of this size can be received since the negotiation is begun as the server may reply after the negotiation timed out
 
-    const bool result = netSend(FLAG_EXCHANGE_HEADERS_DONE, akaEncryptedClientStreamHeader, encryptedHeaderSize, id);
-    SDL_free(akaEncryptedClientStreamHeader);
-    finishSettingUpConversation();
+staticAssert(RECEIVE_BUFFER_SIZE >= INT_SIZE + MAX_NEGOTIABLE_MESSAGE_SIZE * 2); // a whole frame of the largest size (with the encryption overhead) always fits in once the remainder of the previous read is moved to the beginning
 
-    if (!result) {
-        cryptoCoderStreamsDestroy(coderStreams);
-        return NULL;
+static bool fillReceiveBuffer(This* this) { // performs a single read of whatever has arrived, blocks if nothing has, so it's called once the socket is ready; returns false if disconnected; frames are parsed from the buffer so there's no need to make a read per frame part
+    const unsigned remaining = this->receiveBufferEnd - this->receiveBufferStart;
+    if (this->receiveBufferStart) { // the incomplete frame is moved to the beginning to make room for the rest of it
+        SDL_memmove(this->receiveBuffer, this->receiveBuffer + this->receiveBufferStart, remaining);
+        this->receiveBufferStart = 0;
+        this->receiveBufferEnd = remaining;
     }
 
-    return coderStreams;
+    const int received = (*(this->transport->receive))(this->connection, this->receiveBuffer + remaining, RECEIVE_BUFFER_SIZE - remaining);
+    if (received <= 0) return false; // zero or less means the disconnection or an error
+
+    this->receiveBufferEnd += (unsigned) received;
+    this->bytesReceived += (unsigned) received;
+    this->lastReceivedMillis = (*(this->currentTimeMillisGetter))();
+    return true;
 }
 
-static inline bool inviteProcessingTimeoutExceeded(void)
-{ return (*(this->currentTimeMillisGetter))() - this->inviteProcessingStartMillis > TIMEOUT; }
+static byte* nullable nextBufferedFrame(This* this, unsigned* size, bool* compact) { // returns the beginning of the next whole encrypted frame inside the buffer (and consumes it) or null if it hasn't been fully received yet
+    const unsigned available = this->receiveBufferEnd - this->receiveBufferStart;
+    if (available < INT_SIZE) return NULL;
 
-CryptoCoderStreams* nullable netReplyToConversationSetUpInvite(bool accept, unsigned fromId) { // TODO: create a dashboard page with some analysis for admin
-    assert(this);
-    assert(this->settingUpConversation && !this->exchangingFile);
-    queueClear(this->conversationSetupMessages);
+    unsigned prefix;
+    SDL_memcpy(&prefix, this->receiveBuffer + this->receiveBufferStart, INT_SIZE);
+
+    *compact = prefix & COMPACT_FRAME_BIT;
+    *size = prefix & ~COMPACT_FRAME_BIT;
+    assert(*size > cryptoEncryptedSize(0) && *size <= encryptedMessageMaxSize());
+
+    if (available < INT_SIZE + *size) return NULL;
+
+    byte* frame = this->receiveBuffer + this->receiveBufferStart + INT_SIZE;
+    this->receiveBufferStart += INT_SIZE + *size;
+    return frame;
+}
 
-    if (inviteProcessingTimeoutExceeded()) {
-        finishSettingUpConversation();
-        return NULL;
+static bool hasBufferedFrame(This* this) {
+    const unsigned available = this->receiveBufferEnd - this->receiveBufferStart;
+    if (available < INT_SIZE) return false;
+
+    unsigned prefix;
+    SDL_memcpy(&prefix, this->receiveBuffer + this->receiveBufferStart, INT_SIZE);
+    return available >= INT_SIZE + (prefix & ~COMPACT_FRAME_BIT);
+}
+
+static bool receiveBuffered(This* this, Message* message) { // must be called with the receive mutex locked, returns false if the next frame hasn't been fully received yet; the message's body points into the receive buffer, so it's valid until the next read
+    unsigned size = 0;
+    bool compact = false;
+
+    byte* frame = nextBufferedFrame(this, &size, &compact);
+    if (!frame) return false;
+
+    const unsigned long started = SDL_GetPerformanceCounter();
+    const bool decrypted = cryptoDecryptInPlace(this->connectionCoderStreams, frame, size, false); // the frame stays in the buffer until the next read, which happens only after the message is processed
+    assert(decrypted);
+    this->decryptionTicks += SDL_GetPerformanceCounter() - started;
+    this->framesReceived++;
+
+    byte* packed = frame + CRYPTO_IN_PLACE_OFFSET;
+    const unsigned packedSize = size - cryptoEncryptedSize(0);
+
+    if (compact)
+        unpackMessageCompact(packed, packedSize, message);
+    else {
+        unpackMessage(packed, message);
+        assert(wholeMessageBytesSize(message->size) <= packedSize);
     }
+    if (compact && message->from == FROM_SERVER) SDL_memcpy(message->token, this->serverToken, TOKEN_SIZE); // the server sends compact headers only after the negotiation, in which its token has been verified
 
-    if (!accept) {
-        finishSettingUpConversation();
-        netSend(FLAG_EXCHANGE_KEYS, (byte[INVITE_DENY]) {0}, INVITE_DENY, fromId);
-        return NULL;
+    FlagCounters* counters = flagCounters(this, message->flag);
+    counters->framesReceived++;
+    counters->bytesReceived += INT_SIZE + size;
+    return true;
+}
+
+static bool receive(This* this, Message* message) { // takes the next frame that has already been read
+    RW_MUTEX_WRITE_LOCKED(this->receiveMutex,
+        const bool received = receiveBuffered(this, message);
+    )
+    return received;
+}
+
+static bool receiveMore(This* this) { // returns false if disconnected
+    RW_MUTEX_WRITE_LOCKED(this->receiveMutex,
+        const bool received = fillReceiveBuffer(this);
+    )
+    return received;
+}
+
+static bool readReceivedMessage(This* this) { // returns false if disconnected
+    if (!hasBufferedFrame(this) && !receiveMore(this)) { // a single read, a large frame is completed by the next ones, so the deadlines get checked in between, even if the server dies in the middle of the frame
+        onDisconnected(this);
+        return false;
     }
 
-    CryptoKeys* keys = cryptoKeysInit();
-    const byte* akaServerPublicKey = cryptoGenerateKeyPairAsServer(keys);
+    Message message;
+    if (receive(this, &message)) processMessage(this, &message); // each message is processed before the next one is read, so a single one on the stack is enough
+    return true;
+}
+
+static void listenLooper(This* this) {
+    while (this->listening) {
+        if (!checkDeadlines(this)) { // the server has stopped answering pings, the OS would notice that far later
+            onDisconnected(this);
+            break;
+        }
 
-    if (!netSend(FLAG_EXCHANGE_KEYS, akaServerPublicKey, CRYPTO_KEY_SIZE, fromId)) {
-        finishSettingUpConversation();
-        cryptoKeysDestroy(keys);
-        return NULL;
+        if (this->sendFailed) { // the link is broken, though reading may keep blocking till the OS gives up on it
+            onDisconnected(this);
+            break;
+        }
+
+        if (!hasBufferedFrame(this) && !checkSocket(this, listenTimeout(this))) continue; // blocks until more bytes arrive, so a frame gets processed as soon as it's complete; frames that have already been read are processed without touching the socket
+        if (!readReceivedMessage(this)) break; // the connection may have already been cleaned up right from the onDisconnected callback, so 'this' mustn't be touched anymore
     }
+}
 
-    Message* message = NULL;
-    if (!(message = queueWaitAndPop(this->conversationSetupMessages, (int) TIMEOUT))
-        || message->flag != FLAG_EXCHANGE_KEYS_DONE
-        || message->size != CRYPTO_KEY_SIZE
-        || !message->body)
-    {
-        finishSettingUpConversation();
-        cryptoKeysDestroy(keys);
-        destroyMessage(message);
-        return NULL;
+static bool negotiate(This* this, unsigned timeout) { // returns false if disconnected
+    const unsigned proposedFeatures = NEGOTIATION_FEATURE_COMPACT_HEADER | NEGOTIATION_FEATURE_BATCHED_FETCH | NEGOTIATION_FEATURE_HEARTBEAT | (this->onPresenceChanged ? NEGOTIATION_FEATURE_PRESENCE : 0);
+
+    byte body[INT_SIZE * 2];
+    *(unsigned*) body = MAX_NEGOTIABLE_MESSAGE_SIZE;
+    *(unsigned*) (body + INT_SIZE) = proposedFeatures;
+    if (!netSend(this, FLAG_NEGOTIATE, body, sizeof body, TO_SERVER)) return false;
+
+    const unsigned long deadline = (*(this->currentTimeMillisGetter))() + timeout;
+    Message reply;
+
+    while (!receive(this, &reply)) { // the reply may arrive in several reads
+        if (!waitForReceive(this, deadline)) return this->listening; // an older server which ignores unknown messages
+        if (!receiveMore(this)) return false;
     }
+    const Message* message = &reply;
+
+    if (message->from == FROM_SERVER
+        && message->flag == FLAG_NEGOTIATE
+        && (message->size == INT_SIZE || message->size == INT_SIZE * 2) // servers that don't know about features reply with the size only
+        && message->body
+        && checkServerToken(this, message->token)
+        && *(unsigned*) message->body >= MAX_MESSAGE_SIZE // a reply with a size out of the proposed range is treated as no extension at all, the defaults are kept
+        && *(unsigned*) message->body <= MAX_NEGOTIABLE_MESSAGE_SIZE)
+    {
+        this->maxMessageSize = *(unsigned*) message->body;
+
+        if (message->size == INT_SIZE * 2) this->features = *(unsigned*) (message->body + INT_SIZE) & proposedFeatures; // no more messages are sent yet, so the header format can be switched safely
+    } // otherwise it's an older server which replies with an error
+
+    return true;
+}
+
+unsigned netMaxMessageBodySize(This* this) {
+    assert(this);
+    return this->maxMessageSize - MESSAGE_HEAD_SIZE;
+}
+
+bool netPresencePushed(This* this) {
+    assert(this);
+    return this->features & NEGOTIATION_FEATURE_PRESENCE;
+}
+
+void netSetHeartbeatTimeout(This* this, unsigned timeout) {
+    assert(this && timeout >= LISTEN_POLL_TIMEOUT * HEARTBEAT_PINGS_PER_TIMEOUT);
+    this->heartbeatTimeout = timeout;
+}
+
+void netLinkStats(This* this, NetLinkStats* stats) {
+    assert(this && stats);
+    const unsigned long now = (*(this->currentTimeMillisGetter))();
+
+    stats->smoothedRtt = this->smoothedRtt / RTT_SCALE;
+    stats->rttVariation = this->rttVariation / RTT_SCALE;
+    stats->rttSamples = this->rttSamples;
+    stats->framesSent = this->framesSent;
+    stats->bytesSent = this->bytesSent;
+    stats->framesReceived = this->framesReceived;
+    stats->bytesReceived = this->bytesReceived;
+    stats->connectedMillis = this->connectedMillis && now > this->connectedMillis ? now - this->connectedMillis : 0;
+}
+
+static unsigned long ticksToMicros(unsigned long ticks) {
+    const unsigned long frequency = SDL_GetPerformanceFrequency(), micros = 1000000;
+    return ticks / frequency * micros + ticks % frequency * micros / frequency; // doesn't overflow for days
+}
 
-    byte akaClientPublicKey[CRYPTO_KEY_SIZE];
-    SDL_memcpy(akaClientPublicKey, message->body, CRYPTO_KEY_SIZE);
-    destroyMessage(message);
-    if (!cryptoExchangeKeysAsServer(keys, akaClientPublicKey)) {
-        finishSettingUpConversation();
-        cryptoKeysDestroy(keys);
-        return NULL;
+void netStats(This* this, NetStats* stats) {
+    assert(this && stats);
+
+    for (unsigned i = 0; i < STATS_FLAGS_COUNT; i++) {
+        const FlagCounters* counters = &(this->flagCounters[i]);
+        stats->flags[i].flag = i < STATS_FLAGS_COUNT - 1 ? STATS_FLAGS[i] : -1;
+        stats->flags[i].framesSent = counters->framesSent;
+        stats->flags[i].bytesSent = counters->bytesSent;
+        stats->flags[i].framesReceived = counters->framesReceived;
+        stats->flags[i].bytesReceived = counters->bytesReceived;
     }
 
-    CryptoCoderStreams* coderStreams = cryptoCoderStreamsInit();
-    byte* akaServerStreamHeader = cryptoCreateEncoderAsServer(keys, coderStreams);
+    stats->encryptionMicros = ticksToMicros(this->encryptionTicks);
+    stats->decryptionMicros = ticksToMicros(this->decryptionTicks);
+    stats->droppedWhileFetchingUsers = this->droppedWhileFetchingUsers;
+    stats->droppedWhileFetchingMessages = this->droppedWhileFetchingMessages;
+    stats->droppedWhileIgnoring = this->droppedWhileIgnoring;
+
+    SDL_LockMutex(this->sendMutex); // the gauges are read under the locks as they're taken rarely, unlike the counters
+    stats->outboxBytes = this->outboxSize;
+    SDL_UnlockMutex(this->sendMutex);
+
+    stats->conversationSetups = 0;
+    SDL_LockMutex(this->conversationSetupsMutex);
+    for (unsigned i = 0; i < MAX_CONVERSATION_SETUPS; stats->conversationSetups += this->conversationSetups[i++].active);
+    SDL_UnlockMutex(this->conversationSetupsMutex);
+
+    stats->fileTransfers = 0;
+    SDL_LockMutex(this->fileTransfersMutex);
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS; stats->fileTransfers += this->fileTransfers[i++].active);
+    SDL_UnlockMutex(this->fileTransfersMutex);
+}
+
+unsigned netCurrentUserId(This* this) {
+    assert(this);
+    return this->userId;
+}
+
+static bool pumpFileChunks(This* this);
+static void finishSentFileTransfers(This* this, unsigned long sentMessages, bool sendFailed);
+
+static void stopWriting(This* this) { // the writing thread exits then, messages that are still in the outbox get dropped, those who wait for them are notified
+    SDL_LockMutex(this->sendMutex);
+    this->writing = false;
+    this->sendFailed = true;
+    SDL_CondBroadcast(this->sendCondition);
+    SDL_UnlockMutex(this->sendMutex);
+}
+
+static int writeLooper(void* xThis) {
+    This* this = xThis;
+    currentConnection = this;
+    SDL_LockMutex(this->sendMutex);
+
+    while (this->writing) {
+        if (!this->outboxSize && this->fileChunksPumpRequested) {
+            this->fileChunksPumpRequested = false;
+
+            SDL_UnlockMutex(this->sendMutex);
+            const bool morePending = pumpFileChunks(this); // chunks are put into the outbox only while it's empty, so other messages don't wait behind them for long
+            SDL_LockMutex(this->sendMutex);
+
+            this->fileChunksPumpRequested = this->fileChunksPumpRequested || morePending;
+            continue;
+        }
 
-    if (!akaServerStreamHeader) {
-        finishSettingUpConversation();
-        cryptoKeysDestroy(keys);
-        cryptoCoderStreamsDestroy(coderStreams);
-        return NULL;
+        if (!this->outboxSize) {
+            SDL_CondWait(this->sendCondition, this->sendMutex);
+            continue;
+        }
+
+        byte* messages = this->outbox;
+        this->outbox = this->writeBuffer;
+        this->writeBuffer = messages;
+
+        const unsigned size = this->outboxSize;
+        const unsigned long lastMessage = this->enqueuedMessages;
+        this->outboxSize = 0;
+        SDL_CondBroadcast(this->sendCondition); // there's free space in the outbox now
+
+        SDL_UnlockMutex(this->sendMutex);
+        const bool sent = (*(this->transport->send))(this->connection, messages, size); // all the messages that have been accumulated while the previous ones were being sent, are sent at once
+        SDL_LockMutex(this->sendMutex);
+
+        if (sent) {
+            this->framesSent += lastMessage - this->sentMessages;
+            this->bytesSent += size;
+            this->sentMessages = lastMessage;
+        } else
+            this->sendFailed = true;
+        SDL_CondBroadcast(this->sendCondition);
+
+        SDL_UnlockMutex(this->sendMutex);
+        finishSentFileTransfers(this, lastMessage, !sent);
+        SDL_LockMutex(this->sendMutex);
     }
 
-    const unsigned encryptedHeaderSize = cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE);
+    SDL_UnlockMutex(this->sendMutex);
+    return 0;
+}
 
-    byte* akaEncryptedServerStreamHeader = cryptoEncryptSingle(cryptoServerKey(keys), akaServerStreamHeader, CRYPTO_HEADER_SIZE);
-    assert(akaEncryptedServerStreamHeader);
-    SDL_free(akaServerStreamHeader);
+static unsigned long putIntoOutbox(This* this, int flag, const byte* nullable body, unsigned size, unsigned xTo) { // packs & encrypts the message right into the outbox, returns the message's sequence number or 0 if sending has failed; called with the send mutex locked & with enough free space in the outbox
+    assert(body && size && size <= netMaxMessageBodySize(this) || !body && !size && flag != FLAG_PROCEED && flag != FLAG_BROADCAST);
+    if (this->sendFailed) return 0;
 
-    const bool result = netSend(FLAG_EXCHANGE_HEADERS, akaEncryptedServerStreamHeader, encryptedHeaderSize, fromId);
-    SDL_free(akaEncryptedServerStreamHeader);
+    Message message = {
+        flag,
+        (*(this->currentTimeMillisGetter))(),
+        size,
+        0,
+        1,
+        this->userId,
+        xTo,
+        {0},
+        size ? (byte*) body : NULL
+    };
+
+    const bool compact = this->features & NEGOTIATION_FEATURE_COMPACT_HEADER;
+    byte* buffer = this->outbox + this->outboxSize;
+    unsigned packedSize;
 
-    if (!result) {
-        finishSettingUpConversation();
-        cryptoKeysDestroy(keys);
-        cryptoCoderStreamsDestroy(coderStreams);
-        return NULL;
+    if (compact)
+        packedSize = packMessageCompactInto(buffer + INT_SIZE + CRYPTO_IN_PLACE_OFFSET, &message);
+    else {
+        SDL_memcpy(&(message.token), this->token, TOKEN_SIZE);
+        packMessageInto(buffer + INT_SIZE + CRYPTO_IN_PLACE_OFFSET, &message);
+        packedSize = wholeMessageBytesSize(size);
     }
 
-    if (!(message = queueWaitAndPop(this->conversationSetupMessages, (int) TIMEOUT))
-        || message->flag != FLAG_EXCHANGE_HEADERS_DONE
-        || message->size != encryptedHeaderSize
-        || !message->body)
-    {
-        finishSettingUpConversation();
-        destroyMessage(message);
-        cryptoKeysDestroy(keys);
-        cryptoCoderStreamsDestroy(coderStreams);
-        return NULL;
+    const unsigned encryptedSize = cryptoEncryptedSize(packedSize);
+    *((unsigned*) buffer) = compact ? encryptedSize | COMPACT_FRAME_BIT : encryptedSize;
+
+    const unsigned long started = SDL_GetPerformanceCounter();
+    const bool encrypted = cryptoEncryptInPlace(this->connectionCoderStreams, buffer + INT_SIZE, packedSize, false);
+    assert(encrypted);
+    this->encryptionTicks += SDL_GetPerformanceCounter() - started;
+
+    FlagCounters* counters = flagCounters(this, flag);
+    counters->framesSent++;
+    counters->bytesSent += INT_SIZE + encryptedSize;
+
+    this->outboxSize += INT_SIZE + encryptedSize;
+    SDL_CondBroadcast(this->sendCondition);
+    return ++(this->enqueuedMessages);
+}
+
+static inline unsigned maxOutboxedSize(unsigned size) { // the compact header is never larger than the usual one
+    const unsigned maxEncryptedSize = cryptoEncryptedSize(wholeMessageBytesSize(size));
+    assert(INT_SIZE + maxEncryptedSize <= OUTBOX_SIZE);
+    return INT_SIZE + maxEncryptedSize;
+}
+
+static unsigned long enqueue(This* this, int flag, const byte* nullable body, unsigned size, unsigned xTo) { // returns the message's sequence number on success and 0 otherwise; blocks the caller thread only while the outbox is full
+    const unsigned maxSize = maxOutboxedSize(size);
+
+    SDL_LockMutex(this->sendMutex); // messages must be encrypted in the same order they are sent
+    while (!this->sendFailed && this->outboxSize + maxSize > OUTBOX_SIZE)
+        SDL_CondWait(this->sendCondition, this->sendMutex);
+
+    const unsigned long sequence = putIntoOutbox(this, flag, body, size, xTo);
+
+    SDL_UnlockMutex(this->sendMutex);
+    return sequence;
+}
+
+static bool tryEnqueue(This* this, int flag, const byte* body, unsigned size, unsigned xTo, unsigned long* sequence) { // doesn't block, returns false if there's no room in the outbox; otherwise the sequence is set as in enqueue
+    const unsigned maxSize = maxOutboxedSize(size);
+    SDL_LockMutex(this->sendMutex);
+
+    const bool fits = this->sendFailed || this->outboxSize + maxSize <= OUTBOX_SIZE;
+    if (fits) *sequence = putIntoOutbox(this, flag, body, size, xTo);
+
+    SDL_UnlockMutex(this->sendMutex);
+    return fits;
+}
+
+static void requestFileChunksPump(This* this) {
+    SDL_LockMutex(this->sendMutex);
+    this->fileChunksPumpRequested = true;
+    SDL_CondBroadcast(this->sendCondition); // wakes the writing thread up
+    SDL_UnlockMutex(this->sendMutex);
+}
+
+static void finishSentFileTransfer(This* this, unsigned id, bool successful) { // called by the writing thread with the transfers mutex unlocked
+    SDL_LockMutex(this->fileTransfersMutex);
+    FileTransfer* transfer = findFileTransferById(this, id);
+    if (transfer) releaseFileTransfer(this, transfer);
+    SDL_UnlockMutex(this->fileTransfersMutex);
+
+    if (transfer) (*(this->onFileExchangeFinished))(id, successful); // otherwise it has expired already
+}
+
+static inline bool fileTransferPumpable(const FileTransfer* transfer) { // the one with everything sent is pumped once more to end it
+    return transfer->active
+        && transfer->step == TRANSFER_STEP_SENDING
+        && (!transfer->window || transfer->nextIndex < transfer->ackedChunks + transfer->window || transfer->supplied);
+}
+
+static bool pumpFileChunks(This* this) { // the transfers being sent take turns putting their chunks into the outbox until it's full or until their windows are exhausted; returns true if there are chunks left
+    byte* buffer = this->fileChunkBuffer;
+
+    while (this->writing) {
+        SDL_LockMutex(this->fileTransfersMutex);
+
+        FileTransfer* transfer = NULL;
+        unsigned slot = 0;
+
+        if (this->pendingFileChunkSize) { // the chunk that didn't fit last time goes first
+            transfer = findFileTransferById(this, this->pendingFileChunkTransfer);
+            if (transfer && transfer->step == TRANSFER_STEP_SENDING)
+                slot = (unsigned) (transfer - this->fileTransfers);
+            else {
+                transfer = NULL; // has expired
+                this->pendingFileChunkSize = 0;
+            }
+        }
+
+        for (unsigned i = 0; i < MAX_FILE_TRANSFERS && !transfer; i++) {
+            slot = (this->nextPumpedTransfer + i) % MAX_FILE_TRANSFERS;
+            if (fileTransferPumpable(&(this->fileTransfers[slot])))
+                transfer = &(this->fileTransfers[slot]);
+        }
+
+        if (!transfer) {
+            SDL_UnlockMutex(this->fileTransfersMutex);
+            return false; // acknowledgements request another pump
+        }
+
+        this->nextPumpedTransfer = (slot + 1) % MAX_FILE_TRANSFERS;
+        const FileTransfer current = *transfer; // only the writing thread moves transfers that are being sent forward, the listening thread may release them though
+        SDL_UnlockMutex(this->fileTransfersMutex);
+
+        const unsigned prefixSize = current.multiplexed ? INT_SIZE : 0;
+        unsigned size = this->pendingFileChunkSize, bytesRead = this->pendingFileChunkBytes;
+
+        if (!size && current.supplied) { // only the transfers with a window get here
+            *(unsigned*) buffer = current.streamId;
+            size = INT_SIZE;
+            bytesRead = 0;
+        } else if (!size) {
+            bytesRead = (*(this->nextFileChunkSupplier))(current.id, current.nextIndex, buffer + prefixSize, current.chunkSize - prefixSize, current.compressed);
+            assert(bytesRead <= current.chunkSize - prefixSize);
+
+            if (!bytesRead) {
+                bool sent = false;
+
+                SDL_LockMutex(this->fileTransfersMutex);
+                if ((transfer = findFileTransferById(this, current.id))) {
+                    transfer->supplied = true;
+                    sent = !transfer->window && transfer->lastSequence <= this->sentMessages; // only this thread updates the counter
+                    if (!transfer->window && !sent) transfer->step = TRANSFER_STEP_FLUSHING; // waits for the chunks to be sent, the others end the transfer explicitly on the next turn
+                }
+                SDL_UnlockMutex(this->fileTransfersMutex);
+
+                if (sent) finishSentFileTransfer(this, current.id, true);
+                continue;
+            }
+
+            if (prefixSize) *(unsigned*) buffer = current.streamId;
+            size = prefixSize + bytesRead;
+        }
+
+        unsigned long sequence = 0;
+        if (!tryEnqueue(this, FLAG_FILE, buffer, size, current.peerId, &sequence)) {
+            this->pendingFileChunkSize = size;
+            this->pendingFileChunkBytes = bytesRead;
+            this->pendingFileChunkTransfer = current.id;
+            return true;
+        }
+        this->pendingFileChunkSize = 0;
+
+        if (!sequence) { // the rest of transfers get finished once the writing thread notices the failure
+            finishSentFileTransfer(this, current.id, false);
+            return false;
+        }
+
+        SDL_LockMutex(this->fileTransfersMutex);
+        if ((transfer = findFileTransferById(this, current.id))) {
+            if (bytesRead) transfer->nextIndex++;
+
+            transfer->lastSequence = sequence;
+            prolongFileTransfer(this, transfer);
+
+            if (!bytesRead) transfer->step = TRANSFER_STEP_FLUSHING; // the end has been put into the outbox, waits for the last acknowledgement
+        }
+        SDL_UnlockMutex(this->fileTransfersMutex);
     }
+    return false;
+}
 
-    byte akaEncryptedClientStreamHeader[encryptedHeaderSize];
-    SDL_memcpy(akaEncryptedClientStreamHeader, message->body, encryptedHeaderSize);
-    destroyMessage(message);
+static void finishSentFileTransfers(This* this, unsigned long sentMessages, bool sendFailed) { // called by the writing thread after each send
+    unsigned finished[MAX_FILE_TRANSFERS], finishedCount = 0;
+    SDL_LockMutex(this->fileTransfersMutex);
 
-    finishSettingUpConversation();
+    for (unsigned i = 0; i < MAX_FILE_TRANSFERS; i++) {
+        FileTransfer* transfer = &(this->fileTransfers[i]);
+        if (!transfer->active || (transfer->step != TRANSFER_STEP_SENDING && transfer->step != TRANSFER_STEP_FLUSHING)) continue;
+        if (!sendFailed && (transfer->step != TRANSFER_STEP_FLUSHING || transfer->window || transfer->lastSequence > sentMessages)) continue; // those with a window finish on the last acknowledgement
 
-    byte* akaClientStreamHeader = cryptoDecryptSingle(cryptoClientKey(keys), akaEncryptedClientStreamHeader, encryptedHeaderSize);
-    if (!akaClientStreamHeader) {
-        cryptoKeysDestroy(keys);
-        cryptoCoderStreamsDestroy(coderStreams);
-        return NULL;
+        finished[finishedCount++] = transfer->id;
+        releaseFileTransfer(this, transfer);
     }
 
-    const bool decoderCreated = cryptoCreateDecoderStreamAsServer(keys, coderStreams, akaClientStreamHeader);
-    cryptoKeysDestroy(keys);
-    SDL_free(akaClientStreamHeader);
+    if (sendFailed) this->pendingFileChunkSize = 0;
+    SDL_UnlockMutex(this->fileTransfersMutex);
+
+    for (unsigned i = 0; i < finishedCount; i++)
+        (*(this->onFileExchangeFinished))(finished[i], !sendFailed);
+}
+
+static bool waitUntilSent(This* this, unsigned long sequence) { // returns true if the message with the given sequence number (and so every message before it) has been sent
+    if (!sequence) return false;
+    SDL_LockMutex(this->sendMutex);
+
+    while (this->sentMessages < sequence && !this->sendFailed)
+        SDL_CondWait(this->sendCondition, this->sendMutex);
+    const bool sent = this->sentMessages >= sequence;
+
+    SDL_UnlockMutex(this->sendMutex);
+    return sent;
+}
+
+bool netSend(This* this, int flag, const byte* nullable body, unsigned size, unsigned xTo) {
+    assert(this);
+    return waitUntilSent(this, enqueue(this, flag, body, size, xTo));
+}
+
+void netShutdownServer(This* this) {
+    assert(this);
+    netSend(this, FLAG_SHUTDOWN, NULL, 0, TO_SERVER);
+}
+
+static NetUserInfo* unpackUserInfo(const byte* bytes) {
+    NetUserInfo* info = SDL_malloc(sizeof *info);
+
+    SDL_memcpy(&(info->id), bytes, INT_SIZE);
+    SDL_memcpy(&(info->connected), bytes + INT_SIZE, 1);
+    SDL_memcpy(&(info->name), bytes + INT_SIZE + 1, NET_USERNAME_SIZE);
+
+    return info;
+}
+
+void netFetchUsers(This* this) {
+    assert(this && !this->fetchingUsers && !this->fetchingMessages);
+    this->fetchingUsers = true;
+    netSend(this, FLAG_FETCH_USERS, NULL, 0, TO_SERVER);
+}
+
+void netSendBroadcast(This* this, const byte* text, unsigned size) {
+    assert(this && size);
+    netSend(this, FLAG_BROADCAST, text, size, TO_SERVER);
+}
+
+unsigned netUserInfoId(const NetUserInfo* info) {
+    assert(info);
+    return info->id;
+}
+
+bool netUserInfoConnected(const NetUserInfo* info) {
+    assert(info);
+    return info->connected;
+}
+
+const byte* netUserInfoName(const NetUserInfo* info) {
+    assert(info);
+    return info->name;
+}
+
+NetUserInfo* netUserInfoCopy(const NetUserInfo* info) {
+    assert(info);
+    NetUserInfo* new = SDL_malloc(sizeof *new);
+
+    new->id = info->id;
+    new->connected = info->connected;
+    SDL_memcpy(new->name, info->name, NET_USERNAME_SIZE);
+
+    return new;
+}
+
+void netUserInfoDestroy(NetUserInfo* info) { SDL_free(info); }
+
+void netSetIgnoreUsualMessages(This* this, bool ignore) {
+    assert(this);
+    this->ignoreUsualMessages = ignore;
+}
+
+void netFetchMessages(This* this, unsigned id, unsigned long afterTimestamp) {
+    assert(this && !this->fetchingUsers);
+    this->fetchingMessages++; // several fetches may overlap
+
+    byte body[1 + LONG_SIZE + INT_SIZE] = {0};
+
+    body[0] = this->features & NEGOTIATION_FEATURE_BATCHED_FETCH ? FETCH_MODE_BATCHED : FETCH_MODE_SINGLE;
+    *((unsigned long*) &(body[1])) = afterTimestamp;
+    *((unsigned*) &(body[1 + LONG_SIZE])) = id;
+
+    netSend(this, FLAG_FETCH_MESSAGES, body, sizeof body, TO_SERVER);
+}
+
+static void onNextMessageFetched(This* this, const Message* message) {
+    assert(this && this->fetchingMessages);
+    assert(message->body && message->size);
+    const bool last = message->index == message->count - 1;
+
+    (*(this->onNextMessageFetched))(message->from, message->timestamp, message->size, message->body, last);
+    if (last) this->fetchingMessages--;
+}
+
+static void onMessagesBatchFetched(This* this, const Message* message) {
+    assert(this && this->fetchingMessages);
+    assert(message->size >= 1 + INT_SIZE * 2);
 
-    if (!decoderCreated) {
-        cryptoCoderStreamsDestroy(coderStreams);
-        return NULL;
+    const unsigned conversation = *(unsigned*) (message->body + 1), count = *(unsigned*) (message->body + 1 + INT_SIZE);
+    const bool last = message->index == message->count - 1;
+    assert(count <= (message->size - 1 - INT_SIZE * 2) / FETCHED_RECORD_HEAD_SIZE); // each record takes at least its head, checked before the count sizes the array on the stack
+
+    NetFetchedMessage records[count ? count : 1]; // point right into the frame, so nothing gets copied
+    unsigned offset = 1 + INT_SIZE * 2;
+
+    for (unsigned i = 0; i < count; i++) {
+        assert(offset + FETCHED_RECORD_HEAD_SIZE <= message->size);
+
+        records[i].timestamp = *(unsigned long*) (message->body + offset);
+        records[i].from = *(unsigned*) (message->body + offset + LONG_SIZE);
+        records[i].size = *(unsigned*) (message->body + offset + LONG_SIZE + INT_SIZE);
+        records[i].message = message->body + offset + FETCHED_RECORD_HEAD_SIZE;
+
+        offset += FETCHED_RECORD_HEAD_SIZE + records[i].size;
+        assert(records[i].size && offset <= message->size);
     }
+    assert(offset == message->size);
 
-    return coderStreams;
+    (*(this->onMessagesBatchFetched))(conversation, records, count, last);
+    if (last) this->fetchingMessages--;
 }
 
-static void finishFileExchanging(void) {
-    queueClear(this->fileExchangeMessages);
-    this->exchangingFile = false;
+static void onEmptyMessagesFetchReplyReceived(This* this, const Message* message) {
+    assert(this && this->fetchingMessages);
+    assert(message->body && message->size);
+    assert(message->count == 1);
+
+    (*(this->onNextMessageFetched))(*(unsigned*) (message->body + 1 + LONG_SIZE), message->timestamp, 0, NULL, true);
+    this->fetchingMessages--;
 }
 
-bool netBeginFileExchange(unsigned toId, unsigned fileSize, const byte* hash, const char* filename, unsigned filenameSize) {
+static void onNextUsersBundleFetched(This* this, const Message* message) {
+    assert(this && this->fetchingUsers);
+    assert(message->body && message->size && message->size <= netMaxMessageBodySize(this));
+    if (!(message->index)) listClear(this->userInfosList); // TODO: test with large amount of elements & test with sleep()
+
+    for (unsigned i = 0; i < message->size; i += USER_INFO_SIZE)
+        listAddBack(this->userInfosList, unpackUserInfo(message->body + i));
+
+    if (message->index < message->count - 1) return; // not the last bundle
+
+    (*(this->onUsersFetched))(this->userInfosList);
+    listClear(this->userInfosList);
+    this->fetchingUsers = false;
+}
+
+bool netCreateConversation(This* this, unsigned id) { // TODO: start receiving messages from users only after all users were fetched and assert that the sender's id is found locally
     assert(this);
-    assert(fileSize);
-    assert(filenameSize <= NET_MAX_FILENAME_SIZE);
+    SDL_LockMutex(this->conversationSetupsMutex);
 
-    assert(!this->settingUpConversation && !this->exchangingFile);
-    this->exchangingFile = true;
-    queueClear(this->fileExchangeMessages);
+    ConversationSetup* setup = beginConversationSetup(this, id, SETUP_STEP_INVITE_SENT);
+    const bool begun = setup && sendWithoutWaiting(this, FLAG_EXCHANGE_KEYS, (byte[INVITE_ASK]) {0}, INVITE_ASK, id);
+    if (setup && !begun) releaseConversationSetup(this, setup);
 
-    byte body[fileExchangeRequestInitialSize()];
-    SDL_memset(body, 0, NET_MAX_MESSAGE_BODY_SIZE);
+    SDL_UnlockMutex(this->conversationSetupsMutex);
+    return begun;
+}
 
-    *((unsigned*) body) = fileSize;
-    SDL_memcpy(body + INT_SIZE, hash, CRYPTO_HASH_SIZE);
-    *(unsigned*) (body + INT_SIZE + CRYPTO_HASH_SIZE) = filenameSize;
-    SDL_memcpy(body + INT_SIZE + CRYPTO_HASH_SIZE + INT_SIZE, filename, filenameSize);
+bool netReplyToConversationSetUpInvite(This* this, bool accept, unsigned fromId) { // TODO: create a dashboard page with some analysis for admin
+    assert(this);
+    SDL_LockMutex(this->conversationSetupsMutex);
 
-    if (!netSend(FLAG_FILE_ASK, body, fileExchangeRequestInitialSize(), toId)) {
-        finishFileExchanging();
+    ConversationSetup* setup = findConversationSetup(this, fromId);
+    if (!setup || setup->step != SETUP_STEP_INVITE_RECEIVED) { // has expired while the invite was being considered
+        SDL_UnlockMutex(this->conversationSetupsMutex);
         return false;
     }
 
-    Message* message = NULL;
-    if (!(message = queueWaitAndPop(this->fileExchangeMessages, (int) TIMEOUT))
-        || message->flag != FLAG_FILE_ASK
-        || message->size != INT_SIZE
-        || !message->body
-        || *((unsigned*) message->body) != fileSize)
-    {
-        finishFileExchanging();
-        destroyMessage(message);
+    if (!accept) {
+        sendWithoutWaiting(this, FLAG_EXCHANGE_KEYS, (byte[INVITE_DENY]) {0}, INVITE_DENY, fromId);
+        releaseConversationSetup(this, setup);
+        SDL_UnlockMutex(this->conversationSetupsMutex);
         return false;
     }
-    destroyMessage(message);
 
-    unsigned index = 0, bytesWritten;
-    while ((bytesWritten = (*(this->nextFileChunkSupplier))(index++, body))) {
-        assert(bytesWritten <= NET_MAX_MESSAGE_BODY_SIZE);
+    setup->keys = cryptoKeysInit();
+    const byte* akaServerPublicKey = cryptoGenerateKeyPairAsServer(setup->keys);
 
-        if (!netSend(FLAG_FILE, body, bytesWritten, toId)) {
-            finishFileExchanging();
-            return false;
-        }
-    }
+    const bool sent = sendWithoutWaiting(this, FLAG_EXCHANGE_KEYS, akaServerPublicKey, CRYPTO_KEY_SIZE, fromId);
+    if (sent) {
+        setup->step = SETUP_STEP_KEY_SENT;
+        prolongConversationSetup(this, setup);
+    } else
+        releaseConversationSetup(this, setup);
 
-    finishFileExchanging();
-    return true;
+    SDL_UnlockMutex(this->conversationSetupsMutex);
+    return sent;
 }
 
-bool netReplyToFileExchangeInvite(unsigned fromId, unsigned fileSize, bool accept) {
+unsigned netNextFileTransferId(This* this) {
     assert(this);
-    assert(!this->settingUpConversation && this->exchangingFile);
-    queueClear(this->fileExchangeMessages);
+    return ++(this->lastFileTransferId);
+}
 
-    if (inviteProcessingTimeoutExceeded()) {
-        finishFileExchanging();
-        return false;
+bool netBeginFileExchange(This* this, unsigned transferId, unsigned toId, unsigned fileSize, const byte* hash, const char* filename, unsigned filenameSize, bool compress) {
+    assert(this);
+    assert(transferId && fileSize);
+    assert(filenameSize <= NET_MAX_FILENAME_SIZE);
+
+    SDL_LockMutex(this->fileTransfersMutex);
+    assert(!findFileTransferById(this, transferId));
+
+    FileTransfer* transfer = beginFileTransfer(this, transferId, toId, TRANSFER_STEP_AWAITING_REPLY, fileSize);
+    if (transfer) {
+        transfer->streamId = transferId;
+        transfer->extended = true;
+        transfer->window = FILE_EXCHANGE_WINDOW; // proposed, the receiver may agree to a smaller one or to none
+        transfer->compressed = compress; // proposed too
     }
 
-    if (!accept) fileSize = 0;
-    if (!netSend(FLAG_FILE_ASK, (byte*) &fileSize, INT_SIZE, fromId)) {
-        finishFileExchanging();
-        return false;
+    SDL_UnlockMutex(this->fileTransfersMutex);
+    if (!transfer) return false;
+
+    byte body[fileExchangeRequestInitialSize()];
+    SDL_memset(body, 0, sizeof body);
+
+    *((unsigned*) body) = fileSize;
+    SDL_memcpy(body + INT_SIZE, hash, CRYPTO_HASH_SIZE);
+    *(unsigned*) (body + INT_SIZE + CRYPTO_HASH_SIZE) = filenameSize;
+    SDL_memcpy(body + INT_SIZE + CRYPTO_HASH_SIZE + INT_SIZE, filename, filenameSize);
+
+    byte* extension = body + fileExchangeRequestInitialSize() - FILE_EXCHANGE_EXTENSION_SIZE; // older clients ignore it
+    *(unsigned*) extension = FILE_EXCHANGE_EXTENSION_MAGIC;
+    *(unsigned*) (extension + INT_SIZE) = netMaxMessageBodySize(this);
+    *(unsigned*) (extension + INT_SIZE * 2) = transferId;
+    *(unsigned*) (extension + INT_SIZE * 3) = FILE_EXCHANGE_WINDOW | (compress ? FILE_EXCHANGE_COMPRESSION_BIT : 0);
+
+    const bool sent = netSend(this, FLAG_FILE_ASK, body, fileExchangeRequestInitialSize(), toId); // the writing thread doesn't wait for the transfers mutex to send this, as the transfer isn't being sent yet
+    if (!sent) {
+        SDL_LockMutex(this->fileTransfersMutex);
+        releaseFileTransfer(this, transfer);
+        SDL_UnlockMutex(this->fileTransfersMutex);
     }
 
-    if (!accept) {
-        finishFileExchanging();
+    return sent;
+}
+
+bool netReplyToFileExchangeInvite(This* this, unsigned transferId, bool accept) {
+    assert(this);
+    SDL_LockMutex(this->fileTransfersMutex);
+
+    FileTransfer* transfer = findFileTransferById(this, transferId);
+    if (!transfer || transfer->step != TRANSFER_STEP_INVITE_RECEIVED) { // has expired while the invite was being considered
+        SDL_UnlockMutex(this->fileTransfersMutex);
         return false;
     }
 
-    Message* message = NULL; // TODO: add possibility for admin to disable/enable file exchanging and set the maximum/minimum fie size
-    unsigned index = 0;
-
-    unsigned long lastReceivedChunkMillis = (*(this->currentTimeMillisGetter))();
-    while ((message = queueWaitAndPop(this->fileExchangeMessages, (int) TIMEOUT))) { // TODO: add progress bar (not infinite, the real one with %)
-        if ((*(this->currentTimeMillisGetter))() - lastReceivedChunkMillis >= TIMEOUT)
-            break;
+    const unsigned fromId = transfer->peerId, reply[4] = {accept ? transfer->fileSize : 0, transfer->chunkSize, transfer->streamId, transfer->window | (transfer->compressed ? FILE_EXCHANGE_COMPRESSION_BIT : 0)};
+    const unsigned replySize = transfer->window ? INT_SIZE * 4 : transfer->multiplexed ? INT_SIZE * 3 : transfer->extended ? INT_SIZE * 2 : INT_SIZE;
 
-        if (message->flag == FLAG_FILE && message->size > 0 && message->body)
-            lastReceivedChunkMillis = (*(this->currentTimeMillisGetter))();
-        else {
-            destroyMessage(message);
-            message = NULL;
-            continue;
-        }
+    if (accept) { // chunks may arrive right after the reply is sent
+        transfer->step = TRANSFER_STEP_RECEIVING;
+        prolongFileTransfer(this, transfer);
+    } else
+        releaseFileTransfer(this, transfer);
 
-        assert(message->size <= NET_MAX_MESSAGE_BODY_SIZE);
-        (*(this->netNextFileChunkReceiver))(fromId, index++, message->size, message->body);
+    SDL_UnlockMutex(this->fileTransfersMutex);
 
-        destroyMessage(message);
-        message = NULL;
+    const bool sent = netSend(this, FLAG_FILE_ASK, (const byte*) reply, replySize, fromId);
+    if (accept && !sent) {
+        SDL_LockMutex(this->fileTransfersMutex);
+        releaseFileTransfer(this, transfer);
+        SDL_UnlockMutex(this->fileTransfersMutex);
     }
-    destroyMessage(message);
 
-    finishFileExchanging();
-    return true; // TODO: check index == __initial_message__->count here and returns check result + this will shorten the loading time
+    return accept && sent;
 }
 
-void netClean(void) {
+void netClean(This* this) {
     assert(this);
-    rwMutexWriteLock(this->rwMutex);
 
-    queueDestroy(this->conversationSetupMessages);
-    queueDestroy(this->fileExchangeMessages);
+    if (this->listenThread && SDL_ThreadID() == SDL_GetThreadID(this->listenThread)) // called from the listening thread itself (from the onDisconnected or the onConnected(false) callbacks), which exits right after this returns
+        SDL_DetachThread(this->listenThread);
+    else if (this->listenThread) {
+        this->listening = false;
+        SDL_WaitThread(this->listenThread, NULL); // lets the listening thread finish processing the current message
+    }
+
+    if (this->writeThread) {
+        stopWriting(this);
+        SDL_WaitThread(this->writeThread, NULL);
+    }
+
+    SDL_LockMutex(this->sendMutex);
+    rwMutexWriteLock(this->receiveMutex);
+
+    for (unsigned i = 0; i < MAX_CONVERSATION_SETUPS; i++)
+        if (this->conversationSetups[i].active) releaseConversationSetup(this, &(this->conversationSetups[i]));
+    timerWheelDestroy(this->timers);
+    SDL_DestroyMutex(this->conversationSetupsMutex);
+    SDL_DestroyMutex(this->fileTransfersMutex);
+    SDL_free(this->fileChunkBuffer);
 
     SDL_free(this->serverKeyStub);
     listDestroy(this->userInfosList);
 
     if (this->connectionCoderStreams) cryptoCoderStreamsDestroy(this->connectionCoderStreams);
-
-    SDLNet_FreeSocketSet(this->socketSet);
-    SDLNet_TCP_Close(this->socket);
-    SDLNet_Quit();
-
-    rwMutexWriteUnlock(this->rwMutex);
-    rwMutexDestroy(this->rwMutex);
+    if (this->connectionKeys) cryptoKeysDestroy(this->connectionKeys);
+    SDL_free(this->encryptedServerCoderHeader);
+
+    if (this->connection) (*(this->transport->close))(this->connection);
+
+    rwMutexWriteUnlock(this->receiveMutex);
+    SDL_UnlockMutex(this->sendMutex);
+    rwMutexDestroy(this->receiveMutex);
+    SDL_DestroyCond(this->sendCondition);
+    SDL_DestroyMutex(this->sendMutex);
+    SDL_free(this->outbox);
+    SDL_free(this->writeBuffer);
+    SDL_free(this->receiveBuffer);
     SDL_free(this->host);
+    *(this->slot) = NULL;
     SDL_free(this);
-    this = NULL;
 }
 
+NetConnection* nullable netCurrentConnection(void) { return currentConnection; }
+
 ///////////////////////
 
 #ifdef TESTING
 
-ExposedTestNet_Message* exposedTestNet_unpackMessage(const byte* buffer) {
-    Message* msg = unpackMessage(buffer);
-
+static ExposedTestNet_Message* toExposedMessage(const Message* msg) { // copies the body out of the unpacked buffer
     ExposedTestNet_Message* xMsg = SDL_malloc(sizeof *xMsg);
     xMsg->flag = msg->flag;
     xMsg->timestamp = msg->timestamp;
@@ -1133,13 +2196,18 @@ ExposedTestNet_Message* exposedTestNet_unpackMessage(const byte* buffer) {
     xMsg->from = msg->from;
     xMsg->to = msg->to;
     SDL_memcpy(xMsg->token, msg->token, sizeof msg->token);
-    xMsg->body = msg->body;
-
-    SDL_free(msg);
+    xMsg->body = msg->size ? SDL_malloc(msg->size) : NULL;
+    if (msg->size) SDL_memcpy(xMsg->body, msg->body, msg->size);
     return xMsg;
 }
 
-byte* exposedTestNet_packMessage(const ExposedTestNet_Message* msg) {
+ExposedTestNet_Message* exposedTestNet_unpackMessage(const byte* buffer) {
+    Message msg;
+    unpackMessage((byte*) buffer, &msg); // only read
+    return toExposedMessage(&msg);
+}
+
+static Message fromExposedMessage(const ExposedTestNet_Message* msg) {
     Message xMsg = {
         msg->flag,
         msg->timestamp,
@@ -1152,6 +2220,24 @@ byte* exposedTestNet_packMessage(const ExposedTestNet_Message* msg) {
         msg->body
     };
     SDL_memcpy(xMsg.token, msg->token, sizeof xMsg.token);
+    return xMsg;
+}
+
+byte* exposedTestNet_packMessageCompact(const ExposedTestNet_Message* msg, unsigned* size) {
+    const Message xMsg = fromExposedMessage(msg);
+    byte* buffer = SDL_malloc(compactMessageBytesSize(&xMsg));
+    *size = packMessageCompactInto(buffer, &xMsg);
+    return buffer;
+}
+
+ExposedTestNet_Message* exposedTestNet_unpackMessageCompact(const byte* buffer, unsigned size) {
+    Message msg;
+    unpackMessageCompact((byte*) buffer, size, &msg); // only read
+    return toExposedMessage(&msg);
+}
+
+byte* exposedTestNet_packMessage(const ExposedTestNet_Message* msg) {
+    const Message xMsg = fromExposedMessage(msg);
     return packMessage(&xMsg);
 }
 
@@ -20,9 +20,48 @@
 
 #include <stdbool.h>
 #include "crypto.h"
+#include "transport.h"
 #include "collections/list.h"
 #include "defs.h"
 
+typedef struct {
+    unsigned long timestamp;
+    unsigned from;
+    unsigned size;
+    const byte* message; // encrypted
+} NetFetchedMessage;
+
+typedef struct {
+    unsigned smoothedRtt; // in milliseconds, measured by pinging the server if it supports that, 0 until the first pong arrives
+    unsigned rttVariation; // in milliseconds
+    unsigned rttSamples; // pongs received
+    unsigned long framesSent; // since the connection was established, the handshake excluded
+    unsigned long bytesSent; // the framing & the encryption overhead included
+    unsigned long framesReceived;
+    unsigned long bytesReceived;
+    unsigned long connectedMillis; // how long the connection has been established, the counters divided by it give the throughput
+} NetLinkStats;
+
+typedef struct {
+    int flag; // -1 for the frames with the flags which aren't known to the client
+    unsigned long framesSent; // put into the outbox
+    unsigned long bytesSent; // the framing & the encryption overhead included
+    unsigned long framesReceived;
+    unsigned long bytesReceived;
+} NetFlagStats;
+
+typedef struct {
+    NetFlagStats flags[20]; // one per flag the protocol defines & one for the rest
+    unsigned long encryptionMicros; // spent encrypting & decrypting frames, either is done by its own thread
+    unsigned long decryptionMicros;
+    unsigned long droppedWhileFetchingUsers; // usual messages from other users which have been dropped, they're re-fetched later
+    unsigned long droppedWhileFetchingMessages;
+    unsigned long droppedWhileIgnoring; // see netSetIgnoreUsualMessages
+    unsigned outboxBytes; // waiting to be sent
+    unsigned conversationSetups; // in progress
+    unsigned fileTransfers; // in progress, both the sent & the received ones
+} NetStats;
+
 typedef void (*NetOnMessageReceived)(unsigned long/*timestamp*/, unsigned/*fromId*/, const byte*/*message*/, unsigned/*size*/);
 typedef void (*NetOnLogInResult)(bool); // true on success
 typedef void (*NetOnRegisterResult)(bool); // true on success
@@ -30,52 +69,73 @@ typedef void (*NetOnErrorReceived)(int); // receives message's flag
 typedef void (*NetOnDisconnected)(void);
 typedef unsigned long (*NetCurrentTimeMillisGetter)(void);
 typedef void (*NetOnConversationSetUpInviteReceived)(unsigned/*fromId*/); // must call replyToPendingConversationSetUpInvite() after this
-typedef void (*NetOnFileExchangeInviteReceived)(unsigned fromId, unsigned fileSize, const byte* hash, const char* filename, unsigned filenameSize); // must then call replyToFileExchangeInvite
-typedef unsigned (*NetNextFileChunkSupplier)(unsigned index, byte* buffer); // returns (0 < count <= MAX_MESSAGE_BODY_SIZE) of written bytes or 0 if no more chunks available (current chunk included), if this is first time this callback is called, the return of 0 is treated as occurrence of error and the operation gets aborted; copies the another chunk's bytes into the buffer; the buffer is deallocated automatically
-typedef void (*NetNextFileChunkReceiver)(unsigned fromId, unsigned index, unsigned receivedBytesCount, const byte* buffer);
+typedef void (*NetOnConversationSetUp)(unsigned peerId, CryptoCoderStreams* nullable coderStreams); // called when a setup, either begun by the current user or accepted by him, finishes; coderStreams (which are owned by the callback then) are associated with the newly created conversation, they're null if the setup has failed, has been denied or has timed out
+typedef void (*NetOnFileExchangeInviteReceived)(unsigned transferId, unsigned fromId, unsigned fileSize, const byte* hash, const char* filename, unsigned filenameSize, bool compressed); // must then call replyToFileExchangeInvite with the transferId; compressed - whether the chunks will come compressed if the invite is accepted, which is agreed to automatically
+typedef unsigned (*NetNextFileChunkSupplier)(unsigned transferId, unsigned index, byte* buffer, unsigned bufferSize, bool compressed); // called from the writing thread; returns (0 < count <= bufferSize) of written bytes, returning 0 ends the transfer, so the supplier must check itself whether the whole file has been supplied; copies the another chunk's bytes into the buffer; compressed - whether the receiver has agreed to get the chunks compressed; the buffer is owned by the module; bufferSize is negotiated with the receiver and doesn't exceed netMaxMessageBodySize()
+typedef void (*NetNextFileChunkReceiver)(unsigned transferId, unsigned index, unsigned receivedBytesCount, const byte* buffer);
+typedef void (*NetOnFileExchangeFinished)(unsigned transferId, bool successful); // called once per accepted outgoing transfer (or denied, then with false) & per accepted incoming one; outgoing ones finish once the receiver has acknowledged every chunk, incoming ones - once the sender has ended them, those with older clients finish after 15 seconds pass without chunks
 typedef void (*NetOnNextMessageFetched)(unsigned from, unsigned long timestamp, unsigned size, const byte* nullable message, bool last); // message is null (and last is true too) when there are no messages from the given user and from is equal to fromServer
+typedef void (*NetOnMessagesBatchFetched)(unsigned conversation, const NetFetchedMessage* messages, unsigned count, bool last); // used instead of onNextMessageFetched if the server supports batching, so the messages can be processed at once; the records point into the received frame & are valid until the callback returns; count may be 0 if there are no messages in the conversation
+typedef void (*NetOnPresenceChanged)(unsigned id, bool connected); // called for every user who has connected or disconnected, if the server pushes these (see netPresencePushed), id may belong to a user who isn't in the fetched users list yet (registered after it was fetched)
 typedef void (*NetOnUsersFetched)(List* userInfosList); // receives a list of UserInfo objects, which is deallocated automatically (and every item inside it) after the callback returns
 typedef void (*NetOnBroadcastMessageReceived)(const byte* text, unsigned size); // unencrypted text
+typedef void (*NetOnConnected)(bool successful); // on failure the connection still has to be cleaned up with netClean, either right from this callback or later from another thread
+typedef void (*NetOnConnectionProgress)(unsigned step, unsigned stepsCount); // step is in range [1, stepsCount], the last one means the connection is ready
 
 struct NetUserInfo_t;
 typedef struct NetUserInfo_t NetUserInfo;
 
+struct NetConnection_t;
+typedef struct NetConnection_t NetConnection; // a connection to the server with all its state, a process may hold any number of them
+
 extern const unsigned NET_USERNAME_SIZE;
 extern const unsigned NET_UNHASHED_PASSWORD_SIZE;
-extern const unsigned NET_MAX_MESSAGE_BODY_SIZE;
+extern const unsigned NET_MAX_MESSAGE_BODY_SIZE; // supported by every server and client, the actual size for the current connection is negotiated with the server
 
 extern const int NET_FLAG_PROCEED; // just send message to another user
 
 extern const unsigned NET_MAX_FILENAME_SIZE;
 
-bool netInit( // blocks the caller thread until secure connection is established
+bool netInit( // doesn't block the caller thread, starts a separate thread that connects to the server, establishes the secure connection and then listens for incoming messages, so all the callbacks below are called from that thread
+    NetConnection* atomic* connection, // must be null, the new connection is put there before the connecting begins & netClean resets it to null; must outlive the connection
     const char* host,
     unsigned port,
+    const Transport* nullable transport, // null for TRANSPORT_SDL
     const byte* serverSignPublicKey,
     unsigned serverSignPublicKeySize,
     NetOnMessageReceived onMessageReceived,
     NetOnLogInResult onLogInResult,
     NetOnErrorReceived onErrorReceived, // not called on login error & register error as there are separated callback for them
     NetOnRegisterResult onRegisterResult,
-    NetOnDisconnected onDisconnected, // cleanup is performed after this callback returns, so module needs to be reinitialized after this callback ends to continue working with this module
+    NetOnDisconnected onDisconnected, // the connection stays allocated until the caller cleans it up with netClean, either right from this callback or later from another thread, meanwhile sending through it just fails
     NetCurrentTimeMillisGetter currentTimeMillisGetter,
     NetOnUsersFetched onUsersFetched,
     NetOnConversationSetUpInviteReceived onConversationSetUpInviteReceived,
+    NetOnConversationSetUp onConversationSetUp,
     NetOnFileExchangeInviteReceived onFileExchangeInviteReceived,
     NetNextFileChunkSupplier nextFileChunkSupplier,
     NetNextFileChunkReceiver netNextFileChunkReceiver,
+    NetOnFileExchangeFinished onFileExchangeFinished,
     NetOnNextMessageFetched onNextMessageFetched,
-    NetOnBroadcastMessageReceived onBroadcastMessageReceived
-); // returns true on success
-
-void netLogIn(const char* username, const char* password); // in case of failure the server disconnects client
-void netRegister(const char* username, const char* password); // the server disconnects client regardless of the result, but it sends messages with the result
-void netListen(void);
-unsigned netCurrentUserId(void);
-bool netSend(int flag, const byte* body, unsigned size, unsigned xTo); // TODO: make separate function only for sending usual messages and expose it, this function make internal // blocks the caller thread, returns true on success; flag is for internal use only, outside the module flag must be FLAG_PROCEED // TODO: hide original function
-void netShutdownServer(void);
-void netFetchUsers(void);
-void netSendBroadcast(const byte* text, unsigned size);
+    NetOnMessagesBatchFetched onMessagesBatchFetched,
+    NetOnPresenceChanged nullable onPresenceChanged, // the presence isn't subscribed to if null
+    NetOnBroadcastMessageReceived onBroadcastMessageReceived,
+    NetOnConnected onConnected, // other functions of the module can be used only after this callback is called with true
+    NetOnConnectionProgress nullable onConnectionProgress
+); // returns true if the connecting has begun
+
+void netLogIn(NetConnection* connection, const char* username, const char* password); // in case of failure the server disconnects client
+void netRegister(NetConnection* connection, const char* username, const char* password); // the server disconnects client regardless of the result, but it sends messages with the result
+unsigned netMaxMessageBodySize(NetConnection* connection); // negotiated with the server, not less than MAX_MESSAGE_BODY_SIZE; messages sent to other users must not exceed MAX_MESSAGE_BODY_SIZE unless the other user agreed to receive larger ones, as their connections might not support them
+bool netPresencePushed(NetConnection* connection); // whether the server pushes users' connects & disconnects, in which case the fetched users list is kept up to date by patching it with onPresenceChanged and needs to be re-fetched only to resync
+void netSetHeartbeatTimeout(NetConnection* connection, unsigned timeout); // in milliseconds, not less than 400, 15 seconds by default; the server is pinged 4 times per timeout & the connection is considered dead (onDisconnected gets called) if nothing arrives within it, which is done only if the server echoes pings
+void netLinkStats(NetConnection* connection, NetLinkStats* stats); // a snapshot, can be taken from any thread
+void netStats(NetConnection* connection, NetStats* stats); // a snapshot, can be taken from any thread, the counters are updated without locks, the gauges (the outbox & the setups & the transfers) are read under theirs; tells apart server slowness (frames wait to be received) from client stalls (they pile up in the outbox or the crypto time grows)
+unsigned netCurrentUserId(NetConnection* connection);
+bool netSend(NetConnection* connection, int flag, const byte* body, unsigned size, unsigned xTo); // TODO: make separate function only for sending usual messages and expose it, this function make internal // blocks the caller thread, returns true on success; flag is for internal use only, outside the module flag must be FLAG_PROCEED // TODO: hide original function
+void netShutdownServer(NetConnection* connection);
+void netFetchUsers(NetConnection* connection);
+void netSendBroadcast(NetConnection* connection, const byte* text, unsigned size);
 
 unsigned netUserInfoId(const NetUserInfo* info);
 bool netUserInfoConnected(const NetUserInfo* info);
@@ -83,13 +143,15 @@ const byte* netUserInfoName(const NetUserInfo* info);
 NetUserInfo* netUserInfoCopy(const NetUserInfo* info);
 void netUserInfoDestroy(NetUserInfo* info);
 
-void netSetIgnoreUsualMessages(bool ignore); // to let the logic module avoid the problem caused by the 'ratchet' of the stream cipher encryption, missed messages can be then retrieved again
-void netFetchMessages(unsigned id, unsigned long afterTimestamp);
-CryptoCoderStreams* nullable netCreateConversation(unsigned id); // returns the Crypto object associated with newly created conversation on success, expects the id of the user, the current user wanna create conversation with; blocks the caller thread until either a denial received or creation of the conversation succeeds (if an acceptation received) or fails
-CryptoCoderStreams* nullable netReplyToConversationSetUpInvite(bool accept, unsigned fromId); // returns the same as createConversation does, must be called after getting invoked by the onConversationSetUpInviteReceived callback to reply to inviter, returns true on success; blocks the caller thread just like createConversation does
-bool netBeginFileExchange(unsigned toId, unsigned fileSize, const byte* hash, const char* filename, unsigned filenameSize); // blocks the caller thread; returns true if another user (identified by toId) accepted the invite
-bool netReplyToFileExchangeInvite(unsigned fromId, unsigned fileSize, bool accept); // blocks the caller thread; returns true on success; must be called only after an invite from this user received & processed
-void netClean(void);
+void netSetIgnoreUsualMessages(NetConnection* connection, bool ignore); // to let the logic module avoid the problem caused by the 'ratchet' of the stream cipher encryption, missed messages can be then retrieved again
+void netFetchMessages(NetConnection* connection, unsigned id, unsigned long afterTimestamp); // fetches for different conversations may be requested without waiting for the previous ones to finish, the replies to each are delivered with the conversation id (the sender's id in onNextMessageFetched)
+bool netCreateConversation(NetConnection* connection, unsigned id); // expects the id of the user, the current user wanna create conversation with; doesn't wait for the invite to be sent, returns true if the setup has begun, which then finishes in the onConversationSetUp callback; setups with different users proceed in parallel
+bool netReplyToConversationSetUpInvite(NetConnection* connection, bool accept, unsigned fromId); // must be called after getting invoked by the onConversationSetUpInviteReceived callback to reply to inviter; doesn't wait for the reply to be sent, returns true if the invite has been accepted and the setup goes on, which then finishes in the onConversationSetUp callback
+unsigned netNextFileTransferId(NetConnection* connection); // unique within the connection's lifetime, never 0
+bool netBeginFileExchange(NetConnection* connection, unsigned transferId, unsigned toId, unsigned fileSize, const byte* hash, const char* filename, unsigned filenameSize, bool compress); // compress - propose compressing the chunks, which the receiver may not support; doesn't block the caller thread, several files can be sent at once; returns true if the invite has been sent, the result comes through the onFileExchangeFinished callback
+bool netReplyToFileExchangeInvite(NetConnection* connection, unsigned transferId, bool accept); // doesn't block the caller thread; returns true if the invite has been accepted & the reply has been sent, the chunks then come through the nextFileChunkReceiver callback
+void netClean(NetConnection* connection);
+NetConnection* nullable netCurrentConnection(void); // the connection whose thread is calling the callback, null outside the callbacks called from the module's threads
 
 ///////////////////////
 
@@ -109,6 +171,8 @@ typedef struct {
 
 ExposedTestNet_Message* exposedTestNet_unpackMessage(const byte* buffer);
 byte* exposedTestNet_packMessage(const ExposedTestNet_Message* msg);
+byte* exposedTestNet_packMessageCompact(const ExposedTestNet_Message* msg, unsigned* size);
+ExposedTestNet_Message* exposedTestNet_unpackMessageCompact(const byte* buffer, unsigned size);
 
 typedef struct {
     unsigned id;
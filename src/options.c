@@ -91,8 +91,9 @@ static void parseHostOption(const char* line) {
         declarationSize = SDL_strlen(HOST_OPTION) + 1,
         payloadSize = size - declarationSize;
 
-    this->host = SDL_malloc(payloadSize);
+    this->host = SDL_malloc(payloadSize + 1);
     SDL_memcpy(this->host, line + declarationSize, payloadSize);
+    this->host[payloadSize] = 0;
 }
 
 static void parsePortOption(const char* line)
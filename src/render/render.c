@@ -528,6 +528,7 @@ void renderShowEmptyFilePathError(void) { postSystemMessage(stringsString(STRING
 void renderShowFileIsEmptyError(void) { postSystemMessage(stringsString(STRINGS_FILE_IS_EMPTY), true); }
 void renderShowUnableToTransmitFileError(void) { postSystemMessage(stringsString(STRINGS_UNABLE_TO_TRANSMIT_FILE), true); }
 void renderShowFileIsTooBig(void) { postSystemMessage(stringsString(STRINGS_FILE_IS_TOO_BIG), true); }
+void renderShowFilenameIsTooLong(void) { postSystemMessage(stringsString(STRINGS_FILENAME_IS_TOO_LONG), true); }
 void renderShowFileTransmittedSystemMessage(void) { postSystemMessage(stringsString(STRINGS_FILE_TRANSMITTED), false); }
 
 void renderShowInfiniteProgressBar(void) {
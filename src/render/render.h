@@ -131,6 +131,7 @@ void renderShowEmptyFilePathError(void);
 void renderShowFileIsEmptyError(void);
 void renderShowUnableToTransmitFileError(void);
 void renderShowFileIsTooBig(void);
+void renderShowFilenameIsTooLong(void);
 void renderShowFileTransmittedSystemMessage(void);
 
 void renderShowInfiniteProgressBar(void); // showed only on pages that support it (log in/register, not splash as it's a special case)
@@ -19,7 +19,7 @@
 #include <assert.h>
 #include "strings.h"
 
-const unsigned STRINGS = 53;
+const unsigned STRINGS = 54;
 static StringsLanguages sLanguage = STRINGS_LANGUAGE_ENGLISH;
 
 // English
@@ -77,7 +77,8 @@ static const char* const stringsEn[STRINGS] = {
     u8"Auto logging in",
     u8"Admin actions",
     u8"Broadcast message",
-    u8"All currently online users will receive this message, no encryption will be performed"
+    u8"All currently online users will receive this message, no encryption will be performed",
+    u8"Filename is too long"
 };
 
 // Russian
@@ -135,7 +136,8 @@ static const char* const stringsRu[STRINGS] = {
     u8"Входить автоматически",
     u8"Администрировать",
     u8"Рассылка",
-    u8"Все пользователи, которые сейчас подключены, получат это сообщение, дополнительное шифрование произведено не будет"
+    u8"Все пользователи, которые сейчас подключены, получат это сообщение, дополнительное шифрование произведено не будет",
+    u8"Имя файла слишком длинное"
 };
 
 // End
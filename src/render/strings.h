@@ -83,5 +83,6 @@ typedef enum : unsigned {
     STRINGS_AUTO_LOGGING_IN = 49,
     STRINGS_ADMIN_ACTIONS = 50,
     STRINGS_BROADCAST_MESSAGE = 51,
-    STRINGS_BROADCAST_HINT = 52
+    STRINGS_BROADCAST_HINT = 52,
+    STRINGS_FILENAME_IS_TOO_LONG = 53
 } Strings;
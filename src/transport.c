@@ -0,0 +1,336 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <SDL.h>
+#include <SDL_net.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "transport.h"
+
+STATIC_CONST_UNSIGNED MEMORY_PIPE_CAPACITY = 1 << 16; // bytes each direction holds, the sender blocks when it fills up, as it does when the socket's buffer fills up
+STATIC_CONST_UNSIGNED MAX_MEMORY_LISTENERS = 8;
+
+typedef struct {
+    TCPsocket socket;
+    SDLNet_SocketSet socketSet;
+} SdlConnection;
+
+typedef struct {
+    int descriptor;
+} NativeConnection;
+
+typedef struct {
+    byte buffer[MEMORY_PIPE_CAPACITY];
+    unsigned start;
+    unsigned count;
+} MemoryRing;
+
+typedef struct {
+    SDL_mutex* mutex;
+    SDL_cond* condition; // signaled when either direction gets written to or read from, or when the pipe gets closed
+    MemoryRing rings[2]; // an end writes into the ring with its side's index & reads from the other one
+    bool closed; // by either end, what's already in the rings can still be received
+    unsigned ends; // not yet closed
+} MemoryPipe;
+
+typedef struct {
+    MemoryPipe* pipe;
+    unsigned side;
+} MemoryEnd;
+
+typedef struct {
+    unsigned port;
+    MemoryEnd* nullable end; // the client's one
+} MemoryListener;
+
+static atomic unsigned nativeSendBufferSize = 0, nativeReceiveBufferSize = 0;
+static MemoryListener memoryListeners[MAX_MEMORY_LISTENERS] = {0};
+static SDL_SpinLock memoryListenersLock = 0; // held for a few instructions only
+
+static void* nullable sdlOpen(const char* host, unsigned port) {
+    if (SDLNet_Init() != 0) return NULL;
+
+    IPaddress address;
+    TCPsocket socket = NULL;
+
+    if (SDLNet_ResolveHost(&address, host, port) == 0)
+#if SDL_NET_MAJOR_VERSION == 2 && SDL_NET_MINOR_VERSION == 2
+        socket = SDLNet_TCP_Open(&address);
+#elif SDL_NET_MAJOR_VERSION == 2 && SDL_NET_MINOR_VERSION == 3
+        socket = SDLNet_TCP_OpenClient(&address);
+#else
+#   error "untested version"
+#endif
+
+    if (!socket) {
+        SDLNet_Quit();
+        return NULL;
+    }
+
+    SdlConnection* connection = SDL_malloc(sizeof *connection);
+    connection->socket = socket;
+    connection->socketSet = SDLNet_AllocSocketSet(1);
+    assert(connection->socketSet);
+    assert(SDLNet_TCP_AddSocket(connection->socketSet, connection->socket) == 1);
+    return connection;
+}
+
+static bool sdlSend(void* connection, const byte* bytes, unsigned size)
+{ return SDLNet_TCP_Send(((SdlConnection*) connection)->socket, bytes, (int) size) == (int) size; }
+
+static int sdlReceive(void* connection, byte* buffer, unsigned size)
+{ return SDLNet_TCP_Recv(((SdlConnection*) connection)->socket, buffer, (int) size); }
+
+static bool sdlReady(void* connection, unsigned timeout) { // the socket set is only touched by the thread that reads from the socket, so other threads can send while this one is blocked waiting
+    SdlConnection* sdlConnection = connection;
+    return SDLNet_CheckSockets(sdlConnection->socketSet, timeout) == 1
+        && SDLNet_SocketReady(sdlConnection->socket) != 0;
+}
+
+static void sdlClose(void* connection) {
+    SdlConnection* sdlConnection = connection;
+    SDLNet_FreeSocketSet(sdlConnection->socketSet);
+    SDLNet_TCP_Close(sdlConnection->socket);
+    SDL_free(sdlConnection);
+    SDLNet_Quit();
+}
+
+const Transport TRANSPORT_SDL = {&sdlOpen, &sdlSend, &sdlReceive, &sdlReady, &sdlClose};
+
+void transportNativeSetBufferSizes(unsigned sendSize, unsigned receiveSize) {
+    nativeSendBufferSize = sendSize;
+    nativeReceiveBufferSize = receiveSize;
+}
+
+static int nativeConnect(const struct addrinfo* address) { // returns the connected socket's descriptor or -1
+    const int descriptor = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (descriptor < 0) return -1;
+
+    const int sendSize = (int) nativeSendBufferSize, receiveSize = (int) nativeReceiveBufferSize, noDelay = 1;
+    if (sendSize) setsockopt(descriptor, SOL_SOCKET, SO_SNDBUF, &sendSize, sizeof sendSize); // the sizes are hints, the system may adjust them
+    if (receiveSize) setsockopt(descriptor, SOL_SOCKET, SO_RCVBUF, &receiveSize, sizeof receiveSize); // before connecting, as the window scale is agreed on during the connection establishment
+
+    if (connect(descriptor, address->ai_addr, address->ai_addrlen) != 0
+        || setsockopt(descriptor, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof noDelay) != 0)
+    {
+        close(descriptor);
+        return -1;
+    }
+    return descriptor;
+}
+
+static void* nullable nativeOpen(const char* host, unsigned port) {
+    char service[6];
+    SDL_snprintf(service, sizeof service, "%u", port);
+
+    const struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* addresses = NULL;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0) return NULL;
+
+    int descriptor = -1;
+    for (const struct addrinfo* address = addresses; address && descriptor < 0; address = address->ai_next)
+        descriptor = nativeConnect(address); // tries every address the host has been resolved to
+    freeaddrinfo(addresses);
+
+    if (descriptor < 0) return NULL;
+    NativeConnection* connection = SDL_malloc(sizeof *connection);
+    connection->descriptor = descriptor;
+    return connection;
+}
+
+static bool nativeSend(void* connection, const byte* bytes, unsigned size) {
+    const int descriptor = ((NativeConnection*) connection)->descriptor;
+
+    for (unsigned sent = 0; sent < size;) {
+        const long count = send(descriptor, bytes + sent, size - sent, MSG_NOSIGNAL); // the disconnection is reported by the result instead of SIGPIPE
+        if (count > 0) sent += (unsigned) count;
+        else if (count < 0 && errno == EINTR) continue;
+        else return false;
+    }
+    return true;
+}
+
+static int nativeReceive(void* connection, byte* buffer, unsigned size) {
+    long count;
+    while ((count = recv(((NativeConnection*) connection)->descriptor, buffer, size, 0)) < 0 && errno == EINTR);
+    return (int) count;
+}
+
+static bool nativeReady(void* connection, unsigned timeout) {
+    struct pollfd descriptor = {((NativeConnection*) connection)->descriptor, POLLIN, 0};
+    return poll(&descriptor, 1, (int) timeout) == 1; // the hangup & the errors count too, so the receive reports them
+}
+
+static void nativeClose(void* connection) {
+    close(((NativeConnection*) connection)->descriptor);
+    SDL_free(connection);
+}
+
+const Transport TRANSPORT_NATIVE = {&nativeOpen, &nativeSend, &nativeReceive, &nativeReady, &nativeClose};
+
+void* transportMemoryListen(unsigned port) {
+    MemoryPipe* pipe = SDL_malloc(sizeof *pipe);
+    pipe->mutex = SDL_CreateMutex();
+    pipe->condition = SDL_CreateCond();
+    pipe->rings[0].start = pipe->rings[0].count = 0;
+    pipe->rings[1].start = pipe->rings[1].count = 0;
+    pipe->closed = false;
+    pipe->ends = 2;
+
+    MemoryEnd* client = SDL_malloc(sizeof *client), * server = SDL_malloc(sizeof *server);
+    client->pipe = server->pipe = pipe;
+    client->side = 0;
+    server->side = 1;
+
+    SDL_AtomicLock(&memoryListenersLock);
+    unsigned slot = MAX_MEMORY_LISTENERS;
+    for (unsigned i = 0; i < MAX_MEMORY_LISTENERS; i++) {
+        assert(!memoryListeners[i].end || memoryListeners[i].port != port); // one listener per port
+        if (!memoryListeners[i].end && slot == MAX_MEMORY_LISTENERS) slot = i;
+    }
+    assert(slot < MAX_MEMORY_LISTENERS);
+    memoryListeners[slot].port = port;
+    memoryListeners[slot].end = client;
+    SDL_AtomicUnlock(&memoryListenersLock);
+
+    return server;
+}
+
+static MemoryEnd* nullable takeMemoryListener(bool (*matches)(const MemoryListener*, const void*), const void* parameter) { // unregisters & returns the client's end of the first matching listener
+    MemoryEnd* end = NULL;
+    SDL_AtomicLock(&memoryListenersLock);
+
+    for (unsigned i = 0; i < MAX_MEMORY_LISTENERS && !end; i++) {
+        if (!memoryListeners[i].end || !(*matches)(&(memoryListeners[i]), parameter)) continue;
+        end = memoryListeners[i].end;
+        memoryListeners[i].end = NULL;
+    }
+
+    SDL_AtomicUnlock(&memoryListenersLock);
+    return end;
+}
+
+static bool listenerHasPort(const MemoryListener* listener, const void* port) { return listener->port == *(const unsigned*) port; }
+static bool listenerHasPipe(const MemoryListener* listener, const void* pipe) { return listener->end->pipe == pipe; }
+
+static void* nullable memoryOpen(const char*, unsigned port) // as if the connection has been refused if nothing listens to the port
+{ return takeMemoryListener(&listenerHasPort, &port); }
+
+static bool memorySend(void* connection, const byte* bytes, unsigned size) {
+    const MemoryEnd* end = connection;
+    MemoryPipe* pipe = end->pipe;
+    MemoryRing* ring = &(pipe->rings[end->side]);
+
+    SDL_LockMutex(pipe->mutex);
+    while (size && !pipe->closed) {
+        if (ring->count == MEMORY_PIPE_CAPACITY) {
+            SDL_CondWait(pipe->condition, pipe->mutex); // until the other end reads something
+            continue;
+        }
+
+        const unsigned tail = (ring->start + ring->count) % MEMORY_PIPE_CAPACITY;
+        const unsigned count = min(size, min(MEMORY_PIPE_CAPACITY - ring->count, MEMORY_PIPE_CAPACITY - tail)); // up to the end of the free space or of the buffer, the rest goes to its beginning in the next iteration
+
+        SDL_memcpy(ring->buffer + tail, bytes, count);
+        ring->count += count;
+        bytes += count;
+        size -= count;
+        SDL_CondBroadcast(pipe->condition);
+    }
+    SDL_UnlockMutex(pipe->mutex);
+
+    return !size;
+}
+
+static int memoryReceive(void* connection, byte* buffer, unsigned size) {
+    const MemoryEnd* end = connection;
+    MemoryPipe* pipe = end->pipe;
+    MemoryRing* ring = &(pipe->rings[!end->side]);
+
+    SDL_LockMutex(pipe->mutex);
+    while (!ring->count && !pipe->closed)
+        SDL_CondWait(pipe->condition, pipe->mutex);
+
+    const unsigned count = min(size, min(ring->count, MEMORY_PIPE_CAPACITY - ring->start)); // the rest is received in the next call, as a socket does
+    SDL_memcpy(buffer, ring->buffer + ring->start, count);
+    ring->start = (ring->start + count) % MEMORY_PIPE_CAPACITY;
+    ring->count -= count;
+    SDL_CondBroadcast(pipe->condition);
+
+    SDL_UnlockMutex(pipe->mutex);
+    return (int) count; // zero if the pipe has been closed & drained
+}
+
+static bool memoryReady(void* connection, unsigned timeout) {
+    const MemoryEnd* end = connection;
+    MemoryPipe* pipe = end->pipe;
+    const MemoryRing* ring = &(pipe->rings[!end->side]);
+
+    SDL_LockMutex(pipe->mutex);
+    if (!ring->count && !pipe->closed)
+        SDL_CondWaitTimeout(pipe->condition, pipe->mutex, timeout); // a wakeup caused by the other direction is reported as not ready, the caller waits again then
+    const bool ready = ring->count || pipe->closed;
+    SDL_UnlockMutex(pipe->mutex);
+
+    return ready;
+}
+
+static void closeMemoryEnd(MemoryEnd* end) {
+    MemoryPipe* pipe = end->pipe;
+    SDL_free(end);
+
+    SDL_LockMutex(pipe->mutex);
+    pipe->closed = true;
+    const bool last = !--(pipe->ends);
+    SDL_CondBroadcast(pipe->condition);
+    SDL_UnlockMutex(pipe->mutex);
+
+    if (!last) return;
+    SDL_DestroyCond(pipe->condition);
+    SDL_DestroyMutex(pipe->mutex);
+    SDL_free(pipe);
+}
+
+static void memoryClose(void* connection) {
+    MemoryEnd* unclaimed = takeMemoryListener(&listenerHasPipe, ((MemoryEnd*) connection)->pipe); // the server's end is closed before anyone has connected to it
+    closeMemoryEnd(connection);
+    if (unclaimed) closeMemoryEnd(unclaimed);
+}
+
+const Transport TRANSPORT_MEMORY = {&memoryOpen, &memorySend, &memoryReceive, &memoryReady, &memoryClose};
+
+#ifdef TESTING
+
+void* exposedTestTransport_wrapSdlSocket(void* socket) {
+    assert(!SDLNet_Init()); // balances the quit in the close
+
+    SdlConnection* connection = SDL_malloc(sizeof *connection);
+    connection->socket = socket;
+    connection->socketSet = SDLNet_AllocSocketSet(1);
+    assert(connection->socketSet);
+    assert(SDLNet_TCP_AddSocket(connection->socketSet, connection->socket) == 1);
+    return connection;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "defs.h"
+
+// The byte stream the net module talks to the server through, the module doesn't know what's underneath it
+
+typedef struct {
+    void* nullable (*open)(const char* host, unsigned port); // blocks until connected, returns the connection or null on failure
+    bool (*send)(void* connection, const byte* bytes, unsigned size); // blocks until all the bytes are sent, returns false if disconnected; may be called concurrently with receive & ready but not with another send
+    int (*receive)(void* connection, byte* buffer, unsigned size); // a single read of up to size bytes, blocks if nothing has arrived, returns zero or less if disconnected
+    bool (*ready)(void* connection, unsigned timeout); // blocks until either something can be received (or the connection is closed by the other side, so receive won't block) or the timeout (in milliseconds) passes
+    void (*close)(void* connection); // deallocates the connection
+} Transport;
+
+extern const Transport TRANSPORT_SDL; // via SDL_net, the default one
+extern const Transport TRANSPORT_NATIVE; // via the system's sockets with Nagle's algorithm disabled, so small frames aren't delayed
+extern const Transport TRANSPORT_MEMORY; // a pipe pair inside the process, the host is ignored & the port must be listened to beforehand
+
+void transportNativeSetBufferSizes(unsigned sendSize, unsigned receiveSize); // applied to the native connections opened afterwards, 0 leaves the system's default size
+void* transportMemoryListen(unsigned port); // the next TRANSPORT_MEMORY.open with this port gets connected to the returned server's end of the pipe pair, which is used with TRANSPORT_MEMORY's functions too
+
+#ifdef TESTING
+
+void* exposedTestTransport_wrapSdlSocket(void* socket); // wraps an accepted TCPsocket so it can be used with TRANSPORT_SDL's functions
+
+#endif
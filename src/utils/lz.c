@@ -0,0 +1,155 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <SDL_stdinc.h>
+#include <assert.h>
+#include <stdbool.h>
+#include "lz.h"
+
+STATIC_CONST_UNSIGNED MIN_MATCH = 4;
+STATIC_CONST_UNSIGNED MAX_OFFSET = 0xffff;
+STATIC_CONST_UNSIGNED NIBBLE_MAX = 15;
+STATIC_CONST_UNSIGNED TAIL_MAX = 255;
+STATIC_CONST_UNSIGNED HASH_BITS = 12; // 4096 entries, 16 kb on stack
+STATIC_CONST_UNSIGNED OFFSET_SIZE = 2;
+
+static inline unsigned read32(const byte* bytes) { // unaligned
+    unsigned value;
+    SDL_memcpy(&value, bytes, sizeof value);
+    return value;
+}
+
+static inline unsigned hash(unsigned sequence) { return (sequence * 2654435761u) >> (32 - HASH_BITS); } // Knuth's multiplicative
+
+static inline unsigned tailSize(unsigned length) { return length < NIBBLE_MAX ? 0 : (length - NIBBLE_MAX) / TAIL_MAX + 1; }
+
+static unsigned writeTail(byte* destination, unsigned length) { // returns the count of written bytes
+    if (length < NIBBLE_MAX) return 0;
+
+    unsigned written = 0;
+    for (length -= NIBBLE_MAX; length >= TAIL_MAX; length -= TAIL_MAX) destination[written++] = TAIL_MAX;
+    destination[written++] = (byte) length;
+    return written;
+}
+
+static bool readTail(const byte* source, unsigned sourceSize, unsigned* position, unsigned* length) { // returns false if the source ends prematurely
+    byte next;
+    do {
+        if (*position >= sourceSize) return false;
+        next = source[(*position)++];
+        *length += next;
+    } while (next == TAIL_MAX);
+    return true;
+}
+
+static unsigned writeEntry( // returns the count of written bytes
+    byte* destination,
+    const byte* literals,
+    unsigned literalsSize,
+    unsigned offset, // 0 if the entry ends the block
+    unsigned matchSize
+) {
+    unsigned written = 0;
+
+    const unsigned matchNibble = offset ? matchSize - MIN_MATCH : 0;
+    destination[written++] = (byte) (min(literalsSize, NIBBLE_MAX) << 4 | min(matchNibble, NIBBLE_MAX));
+
+    written += writeTail(destination + written, literalsSize);
+    SDL_memcpy(destination + written, literals, literalsSize);
+    written += literalsSize;
+
+    if (!offset) return written;
+
+    destination[written++] = (byte) offset;
+    destination[written++] = (byte) (offset >> 8);
+    written += writeTail(destination + written, matchNibble);
+    return written;
+}
+
+unsigned lzCompress(const byte* source, unsigned sourceSize, byte* destination, unsigned destinationSize, unsigned* consumed) {
+    assert(source && destination && consumed);
+
+    unsigned table[1 << HASH_BITS]; // positions of the recently seen 4-byte sequences, plus one, so zero stays for empty entries
+    SDL_memset(table, 0, sizeof table);
+
+    unsigned position = 0, anchor = 0, written = 0; // the anchor is where the pending literals begin
+
+    while (position + MIN_MATCH <= sourceSize) {
+        const unsigned sequence = read32(source + position), slot = hash(sequence), candidate = table[slot];
+        table[slot] = position + 1;
+
+        if (!candidate || position - (candidate - 1) > MAX_OFFSET || read32(source + candidate - 1) != sequence) {
+            position++;
+            continue;
+        }
+
+        const unsigned matchStart = candidate - 1;
+        unsigned matchSize = MIN_MATCH;
+        while (position + matchSize < sourceSize && source[matchStart + matchSize] == source[position + matchSize]) matchSize++;
+
+        const unsigned literalsSize = position - anchor,
+            entrySize = 1 + tailSize(literalsSize) + literalsSize + OFFSET_SIZE + tailSize(matchSize - MIN_MATCH);
+        if (written + entrySize > destinationSize) break; // the rest goes as literals, as many as fit
+
+        written += writeEntry(destination + written, source + anchor, literalsSize, position - matchStart, matchSize);
+        position += matchSize;
+        anchor = position;
+    }
+
+    unsigned literalsSize = min(sourceSize - anchor, destinationSize - written);
+    while (literalsSize && written + 1 + tailSize(literalsSize) + literalsSize > destinationSize) literalsSize--; // just a few steps as the tail grows slowly
+
+    if (literalsSize) written += writeEntry(destination + written, source + anchor, literalsSize, 0, 0);
+
+    *consumed = anchor + literalsSize;
+    return written;
+}
+
+unsigned lzDecompress(const byte* source, unsigned sourceSize, byte* destination, unsigned destinationSize) {
+    assert(source && destination);
+    unsigned position = 0, written = 0;
+
+    while (position < sourceSize) {
+        const byte token = source[position++];
+
+        unsigned literalsSize = token >> 4;
+        if (literalsSize == NIBBLE_MAX && !readTail(source, sourceSize, &position, &literalsSize)) return 0;
+        if (literalsSize > sourceSize - position || literalsSize > destinationSize - written) return 0;
+
+        SDL_memcpy(destination + written, source + position, literalsSize);
+        position += literalsSize;
+        written += literalsSize;
+
+        if (position == sourceSize) break;
+        if (sourceSize - position < OFFSET_SIZE) return 0;
+
+        const unsigned offset = source[position] | source[position + 1] << 8;
+        position += OFFSET_SIZE;
+        if (!offset || offset > written) return 0;
+
+        unsigned matchSize = token & NIBBLE_MAX;
+        if (matchSize == NIBBLE_MAX && !readTail(source, sourceSize, &position, &matchSize)) return 0;
+        matchSize += MIN_MATCH;
+        if (matchSize > destinationSize - written) return 0;
+
+        for (unsigned i = 0; i < matchSize; i++, written++) // byte by byte as the match may overlap the bytes being written, which is how runs get encoded
+            destination[written] = destination[written - offset];
+    }
+
+    return written;
+}
@@ -0,0 +1,30 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../defs.h"
+
+// A byte-oriented LZ77-class codec for data that's about to be encrypted (which makes it incompressible afterwards).
+// The compressed block is a sequence of [token][literals length tail][literals][match offset][match length tail] entries,
+// the token's high nibble is the literals length & the low one is the match length minus 4, a nibble of 15 is continued by
+// tail bytes which are summed up until one of them is less than 255; the offset takes 2 bytes (little endian); the block
+// may end right after any entry's literals
+
+unsigned lzCompress(const byte* source, unsigned sourceSize, byte* destination, unsigned destinationSize, unsigned* consumed); // compresses as much of the source as fits into the destination, sets consumed to the count of the source's bytes that have been compressed, returns the compressed size
+unsigned lzDecompress(const byte* source, unsigned sourceSize, byte* destination, unsigned destinationSize); // returns the decompressed size, or 0 if the source is malformed or doesn't fit into the destination
@@ -17,11 +17,13 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <unistd.h>
 #include <time.h>
 #include <SDL.h>
 #include "../src/collections/list.h"
 #include "../src/collections/queue.h"
+#include "../src/collections/timerWheel.h"
 #include "testCollections.h"
 
 static int testCollections_listBasicComparator(const unsigned* left, const unsigned** right)
@@ -97,6 +99,26 @@ void testCollections_queueBasic(void) {
     }
 
     assert(!queueSize(queue));
+
+    unsigned pushed = 0, popped = 0; // interleaves pushes & pops so the values wrap around the queue's storage as it grows
+    for (unsigned i = 0; i < count * 10; i++) {
+        for (unsigned k = 0; k < 3; k++) {
+            unsigned* j = SDL_malloc(sizeof *j);
+            *j = pushed++;
+            queuePush(queue, j);
+        }
+
+        for (unsigned k = 0; k < 2; k++) {
+            unsigned* j = queuePop(queue);
+            assert(j && *j == popped++);
+            SDL_free(j);
+        }
+    }
+    assert(queueSize(queue) == pushed - popped);
+
+    unsigned* top = queuePeek(queue);
+    assert(top && *top == popped);
+
     queueDestroy(queue);
 
     assert(allocations == SDL_GetNumAllocations());
@@ -127,7 +149,69 @@ void testCollections_queueExtra(void) {
     SDL_free(value);
 
     SDL_WaitThread(manipulator, NULL);
+
+    const unsigned long startMillis = currentTimeMillis();
+    assert(!queueWaitAndPop(queue, 100)); // nothing gets pushed
+    assert(currentTimeMillis() - startMillis >= 100);
     queueDestroy(queue);
 
     assert(allocations == SDL_GetNumAllocations());
 }
+
+void testCollections_timerWheel(void) {
+    const int allocations = SDL_GetNumAllocations();
+
+    const unsigned count = 100, resolution = 10;
+    unsigned long now = 1000, deadlines[count];
+    bool cancelled[count], expiredTimers[count];
+
+    TimerWheel* wheel = timerWheelInit(count, resolution, now);
+    assert(timerWheelNextExpiration(wheel) == ULONG_MAX);
+
+    for (unsigned i = 0; i < count; i++) { // the deadlines span all the levels but the last one
+        deadlines[i] = now + 1 + i * i * 7;
+        timerWheelArm(wheel, i, deadlines[i]);
+        cancelled[i] = !(i % 3);
+        expiredTimers[i] = false;
+    }
+
+    for (unsigned i = 0; i < count; i += 3) timerWheelCancel(wheel, i);
+    assert(!timerWheelArmed(wheel, 0) && timerWheelArmed(wheel, 1));
+
+    deadlines[1] = now + 5000; // re-arming moves the timer
+    timerWheelArm(wheel, 1, deadlines[1]);
+    assert(timerWheelNextExpiration(wheel) <= deadlines[2] + resolution);
+
+    unsigned expired[count], expiredCount = 0;
+    const unsigned long last = now + count * count * 7 + resolution;
+
+    while (now < last) {
+        const unsigned long previous = now;
+        now += 7; // not aligned with the ticks
+
+        const unsigned newlyExpired = timerWheelAdvance(wheel, now, expired);
+        for (unsigned i = 0; i < newlyExpired; i++) {
+            const unsigned timer = expired[i], expiration = (deadlines[timer] / resolution + 1) * resolution;
+            assert(!cancelled[timer] && !expiredTimers[timer] && !timerWheelArmed(wheel, timer));
+            assert(now > deadlines[timer] && now >= expiration && previous < expiration); // never before the deadline & within a tick after it
+            expiredTimers[timer] = true;
+        }
+        expiredCount += newlyExpired;
+    }
+
+    for (unsigned i = 0; i < count; i++) assert(expiredTimers[i] == !cancelled[i]);
+    assert(expiredCount == count - (count + 2) / 3 && timerWheelNextExpiration(wheel) == ULONG_MAX);
+
+    timerWheelArm(wheel, 0, now - resolution * 3); // has passed already, expires on the next tick
+    assert(timerWheelAdvance(wheel, now + resolution, expired) == 1 && !*expired);
+    now += resolution;
+
+    const unsigned long far = now + (1ul << 24) * resolution * 2; // further than the wheel spans, waits in the last level
+    timerWheelArm(wheel, 0, far);
+    assert(!timerWheelAdvance(wheel, far, expired));
+    assert(timerWheelAdvance(wheel, far + resolution, expired) == 1 && !*expired);
+
+    timerWheelDestroy(wheel);
+
+    assert(allocations == SDL_GetNumAllocations());
+}
@@ -23,3 +23,5 @@ void testCollections_listExtra(void);
 
 void testCollections_queueBasic(void);
 void testCollections_queueExtra(void);
+
+void testCollections_timerWheel(void);
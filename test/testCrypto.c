@@ -69,10 +69,17 @@ void testCrypto_signature(void) {
 
     byte* xSigned = exposedTestCrypto_sign(bytes, size, secretSignKey);
     assert(xSigned);
-    SDL_free(secretSignKey);
 
     assert(cryptoCheckServerSignedBytes(xSigned, xSigned + CRYPTO_SIGNATURE_SIZE, size));
+
+    byte* xSignedAgain = exposedTestCrypto_sign(bytes, size, secretSignKey); // signatures are deterministic, so the verified one can be cached and compared with
+    assert(cryptoCompare(xSigned, xSignedAgain, CRYPTO_SIGNATURE_SIZE));
+    xSignedAgain[0]++;
+    assert(!cryptoCompare(xSigned, xSignedAgain, CRYPTO_SIGNATURE_SIZE));
+    SDL_free(xSignedAgain);
+
     SDL_free(xSigned);
+    SDL_free(secretSignKey);
 
     assert(allocations == SDL_GetNumAllocations());
 }
@@ -109,6 +116,29 @@ void testCrypto_streamCrypt(void) {
         SDL_free(decrypted);
     }
 
+    {
+        const unsigned size = 10;
+        byte original[size];
+        cryptoFillWithRandomBytes(original, size);
+
+        byte buffer[cryptoEncryptedSize(size)];
+        SDL_memcpy(buffer + CRYPTO_IN_PLACE_OFFSET, original, size);
+        assert(cryptoEncryptInPlace(streams1, buffer, size, false));
+
+        byte* decrypted = cryptoDecrypt(streams1, buffer, sizeof buffer, false);
+        assert(decrypted);
+        assert(!SDL_memcmp(original, decrypted, size));
+        SDL_free(decrypted);
+
+        byte* encrypted = cryptoEncrypt(streams1, original, size, false);
+        assert(encrypted);
+        SDL_memcpy(buffer, encrypted, sizeof buffer);
+        SDL_free(encrypted);
+
+        assert(cryptoDecryptInPlace(streams1, buffer, sizeof buffer, false));
+        assert(!SDL_memcmp(original, buffer + CRYPTO_IN_PLACE_OFFSET, size));
+    }
+
     cryptoCoderStreamsDestroy(streams1);
 
     assert(allocations == SDL_GetNumAllocations());
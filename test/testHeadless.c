@@ -0,0 +1,144 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <SDL.h>
+#include <SDL_net.h>
+#include "../src/crypto.h"
+#include "testServer.h"
+#include "testHeadless.h"
+
+// The whole client, built with HEADLESS, is run as a separate process against the stand-in server, its standard output is compared with the expected one
+
+STATIC_CONST_UNSIGNED MAX_OUTPUT_SIZE = 1 << 12;
+STATIC_CONST_UNSIGNED CONVERSATION_PEER = 3; // a connected one
+
+static void writeFile(const char* name, const char* content) {
+    SDL_RWops* rwOps = SDL_RWFromFile(name, "wb");
+    assert(rwOps);
+    assert(SDL_RWwrite(rwOps, content, 1, SDL_strlen(content)) == SDL_strlen(content));
+    SDL_RWclose(rwOps);
+}
+
+static void writeOptions(unsigned port) { // the client is pointed at the stand-in server, whose sign key changes on each start
+    char options[MAX_OUTPUT_SIZE];
+    unsigned size = SDL_snprintf(options, MAX_OUTPUT_SIZE, "admin=false\nhost=127.0.0.1\nport=%u\nsspk=", port);
+
+    for (unsigned i = 0; i < CRYPTO_KEY_SIZE; i++)
+        size += SDL_snprintf(options + size, MAX_OUTPUT_SIZE - size, i ? ",%u" : "%u", testServer_signPublicKey()[i]);
+
+    SDL_snprintf(options + size, MAX_OUTPUT_SIZE - size, "\ntheme=1\nlanguage=0\ncredentials="); // no trailing newline, as in the default file
+    writeFile("options.txt", options);
+}
+
+static unsigned expectUsers(char* buffer, unsigned size, unsigned conversationPeer) { // as the users command prints them, the client itself is excluded; returns the size written
+    unsigned written = 0;
+    for (unsigned peer = 2; peer < TEST_SERVER_MAX_PEERS; peer++)
+        written += SDL_snprintf(buffer + written, size - written, "%u\tpeer%u\t%s\t%s\n", peer, peer, peer % 2 ? "online" : "offline", peer == conversationPeer ? "conversation" : "-");
+    return written;
+}
+
+static FILE* startClient(const char* client, unsigned port, const char* script) { // with the script as the standard input, the client's standard output is read from the returned pipe
+    assert(client);
+    writeOptions(port);
+    remove("database.sqlite3"); // left from a previous run
+    writeFile("script.txt", script);
+
+    char command[MAX_OUTPUT_SIZE];
+    SDL_snprintf(command, MAX_OUTPUT_SIZE, "%s < script.txt", client); // the standard error, with the system messages, goes to the test's log
+    FILE* process = popen(command, "r");
+    assert(process);
+    return process;
+}
+
+static void finishClient(FILE* process, char* output, unsigned size) { // reads the rest of the output, it's compared as a whole since a failed command stops the script
+    const unsigned read = fread(output, 1, size - 1, process);
+    output[read] = 0;
+    assert(!pclose(process)); // neither crashed nor asserted
+}
+
+void testHeadless_script(const char* client) {
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = 8098;
+    testServer_start(port, 1 << 12, false, false);
+
+    FILE* process = startClient(client, port,
+        "# the users list, then a conversation with a stand-in peer, which shows up in the list afterwards\n"
+        "login tester password\n"
+        "users\n"
+        "open peer3\n"
+        "send hello\n"
+        "back\n"
+        "users\n"
+        "exit\n"
+    );
+
+    char output[MAX_OUTPUT_SIZE], expected[MAX_OUTPUT_SIZE];
+    finishClient(process, output, MAX_OUTPUT_SIZE);
+
+    const unsigned size = expectUsers(expected, MAX_OUTPUT_SIZE, 0);
+    expectUsers(expected + size, MAX_OUTPUT_SIZE - size, CONVERSATION_PEER);
+    assert(!SDL_strcmp(output, expected));
+
+    assert(testServer_messagesReceived(CONVERSATION_PEER) == 1); // the client drains its pending sends before quitting
+    testServer_stop();
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+void testHeadless_reconnection(const char* client) {
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = 8099;
+    testServer_start(port, 1 << 12, false, false);
+
+    FILE* process = startClient(client, port,
+        "# the connection gets dropped after the first list, the client reconnects & logs back in by itself\n"
+        "login tester password\n"
+        "users\n"
+        "wait 1000\n"
+        "users\n"
+        "exit\n"
+    );
+
+    char output[MAX_OUTPUT_SIZE], expected[MAX_OUTPUT_SIZE];
+    unsigned size = 0;
+    for (unsigned i = 0; i < TEST_SERVER_MAX_PEERS - 2; i++) { // the first list, the output is flushed after each command
+        assert(fgets(output + size, (int) (MAX_OUTPUT_SIZE - size), process));
+        size += SDL_strlen(output + size);
+    }
+
+    testServer_dropClients(); // while the client waits
+    finishClient(process, output + size, MAX_OUTPUT_SIZE - size);
+
+    size = expectUsers(expected, MAX_OUTPUT_SIZE, 0);
+    size += expectUsers(expected + size, MAX_OUTPUT_SIZE - size, 0);
+    SDL_snprintf(expected + size, MAX_OUTPUT_SIZE - size, "%u\tuser%u\toffline\t-\n", TEST_SERVER_FIRST_CLIENT_ID, TEST_SERVER_FIRST_CLIENT_ID); // the dropped session, the resumed one has got the next id
+    assert(!SDL_strcmp(output, expected));
+
+    assert(testServer_loggedInClients() == 2);
+    testServer_stop();
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
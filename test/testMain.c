@@ -23,6 +23,8 @@
 #include "testRender.h"
 #include "testNet.h"
 #include "testCrypto.h"
+#include "testUtils.h"
+#include "testHeadless.h"
 
 #pragma pack(true)
 
@@ -32,7 +34,7 @@
 
 int main(int argc, const char* const* argv) {
     staticAssert(__LINUX__ == 1);
-    assert(argc == 2);
+    assert(argc == 2 || argc == 3); // the headless client's path follows the test's index for the tests that run it
     assert(!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_TIMER));
     testCrypto_start();
 
@@ -41,6 +43,7 @@ int main(int argc, const char* const* argv) {
         case 1: testCollections_listExtra(); break;
         case 2: testCollections_queueBasic(); break;
         case 3: testCollections_queueExtra(); break;
+        case 35: testCollections_timerWheel(); break;
 
         case 4: testRender_basic(); break;
 
@@ -48,6 +51,23 @@ int main(int argc, const char* const* argv) {
         case 6: testNet_packMessage(true); break;
         case 7: testNet_unpackMessage(true); break;
         case 8: testNet_unpackUserInfo(); break;
+        case 17: testNet_negotiation(false, false); break;
+        case 18: testNet_negotiation(true, false); break;
+        case 19: testNet_negotiation(true, true); break;
+        case 20: testNet_packMessageCompact(true); break;
+        case 21: testNet_connectionFailure(); break;
+        case 22: testNet_conversationSetups(); break;
+        case 23: testNet_fileTransfers(NULL); break;
+        case 24: testNet_batchedFetch(false); break;
+        case 25: testNet_batchedFetch(true); break;
+        case 26: testNet_presence(false); break;
+        case 27: testNet_presence(true); break;
+        case 30: testNet_heartbeat(false, false); break;
+        case 31: testNet_heartbeat(true, false); break;
+        case 36: testNet_heartbeat(true, true); break;
+        case 32: testNet_fileTransfers(&TRANSPORT_NATIVE); break;
+        case 33: testNet_fileTransfers(&TRANSPORT_MEMORY); break;
+        case 34: testNet_sessions(); break;
 
         case 9: testCrypto_keyExchange(); break;
         case 10: testCrypto_signature(); break;
@@ -57,6 +77,12 @@ int main(int argc, const char* const* argv) {
         case 14: testCrypto_padding(true); break;
         case 15: testCrypto_coderStreamsSerialization(); break;
         case 16: testCrypto_base64(); break;
+
+        case 28: testUtils_lzRoundTrip(); break;
+        case 29: testUtils_lzPartial(); break;
+
+        case 37: testHeadless_script(argv[2]); break;
+        case 38: testHeadless_reconnection(argv[2]); break;
     }
 
     ///////////////////////////////////////////////////////////
@@ -21,9 +21,11 @@
 #include <assert.h>
 #include <SDL.h>
 #include <SDL_net.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <unistd.h>
 #include "../src/net.h"
+#include "testServer.h"
 #include "testNet.h"
 
 static int akaServerThread(void*) {
@@ -174,3 +176,566 @@ void testNet_unpackUserInfo(void) {
     assert(!SDL_strcmp((char*) info->name, (char*) (akaPacked + 4 + 1)));
     SDL_free(info);
 }
+
+static NetConnection* atomic connection = NULL;
+static atomic bool loggedIn = false;
+static atomic bool connected = false;
+static atomic bool connectionFinished = false;
+static atomic unsigned connectionStep = 0;
+static atomic unsigned echoedSize = 0;
+
+static void onMessageReceived(unsigned long, unsigned, const byte*, unsigned) { assert(false); }
+static void onLogInResult(bool successful) { loggedIn = successful; }
+static void onErrorReceived(int) { assert(false); }
+static void onDisconnected(void) {}
+static atomic unsigned long clockShift = 0; // lets the tests skip the net module's timeouts
+static unsigned long currentTimeMillis(void) { return SDL_GetTicks64() + clockShift; }
+
+static void onBroadcastMessageReceived(const byte* text, unsigned size) {
+    for (unsigned i = 0; i < size; i++) assert(text[i] == (byte) i);
+    echoedSize = size;
+}
+
+static void onConnected(bool successful) {
+    connected = successful;
+    connectionFinished = true;
+}
+
+static void onConnectionProgress(unsigned step, unsigned stepsCount) {
+    assert(step == connectionStep + 1 && step <= stepsCount); // steps come in order, none is skipped
+    connectionStep = step;
+}
+
+static void waitFor(const atomic bool* flag) { for (unsigned i = 0; !*flag && i < 50; SDL_Delay(100), i++); }
+
+typedef struct { // the callbacks a test checks, the others are either null or the shared ones above
+    NetOnDisconnected nullable onDisconnected; // onDisconnected if null
+    NetOnConversationSetUpInviteReceived nullable onConversationSetUpInviteReceived;
+    NetOnConversationSetUp nullable onConversationSetUp;
+    NetNextFileChunkSupplier nullable nextFileChunkSupplier;
+    NetOnFileExchangeFinished nullable onFileExchangeFinished;
+    NetOnNextMessageFetched nullable onNextMessageFetched;
+    NetOnMessagesBatchFetched nullable onMessagesBatchFetched;
+    NetOnPresenceChanged nullable onPresenceChanged;
+} Callbacks;
+
+static void connectToServer(unsigned port, const Transport* nullable transport, Callbacks callbacks) { // the stand-in server must be listening on the port already
+    connected = connectionFinished = false;
+    connectionStep = 0;
+
+    assert(netInit(
+        &connection,
+        "127.0.0.1", port, transport,
+        testServer_signPublicKey(), CRYPTO_KEY_SIZE,
+        &onMessageReceived,
+        &onLogInResult,
+        &onErrorReceived,
+        NULL,
+        callbacks.onDisconnected ? callbacks.onDisconnected : &onDisconnected,
+        &currentTimeMillis,
+        NULL,
+        callbacks.onConversationSetUpInviteReceived,
+        callbacks.onConversationSetUp,
+        NULL,
+        callbacks.nextFileChunkSupplier,
+        NULL,
+        callbacks.onFileExchangeFinished,
+        callbacks.onNextMessageFetched,
+        callbacks.onMessagesBatchFetched,
+        callbacks.onPresenceChanged,
+        &onBroadcastMessageReceived,
+        &onConnected,
+        &onConnectionProgress
+    )); // returns right away, the handshake is performed in the net thread
+
+    waitFor(&connectionFinished);
+    assert(connected);
+}
+
+static void connectAndLogIn(unsigned port, const Transport* nullable transport, Callbacks callbacks) {
+    connectToServer(port, transport, callbacks);
+
+    char username[NET_USERNAME_SIZE], password[NET_UNHASHED_PASSWORD_SIZE];
+    SDL_memset(username, 'u', sizeof username);
+    SDL_memset(password, 'p', sizeof password);
+
+    loggedIn = false;
+    netLogIn(connection, username, password); // the connection's coder streams are still in sync after the negotiation, the header format has been switched if compact
+    waitFor(&loggedIn);
+    assert(loggedIn);
+}
+
+static const NetFlagStats* findFlagStats(const NetStats* stats, int flag) {
+    const NetFlagStats* found = NULL;
+    for (unsigned i = 0; !found && i < sizeof stats->flags / sizeof *stats->flags; i++)
+        if (stats->flags[i].flag == flag) found = &(stats->flags[i]);
+
+    assert(found);
+    return found;
+}
+
+void testNet_negotiation(bool extended, bool compact) {
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = 8081 + extended + compact, serverMaxMessageSize = 1 << 12; // 4096
+    testServer_start(port, extended ? serverMaxMessageSize : 0, compact, false);
+
+    connectAndLogIn(port, NULL, (Callbacks) {0});
+    assert(connectionStep == 6);
+
+    const unsigned messageHeadSize = 96, maxBodySize = netMaxMessageBodySize(connection);
+    assert(maxBodySize == (extended ? serverMaxMessageSize - messageHeadSize : NET_MAX_MESSAGE_BODY_SIZE));
+
+    byte text[maxBodySize];
+    for (unsigned i = 0; i < maxBodySize; text[i] = (byte) i, i++);
+
+    echoedSize = 0;
+    netSendBroadcast(connection, text, maxBodySize); // the largest message allowed for the connection, the stand-in server echoes it back
+    for (unsigned i = 0; !echoedSize && i < 50; SDL_Delay(100), i++);
+    assert(echoedSize == maxBodySize);
+
+    NetStats stats;
+    netStats(connection, &stats);
+
+    const NetFlagStats* broadcasts = findFlagStats(&stats, 0x10000000), * logIns = findFlagStats(&stats, 0x04), * loggedIns = findFlagStats(&stats, 0x05);
+    assert(broadcasts->framesSent == 1 && broadcasts->framesReceived == 1 && broadcasts->bytesSent > maxBodySize && broadcasts->bytesReceived > maxBodySize);
+    assert(logIns->framesSent == 1 && !logIns->framesReceived && !loggedIns->framesSent && loggedIns->framesReceived == 1);
+    assert(!findFlagStats(&stats, -1)->framesReceived); // the stand-in server doesn't send anything unknown
+    assert(!stats.droppedWhileFetchingUsers && !stats.droppedWhileFetchingMessages && !stats.droppedWhileIgnoring && !stats.conversationSetups && !stats.fileTransfers);
+
+    netClean(connection);
+    testServer_stop();
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+static atomic int conversationSetUpResults[TEST_SERVER_MAX_PEERS] = {0}; // 1 - set up, -1 - failed
+
+static void onConversationSetUpInviteReceived(unsigned) { assert(false); }
+
+static void onConversationSetUp(unsigned peerId, CryptoCoderStreams* nullable coderStreams) {
+    assert(peerId < TEST_SERVER_MAX_PEERS && !conversationSetUpResults[peerId]);
+    conversationSetUpResults[peerId] = coderStreams ? 1 : -1;
+    if (coderStreams) cryptoCoderStreamsDestroy(coderStreams);
+}
+
+void testNet_conversationSetups(void) {
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = 8084;
+    testServer_start(port, 0, false, false);
+
+    for (unsigned i = 0; i < TEST_SERVER_MAX_PEERS; conversationSetUpResults[i++] = 0);
+
+    connectAndLogIn(port, NULL, (Callbacks) {.onConversationSetUpInviteReceived = &onConversationSetUpInviteReceived, .onConversationSetUp = &onConversationSetUp});
+
+    for (unsigned i = 2; i < TEST_SERVER_MAX_PEERS; i++)
+        assert(netCreateConversation(connection, i)); // returns right away, so the setups proceed in parallel
+
+    bool finished = false;
+    for (unsigned i = 0; !finished && i < 50; SDL_Delay(100), i++) {
+        finished = true;
+        for (unsigned j = 2; j < TEST_SERVER_MAX_PEERS; j++)
+            if (!conversationSetUpResults[j]) finished = false;
+    }
+
+    for (unsigned i = 2; i < TEST_SERVER_MAX_PEERS; i++)
+        assert(conversationSetUpResults[i] == (i == TEST_SERVER_DENYING_PEER ? -1 : 1));
+
+    testServer_mute(false); // the invite gets no reply, so the setup expires
+    SDL_Delay(200); // the server may be waiting for the socket, it notices that it's muted afterwards
+    conversationSetUpResults[2] = 0;
+    assert(netCreateConversation(connection, 2));
+
+    clockShift = 60000; // past the timeout
+    const unsigned long shifted = SDL_GetTicks64();
+    for (unsigned i = 0; !conversationSetUpResults[2] && i < 100; SDL_Delay(10), i++);
+    assert(conversationSetUpResults[2] == -1 && SDL_GetTicks64() - shifted < 500); // as soon as the deadline has passed
+
+    netClean(connection);
+    testServer_stop();
+    clockShift = 0; // the time mustn't go backwards while the connection exists
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+static const unsigned testFileSize = 1 << 18; // 256 kB, spans many chunks, so the transfers overlap
+static atomic unsigned fileTransferPeers[3] = {0}; // indexed by transfer ids
+static atomic int fileTransferResults[3] = {0}; // 1 - sent, -1 - failed
+
+static unsigned nextFileChunkSupplier(unsigned transferId, unsigned index, byte* buffer, unsigned bufferSize, bool compressed) {
+    assert(transferId && transferId < 3 && bufferSize >= NET_MAX_MESSAGE_BODY_SIZE - 4);
+    assert(compressed == (fileTransferPeers[transferId] == 3)); // the stand-in peer agrees to the compression proposed for the second file only
+    const unsigned offset = index * bufferSize;
+    if (offset >= testFileSize) return 0;
+
+    const unsigned size = min(bufferSize, testFileSize - offset);
+    SDL_memset(buffer, (int) fileTransferPeers[transferId], size);
+    return size;
+}
+
+static void onFileExchangeFinished(unsigned transferId, bool successful) {
+    assert(transferId && transferId < 3 && !fileTransferResults[transferId]);
+    fileTransferResults[transferId] = successful ? 1 : -1;
+}
+
+void testNet_fileTransfers(const Transport* nullable transport) {
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = transport == &TRANSPORT_NATIVE ? 8094 : transport == &TRANSPORT_MEMORY ? 8095 : 8085;
+    testServer_start(port, 1 << 12, false, transport == &TRANSPORT_MEMORY);
+    if (transport == &TRANSPORT_NATIVE) transportNativeSetBufferSizes(1 << 16, 1 << 16);
+
+    for (unsigned i = 0; i < 3; i++) {
+        fileTransferPeers[i] = 0;
+        fileTransferResults[i] = 0;
+    }
+
+    connectAndLogIn(port, transport, (Callbacks) {.nextFileChunkSupplier = &nextFileChunkSupplier, .onFileExchangeFinished = &onFileExchangeFinished});
+
+    byte hash[CRYPTO_HASH_SIZE];
+    SDL_memset(hash, 0, sizeof hash);
+
+    for (unsigned peer = 2; peer < 4; peer++) { // both files are being sent at once to different users
+        const unsigned transferId = netNextFileTransferId(connection);
+        assert(transferId && transferId < 3);
+        fileTransferPeers[transferId] = peer;
+        assert(netBeginFileExchange(connection, transferId, peer, testFileSize, hash, "file", 4, peer == 3));
+    }
+
+    const unsigned long started = SDL_GetTicks64();
+    for (unsigned i = 0; !(fileTransferResults[1] && fileTransferResults[2]) && i < 500; SDL_Delay(10), i++);
+    assert(fileTransferResults[1] == 1 && fileTransferResults[2] == 1);
+    assert(SDL_GetTicks64() - started < 5000); // the transfers end explicitly, nobody waits for the 15 seconds inactivity timeout
+
+    assert(testServer_fileBytesReceived(2) == testFileSize && testServer_fileBytesReceived(3) == testFileSize); // the last acknowledgements have been sent after everything has been received
+
+    netClean(connection);
+    testServer_stop();
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+static atomic unsigned fetchedMessages[TEST_SERVER_MAX_PEERS] = {0}, fetchedFrames = 0, finishedFetches = 0; // fetched messages are counted per conversation
+
+static void checkFetchedMessage(unsigned from, unsigned size, const byte* message) {
+    assert(from >= 2 && from < TEST_SERVER_MAX_PEERS);
+    const unsigned index = fetchedMessages[from]++; // each conversation's messages arrive in order even if the fetches overlap
+
+    assert(index < TEST_SERVER_STORED_MESSAGES && size == index % 32 + 1);
+    for (unsigned i = 0; i < size; i++) assert(message[i] == (byte) index);
+}
+
+static void onNextMessageFetched(unsigned from, unsigned long, unsigned size, const byte* nullable message, bool last) {
+    assert(message);
+    checkFetchedMessage(from, size, message);
+    fetchedFrames++;
+    if (last) finishedFetches++;
+}
+
+static void onMessagesBatchFetched(unsigned conversation, const NetFetchedMessage* messages, unsigned count, bool last) {
+    assert(conversation >= 2 && conversation < TEST_SERVER_MAX_PEERS && count);
+
+    for (unsigned i = 0; i < count; i++) {
+        assert(messages[i].from == conversation && messages[i].timestamp == fetchedMessages[conversation] + 1);
+        checkFetchedMessage(messages[i].from, messages[i].size, messages[i].message);
+    }
+
+    fetchedFrames++;
+    if (last) finishedFetches++;
+}
+
+void testNet_batchedFetch(bool batched) {
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = 8086 + batched;
+    testServer_start(port, batched ? 1 << 12 : 0, false, false); // an older server sends a frame per message
+
+    fetchedFrames = finishedFetches = 0;
+    for (unsigned i = 0; i < TEST_SERVER_MAX_PEERS; fetchedMessages[i++] = 0);
+
+    connectAndLogIn(port, NULL, (Callbacks) {.onNextMessageFetched = &onNextMessageFetched, .onMessagesBatchFetched = &onMessagesBatchFetched});
+
+    const unsigned conversations = TEST_SERVER_MAX_PEERS - 2;
+    for (unsigned i = 2; i < TEST_SERVER_MAX_PEERS; netFetchMessages(connection, i++, 0)); // all at once, without waiting for the previous ones to finish
+    for (unsigned i = 0; finishedFetches < conversations && i < 50; SDL_Delay(100), i++);
+
+    assert(finishedFetches == conversations);
+    for (unsigned i = 2; i < TEST_SERVER_MAX_PEERS; i++) assert(fetchedMessages[i] == TEST_SERVER_STORED_MESSAGES);
+    assert(batched ? fetchedFrames < conversations * TEST_SERVER_STORED_MESSAGES / 10 : fetchedFrames == conversations * TEST_SERVER_STORED_MESSAGES); // the whole history fits into a few frames
+
+    netClean(connection);
+    testServer_stop();
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+static atomic int presences[TEST_SERVER_MAX_PEERS] = {0}; // 1 - connected, -1 - disconnected
+static atomic unsigned presenceChanges = 0;
+
+static void onPresenceChanged(unsigned id, bool connected) {
+    assert(id < TEST_SERVER_MAX_PEERS);
+    presences[id] = connected ? 1 : -1;
+    presenceChanges++;
+}
+
+void testNet_presence(bool pushed) {
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = 8088 + pushed;
+    testServer_start(port, pushed ? 1 << 12 : 0, false, false); // an older server doesn't push the presence
+
+    presenceChanges = 0;
+    for (unsigned i = 0; i < TEST_SERVER_MAX_PEERS; presences[i++] = 0);
+
+    connectAndLogIn(port, NULL, (Callbacks) {.onPresenceChanged = &onPresenceChanged});
+    assert(netPresencePushed(connection) == pushed);
+
+    const unsigned expectedChanges = pushed ? TEST_SERVER_MAX_PEERS - 2 : 0;
+    for (unsigned i = 0; presenceChanges < expectedChanges && i < 50; SDL_Delay(100), i++);
+    SDL_Delay(100); // nothing more arrives
+
+    assert(presenceChanges == expectedChanges);
+    for (unsigned i = 2; i < TEST_SERVER_MAX_PEERS; i++)
+        assert(presences[i] == (pushed ? (i % 2 ? 1 : -1) : 0));
+
+    netClean(connection);
+    testServer_stop();
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+static atomic bool disconnected = false;
+
+static void onDisconnectedNoted(void) { disconnected = true; }
+
+static atomic bool sendsFail = false;
+
+static bool failingSend(void* xConnection, const byte* bytes, unsigned size)
+{ return !sendsFail && (*(TRANSPORT_SDL.send))(xConnection, bytes, size); }
+
+void testNet_heartbeat(bool echoed, bool midFrame) {
+    assert(echoed || !midFrame);
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = midFrame ? 8097 : 8092 + echoed; // 8090 is left unused for testNet_connectionFailure
+    testServer_start(port, echoed ? 1 << 12 : 0, false, false); // an older server doesn't echo pings
+
+    Transport transport = TRANSPORT_SDL; // which can be told to fail sending
+    transport.send = &failingSend;
+
+    disconnected = sendsFail = false;
+    connectToServer(port, &transport, (Callbacks) {.onDisconnected = &onDisconnectedNoted});
+
+    const unsigned timeout = 400; // a ping per 100 milliseconds
+    netSetHeartbeatTimeout(connection, timeout);
+    SDL_Delay(timeout * 2);
+
+    NetLinkStats stats;
+    netLinkStats(connection, &stats);
+    assert(stats.connectedMillis >= timeout * 2);
+    assert(echoed ? stats.rttSamples >= 3 : !stats.rttSamples);
+    assert(stats.framesSent >= 1 + stats.rttSamples && stats.framesReceived >= stats.rttSamples && stats.bytesSent && stats.bytesReceived); // the negotiation & the pings
+    assert(stats.smoothedRtt < timeout && stats.rttVariation < timeout); // the loopback
+
+    testServer_mute(midFrame); // the listening thread doesn't wait for the rest of the frame without checking the deadlines
+    const unsigned long muted = SDL_GetTicks64();
+    for (unsigned i = 0; !disconnected && i < 20; SDL_Delay(50), i++);
+
+    if (echoed) // the dead connection is noticed long before the OS gives up on it
+        assert(disconnected && SDL_GetTicks64() - muted < timeout * 3);
+    else { // silence is normal for connections to older servers, but a failed send isn't
+        assert(!disconnected);
+
+        sendsFail = true;
+        const unsigned long failed = SDL_GetTicks64();
+        const byte body[] = {1};
+        assert(!netSend(connection, NET_FLAG_PROCEED, body, sizeof body, 2)); // no pings go to older servers, so a message is sent instead
+        for (unsigned i = 0; !disconnected && i < 20; SDL_Delay(50), i++);
+        assert(disconnected && SDL_GetTicks64() - failed < timeout);
+    }
+
+    assert(connection); // it's up to the owner to clean it up
+    netClean(connection);
+    assert(!connection);
+    testServer_stop();
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+enum { SESSIONS = 16, SESSIONS_WAVE = 4, SESSION_MESSAGES = 10 }; // the stand-in server listens with SDL_net's backlog of 5, so the sessions connect in waves
+static NetConnection* atomic sessions[SESSIONS] = {0};
+static atomic unsigned sessionsConnected = 0, sessionsLoggedIn = 0, sessionsEchoed = 0;
+
+static unsigned currentSession(void) { // the callbacks are shared by the sessions, so they're told apart by the connection which calls them
+    NetConnection* current = netCurrentConnection();
+    unsigned session = 0;
+    for (; session < SESSIONS && sessions[session] != current; session++);
+
+    assert(current && session < SESSIONS);
+    return session;
+}
+
+static void onSessionConnected(bool successful) {
+    assert(successful);
+    currentSession();
+    sessionsConnected++;
+}
+
+static void onSessionLogInResult(bool successful) {
+    assert(successful);
+    currentSession();
+    sessionsLoggedIn++;
+}
+
+static void onSessionBroadcastMessageReceived(const byte* text, unsigned size) { // the server echoes each session's broadcast back to it
+    assert(size == 1 && text[0] == (byte) currentSession());
+    sessionsEchoed++;
+}
+
+void testNet_sessions(void) {
+    const int allocations = SDL_GetNumAllocations();
+    SDLNet_Init();
+
+    const unsigned port = 8096;
+    testServer_start(port, 1 << 12, true, false);
+
+    sessionsConnected = sessionsLoggedIn = sessionsEchoed = 0;
+    for (unsigned i = 0; i < SESSIONS; i++) {
+        assert(netInit(
+            &(sessions[i]),
+            "127.0.0.1", port, NULL,
+            testServer_signPublicKey(), CRYPTO_KEY_SIZE,
+            &onMessageReceived,
+            &onSessionLogInResult,
+            &onErrorReceived,
+            NULL,
+            &onDisconnected,
+            &currentTimeMillis,
+            NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+            &onSessionBroadcastMessageReceived,
+            &onSessionConnected,
+            NULL
+        ));
+
+        if ((i + 1) % SESSIONS_WAVE) continue;
+        for (unsigned j = 0; sessionsConnected <= i && j < 500; SDL_Delay(10), j++);
+        assert(sessionsConnected == i + 1);
+    }
+
+    char username[NET_USERNAME_SIZE], password[NET_UNHASHED_PASSWORD_SIZE];
+    SDL_memset(username, 'u', sizeof username);
+    SDL_memset(password, 'p', sizeof password);
+
+    for (unsigned i = 0; i < SESSIONS; netLogIn(sessions[i++], username, password));
+    for (unsigned i = 0; sessionsLoggedIn < SESSIONS && i < 50; SDL_Delay(100), i++);
+    assert(sessionsLoggedIn == SESSIONS);
+
+    for (unsigned i = 0; i < SESSIONS; i++) { // each session keeps its own negotiated limits & encryption streams
+        assert(netMaxMessageBodySize(sessions[i]) > NET_MAX_MESSAGE_BODY_SIZE);
+
+        const byte text = (byte) i;
+        netSendBroadcast(sessions[i], &text, 1);
+
+        const byte body[8] = {0};
+        for (unsigned j = 0; j < SESSION_MESSAGES; j++)
+            assert(netSend(sessions[i], NET_FLAG_PROCEED, body, sizeof body, 2));
+    }
+
+    for (unsigned i = 0; (sessionsEchoed < SESSIONS || testServer_messagesReceived(2) < SESSIONS * SESSION_MESSAGES) && i < 50; SDL_Delay(100), i++);
+    assert(sessionsEchoed == SESSIONS && testServer_messagesReceived(2) == SESSIONS * SESSION_MESSAGES);
+
+    for (unsigned i = 0; i < SESSIONS; i++) {
+        netClean(sessions[i]);
+        assert(!sessions[i]);
+    }
+    testServer_stop();
+
+    SDLNet_Quit();
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+void testNet_connectionFailure(void) {
+    const int allocations = SDL_GetNumAllocations();
+
+    connected = connectionFinished = false;
+    connectionStep = 0;
+
+    byte serverSignPublicKey[CRYPTO_KEY_SIZE];
+    SDL_memset(serverSignPublicKey, 0, sizeof serverSignPublicKey);
+
+    assert(netInit(
+        &connection,
+        "127.0.0.1", 8090, NULL, // nobody listens there
+        serverSignPublicKey, CRYPTO_KEY_SIZE,
+        &onMessageReceived,
+        &onLogInResult,
+        &onErrorReceived,
+        NULL,
+        &onDisconnected,
+        &currentTimeMillis,
+        NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+        &onBroadcastMessageReceived,
+        &onConnected,
+        &onConnectionProgress
+    ));
+
+    waitFor(&connectionFinished);
+    assert(connectionFinished && !connected && !connectionStep);
+
+    assert(connection); // the connection waits for its owner to clean it up
+    netClean(connection);
+    assert(!connection && allocations == SDL_GetNumAllocations());
+}
+
+void testNet_packMessageCompact(bool first) {
+    const int allocations = SDL_GetNumAllocations();
+
+    const int size = 3;
+    byte body[size];
+    SDL_memset(body, 8, sizeof body);
+
+    ExposedTestNet_Message msg = {
+        0x7fffffff, 0x0123456789ab, size,
+        first ? 0 : 300, first ? 1 : 1000,
+        1, 0x7ffffffe,
+        {0}, body
+    };
+
+    unsigned packedSize = 0;
+    byte* packed = exposedTestNet_packMessageCompact(&msg, &packedSize);
+    assert(packed);
+    assert(packedSize == 6 + 5 + 1 + (first ? 1 : 2 + 2) + 1 + 5 + size); // index & count are omitted when there's only one part, the token is always omitted
+    assert(packedSize < 96 + size);
+
+    ExposedTestNet_Message* unpacked = exposedTestNet_unpackMessageCompact(packed, packedSize);
+    SDL_free(packed);
+
+    assert(unpacked->flag == msg.flag);
+    assert(unpacked->timestamp == msg.timestamp);
+    assert(unpacked->size == msg.size);
+    assert(unpacked->index == msg.index);
+    assert(unpacked->count == msg.count);
+    assert(unpacked->from == msg.from);
+    assert(unpacked->to == msg.to);
+    assert(!SDL_memcmp(unpacked->token, (byte[sizeof msg.token]) {0}, sizeof msg.token));
+    assert(!SDL_memcmp(unpacked->body, body, size));
+
+    SDL_free(unpacked->body);
+    SDL_free(unpacked);
+
+    assert(allocations == SDL_GetNumAllocations());
+    first ? testNet_packMessageCompact(false) : STUB;
+}
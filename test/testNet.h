@@ -19,6 +19,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include "../src/transport.h"
 
 void testNet_basic(void);
 
@@ -26,3 +27,13 @@ void testNet_packMessage(bool first);
 void testNet_unpackMessage(bool first);
 
 void testNet_unpackUserInfo(void);
+
+void testNet_negotiation(bool extended, bool compact);
+void testNet_connectionFailure(void);
+void testNet_conversationSetups(void);
+void testNet_fileTransfers(const Transport* nullable transport); // null for TRANSPORT_SDL, the stand-in server is reached in memory if it is TRANSPORT_MEMORY
+void testNet_batchedFetch(bool batched);
+void testNet_presence(bool pushed);
+void testNet_heartbeat(bool echoed, bool midFrame);
+void testNet_sessions(void); // several connections in one process
+void testNet_packMessageCompact(bool first);
@@ -0,0 +1,575 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <SDL.h>
+#include <SDL_net.h>
+#include <stdatomic.h>
+#include "../src/crypto.h"
+#include "../src/net.h"
+#include "../src/transport.h"
+#include "testServer.h"
+
+enum { // mirrors the protocol's ones
+    FLAG_PROCEED = 0x00000000,
+    FLAG_LOG_IN = 0x00000004,
+    FLAG_LOGGED_IN = 0x00000005,
+    FLAG_ERROR = 0x00000009,
+    FLAG_FETCH_USERS = 0x0000000c,
+    FLAG_FETCH_MESSAGES = 0x0000000d,
+    FLAG_PRESENCE = 0x0000000e,
+    FLAG_PING = 0x0000000f,
+    FLAG_NEGOTIATE = 0x00000010,
+    FLAG_EXCHANGE_KEYS = 0x000000a0,
+    FLAG_EXCHANGE_KEYS_DONE = 0x000000b0,
+    FLAG_EXCHANGE_HEADERS = 0x000000c0,
+    FLAG_EXCHANGE_HEADERS_DONE = 0x000000d0,
+    FLAG_FILE_ASK = 0x000000e0,
+    FLAG_FILE = 0x000000f0,
+    FLAG_BROADCAST = 0x10000000
+};
+
+enum {
+    INT_SIZE = 4,
+    MESSAGE_HEAD_SIZE = 96,
+    MAX_MESSAGE_SIZE = 256,
+    TOKEN_SIZE = 64,
+    TOKEN_UNSIGNED_VALUE_SIZE = 8,
+    FROM_SERVER = 0x7fffffff,
+    FEATURE_COMPACT_HEADER = 1 << 0,
+    FEATURE_BATCHED_FETCH = 1 << 1,
+    FEATURE_PRESENCE = 1 << 2,
+    FEATURE_HEARTBEAT = 1 << 3,
+    POLL_TIMEOUT = 100,
+    INVITE_ASK = 1,
+    INVITE_DENY = 2,
+    FILE_INVITE_SIZE = 160,
+    FILE_INVITE_EXTENSION_SIZE = 16,
+    FETCH_MODE_BATCHED = 2,
+    FETCH_REQUEST_SIZE = 1 + 8 + INT_SIZE,
+    FETCHED_RECORD_HEAD_SIZE = 8 + INT_SIZE * 2,
+    USERNAME_SIZE = 16,
+    USER_INFO_SIZE = INT_SIZE + 1 + USERNAME_SIZE
+};
+
+STATIC_CONST_UNSIGNED COMPACT_FRAME_BIT = 1u << 31; // these don't fit in the enum's int
+STATIC_CONST_UNSIGNED FILE_ACK_MAGIC = 0x80414b00;
+STATIC_CONST_UNSIGNED FILE_COMPRESSION_BIT = 1u << 31;
+
+typedef struct {
+    void* socket;
+    CryptoCoderStreams* nullable coderStreams; // null once the client has disconnected
+    SDL_mutex* sendMutex; // messages from the other clients are relayed by their threads, so they send to this client along with its own one
+    atomic unsigned id; // 0 until logged in
+    unsigned agreedFeatures; // each client negotiates its own
+} Client;
+
+static SDL_Thread* thread = NULL;
+static unsigned port = 0, maxMessageSize = 0, features = 0;
+static Client clients[TEST_SERVER_MAX_CLIENTS] = {0};
+static atomic unsigned loggedInClients = 0; // the next client's id is TEST_SERVER_FIRST_CLIENT_ID plus this
+static const Transport* transport = &TRANSPORT_SDL; // the client is served through the same interface the net module uses
+static void* nullable memoryServerEnd = NULL; // listened to before the thread starts if the client connects in memory
+static byte signPublicKey[32] = {0}, signSecretKey[EXPOSED_TEST_CRYPTO_SIGN_SECRET_KEY_SIZE] = {0};
+static atomic bool running = false;
+static atomic bool muted = false;
+static atomic bool mutedMidFrame = false; // the client thread sends an incomplete frame once it notices that the server is muted, for the tests with a single client
+static atomic unsigned drops = 0; // the client threads disconnect their clients once this changes, the clients that connect later are served as usual
+static CryptoKeys* nullable peerKeys[TEST_SERVER_MAX_PEERS] = {0}; // stand-in users with these ids, the client sets up conversations with
+static CryptoCoderStreams* nullable peerCoderStreams[TEST_SERVER_MAX_PEERS] = {0};
+static unsigned peerFileStreams[TEST_SERVER_MAX_PEERS] = {0}; // stream ids of the files being sent to the stand-in peers
+static unsigned peerFileWindows[TEST_SERVER_MAX_PEERS] = {0};
+static bool peerFileCompressed[TEST_SERVER_MAX_PEERS] = {0};
+static unsigned peerFileChunks[TEST_SERVER_MAX_PEERS] = {0}, peerFileAckedChunks[TEST_SERVER_MAX_PEERS] = {0};
+static atomic unsigned peerFileBytes[TEST_SERVER_MAX_PEERS] = {0};
+static atomic unsigned peerMessages[TEST_SERVER_MAX_PEERS] = {0};
+
+static bool recvAll(void* client, void* buffer, unsigned size) { // large frames arrive in several parts
+    for (unsigned received = 0, count; received < size; received += count)
+        if ((int) (count = (unsigned) (*(transport->receive))(client, (byte*) buffer + received, size - received)) <= 0) return false;
+    return true;
+}
+
+static bool sendAll(void* client, const void* buffer, unsigned size)
+{ return (*(transport->send))(client, buffer, size); }
+
+static CryptoCoderStreams* nullable handshake(void* client) { // the server side of the net module's initiateSecuredConnection
+    CryptoKeys* keys = cryptoKeysInit();
+    CryptoCoderStreams* coderStreams = cryptoCoderStreamsInit();
+
+    byte* signedPublicKey = exposedTestCrypto_sign(cryptoGenerateKeyPairAsServer(keys), CRYPTO_KEY_SIZE, signSecretKey);
+    const bool publicKeySent = sendAll(client, signedPublicKey, CRYPTO_SIGNATURE_SIZE + CRYPTO_KEY_SIZE);
+    SDL_free(signedPublicKey);
+
+    byte clientPublicKey[CRYPTO_KEY_SIZE];
+    const bool keysExchanged = publicKeySent
+        && recvAll(client, clientPublicKey, CRYPTO_KEY_SIZE)
+        && cryptoExchangeKeysAsServer(keys, clientPublicKey);
+
+    bool succeeded = false;
+    if (keysExchanged) {
+        byte* serverCoderHeader = cryptoCreateEncoderAsServer(keys, coderStreams);
+        assert(serverCoderHeader);
+        byte* encryptedServerCoderHeader = cryptoEncryptSingle(cryptoServerKey(keys), serverCoderHeader, CRYPTO_HEADER_SIZE);
+        assert(encryptedServerCoderHeader);
+        SDL_free(serverCoderHeader);
+
+        const unsigned encryptedCoderHeaderSize = cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE);
+        const bool headerSent = sendAll(client, encryptedServerCoderHeader, encryptedCoderHeaderSize);
+        SDL_free(encryptedServerCoderHeader);
+
+        byte encryptedClientCoderHeader[encryptedCoderHeaderSize];
+        if (headerSent && recvAll(client, encryptedClientCoderHeader, encryptedCoderHeaderSize)) {
+            byte* clientCoderHeader = cryptoDecryptSingle(cryptoClientKey(keys), encryptedClientCoderHeader, encryptedCoderHeaderSize);
+            succeeded = clientCoderHeader && cryptoCreateDecoderStreamAsServer(keys, coderStreams, clientCoderHeader);
+            SDL_free(clientCoderHeader);
+        }
+    }
+
+    cryptoKeysDestroy(keys);
+    if (succeeded) return coderStreams;
+
+    cryptoCoderStreamsDestroy(coderStreams);
+    return NULL;
+}
+
+static void sendMessagePart(Client* client, int flag, const byte* nullable body, unsigned size, unsigned index, unsigned count, unsigned from, unsigned to) {
+    ExposedTestNet_Message message = {flag, SDL_GetTicks64(), size, index, count, from, to, {0}, (byte*) body};
+
+    byte tokenUnsignedValue[TOKEN_UNSIGNED_VALUE_SIZE];
+    SDL_memset(tokenUnsignedValue, (1 << 8) - 1, TOKEN_UNSIGNED_VALUE_SIZE);
+    byte* signedToken = exposedTestCrypto_sign(tokenUnsignedValue, TOKEN_UNSIGNED_VALUE_SIZE, signSecretKey);
+    SDL_memcpy(message.token, signedToken, TOKEN_SIZE); // the signature
+    SDL_free(signedToken);
+
+    const bool compact = client->agreedFeatures & FEATURE_COMPACT_HEADER;
+    unsigned packedSize = MESSAGE_HEAD_SIZE + size;
+    byte* packed = compact ? exposedTestNet_packMessageCompact(&message, &packedSize) : exposedTestNet_packMessage(&message);
+
+    const unsigned encryptedSize = cryptoEncryptedSize(packedSize);
+    byte frame[INT_SIZE + encryptedSize];
+    *(unsigned*) frame = compact ? encryptedSize | COMPACT_FRAME_BIT : encryptedSize;
+
+    SDL_LockMutex(client->sendMutex); // frames must be sent in the same order they're encrypted
+    if (client->coderStreams) { // a relayed message may come after the client has disconnected
+        byte* encrypted = cryptoEncrypt(client->coderStreams, packed, packedSize, true);
+        assert(encrypted);
+        SDL_memcpy(frame + INT_SIZE, encrypted, encryptedSize);
+        SDL_free(encrypted);
+
+        sendAll(client->socket, frame, INT_SIZE + encryptedSize); // the client may have already disconnected
+    }
+    SDL_UnlockMutex(client->sendMutex);
+    SDL_free(packed);
+}
+
+static void sendMessage(Client* client, int flag, const byte* nullable body, unsigned size, unsigned from, unsigned to)
+{ sendMessagePart(client, flag, body, size, 0, 1, from, to); }
+
+static ExposedTestNet_Message* nullable receiveMessage(Client* client) {
+    unsigned size = 0;
+    if (!recvAll(client->socket, &size, INT_SIZE)) return NULL;
+
+    const bool compact = size & COMPACT_FRAME_BIT;
+    size &= ~COMPACT_FRAME_BIT;
+    assert(!compact || client->agreedFeatures & FEATURE_COMPACT_HEADER);
+    assert(size && size <= cryptoEncryptedSize(maxMessageSize ? maxMessageSize : MAX_MESSAGE_SIZE));
+
+    byte buffer[size];
+    if (!recvAll(client->socket, buffer, size)) return NULL;
+
+    byte* decrypted = cryptoDecrypt(client->coderStreams, buffer, size, true);
+    assert(decrypted);
+    ExposedTestNet_Message* message = compact
+        ? exposedTestNet_unpackMessageCompact(decrypted, size - cryptoEncryptedSize(0))
+        : exposedTestNet_unpackMessage(decrypted);
+    SDL_free(decrypted);
+    return message;
+}
+
+static void processConversationSetUpMessage(Client* client, const ExposedTestNet_Message* message) { // a stand-in peer behaves like the invited user does in the net module
+    const unsigned peer = message->to, encryptedHeaderSize = cryptoSingleEncryptedSize(CRYPTO_HEADER_SIZE);
+    assert(peer < TEST_SERVER_MAX_PEERS && message->body);
+
+    switch (message->flag) {
+        case FLAG_EXCHANGE_KEYS: {
+            assert(message->size == INVITE_ASK && !peerKeys[peer]);
+
+            if (peer == TEST_SERVER_DENYING_PEER) {
+                const byte denial[INVITE_DENY] = {0};
+                sendMessage(client, FLAG_EXCHANGE_KEYS, denial, INVITE_DENY, peer, message->from);
+                break;
+            }
+
+            peerKeys[peer] = cryptoKeysInit();
+            sendMessage(client, FLAG_EXCHANGE_KEYS, cryptoGenerateKeyPairAsServer(peerKeys[peer]), CRYPTO_KEY_SIZE, peer, message->from);
+        } break;
+        case FLAG_EXCHANGE_KEYS_DONE: {
+            assert(message->size == CRYPTO_KEY_SIZE && peerKeys[peer]);
+            assert(cryptoExchangeKeysAsServer(peerKeys[peer], message->body));
+
+            peerCoderStreams[peer] = cryptoCoderStreamsInit();
+            byte* header = cryptoCreateEncoderAsServer(peerKeys[peer], peerCoderStreams[peer]);
+            assert(header);
+            byte* encryptedHeader = cryptoEncryptSingle(cryptoServerKey(peerKeys[peer]), header, CRYPTO_HEADER_SIZE);
+            assert(encryptedHeader);
+            SDL_free(header);
+
+            sendMessage(client, FLAG_EXCHANGE_HEADERS, encryptedHeader, encryptedHeaderSize, peer, message->from);
+            SDL_free(encryptedHeader);
+        } break;
+        case FLAG_EXCHANGE_HEADERS_DONE: {
+            assert(message->size == encryptedHeaderSize && peerKeys[peer] && peerCoderStreams[peer]);
+
+            byte* header = cryptoDecryptSingle(cryptoClientKey(peerKeys[peer]), message->body, encryptedHeaderSize);
+            assert(header);
+            assert(cryptoCreateDecoderStreamAsServer(peerKeys[peer], peerCoderStreams[peer], header));
+            SDL_free(header);
+
+            cryptoKeysDestroy(peerKeys[peer]);
+            peerKeys[peer] = NULL;
+        } break;
+        default:
+            assert(false);
+    }
+}
+
+static void processFileExchangeMessage(Client* client, const ExposedTestNet_Message* message) { // a stand-in peer accepts every file, counts its bytes & acknowledges its chunks
+    const unsigned peer = message->to;
+    assert(peer < TEST_SERVER_MAX_PEERS && message->body);
+
+    if (message->flag == FLAG_FILE_ASK) {
+        assert(message->size == FILE_INVITE_SIZE && !peerFileStreams[peer]);
+
+        const byte* extension = message->body + FILE_INVITE_SIZE - FILE_INVITE_EXTENSION_SIZE;
+        peerFileStreams[peer] = *(unsigned*) (extension + INT_SIZE * 2);
+        const unsigned window = *(unsigned*) (extension + INT_SIZE * 3);
+        peerFileWindows[peer] = window & ~FILE_COMPRESSION_BIT;
+        peerFileCompressed[peer] = (window & FILE_COMPRESSION_BIT) != 0;
+        assert(peerFileStreams[peer] && peerFileWindows[peer] >= 4);
+        peerFileBytes[peer] = peerFileChunks[peer] = peerFileAckedChunks[peer] = 0;
+
+        const unsigned maxBodySize = (maxMessageSize ? maxMessageSize : MAX_MESSAGE_SIZE) - MESSAGE_HEAD_SIZE;
+        const unsigned reply[4] = {*(unsigned*) message->body, min(*(unsigned*) (extension + INT_SIZE), maxBodySize), peerFileStreams[peer], window}; // agrees to the compression if it's proposed
+        sendMessage(client, FLAG_FILE_ASK, (const byte*) reply, sizeof reply, peer, message->from);
+        return;
+    }
+
+    assert(message->size >= INT_SIZE && *(unsigned*) message->body == peerFileStreams[peer]); // every chunk carries the stream id
+    const bool ended = message->size == INT_SIZE; // the stream id alone
+
+    if (!ended) {
+        peerFileChunks[peer]++;
+        peerFileBytes[peer] += message->size - INT_SIZE;
+        assert(peerFileChunks[peer] <= peerFileAckedChunks[peer] + peerFileWindows[peer]); // the sender doesn't get ahead of its window
+    }
+
+    if (ended || peerFileChunks[peer] - peerFileAckedChunks[peer] == peerFileWindows[peer] / 4) {
+        const unsigned ack[3] = {FILE_ACK_MAGIC, peerFileStreams[peer], peerFileChunks[peer]};
+        sendMessage(client, FLAG_FILE_ASK, (const byte*) ack, sizeof ack, peer, message->from);
+        peerFileAckedChunks[peer] = peerFileChunks[peer];
+    }
+}
+
+static unsigned storedMessageSize(unsigned index) { return index % 32 + 1; }
+
+static void packStoredMessage(byte* buffer, unsigned index, unsigned peer) { // [timestamp][from][size][message]
+    *(unsigned long*) buffer = index + 1;
+    *(unsigned*) (buffer + 8) = peer;
+    *(unsigned*) (buffer + 8 + INT_SIZE) = storedMessageSize(index);
+    SDL_memset(buffer + FETCHED_RECORD_HEAD_SIZE, (int) index, storedMessageSize(index));
+}
+
+static void processFetchMessagesRequest(Client* client, const ExposedTestNet_Message* message) { // replies with the stand-in peer's stored messages which are newer than the requested timestamp
+    assert(message->size == FETCH_REQUEST_SIZE && message->body);
+
+    const unsigned long after = *(unsigned long*) (message->body + 1);
+    const unsigned peer = *(unsigned*) (message->body + 1 + 8);
+    assert(peer < TEST_SERVER_MAX_PEERS);
+
+    const unsigned first = (unsigned) min(after, (unsigned long) TEST_SERVER_STORED_MESSAGES), stored = TEST_SERVER_STORED_MESSAGES - first; // the message with index i has timestamp i + 1
+
+    if (*(message->body) != FETCH_MODE_BATCHED) { // a frame per message, or the request itself echoed back if there are none
+        assert(!(client->agreedFeatures & FEATURE_BATCHED_FETCH));
+
+        if (!stored) sendMessage(client, FLAG_FETCH_MESSAGES, message->body, message->size, FROM_SERVER, message->from);
+        for (unsigned i = 0; i < stored; i++) {
+            byte record[FETCHED_RECORD_HEAD_SIZE + storedMessageSize(first + i)];
+            packStoredMessage(record, first + i, peer);
+            sendMessagePart(client, FLAG_FETCH_MESSAGES, record + FETCHED_RECORD_HEAD_SIZE, storedMessageSize(first + i), i, stored, peer, message->from); // just the message, the sender is in the head
+        }
+        return;
+    }
+    assert(client->agreedFeatures & FEATURE_BATCHED_FETCH);
+
+    const unsigned maxBodySize = maxMessageSize - MESSAGE_HEAD_SIZE, frameHeadSize = 1 + INT_SIZE * 2;
+    unsigned frameFirsts[TEST_SERVER_STORED_MESSAGES + 1], frames = 0; // indexes of the first messages of each frame, the last one points past the end
+
+    frameFirsts[frames++] = first;
+    for (unsigned i = first, frameSize = frameHeadSize; i < TEST_SERVER_STORED_MESSAGES; i++) {
+        const unsigned recordSize = FETCHED_RECORD_HEAD_SIZE + storedMessageSize(i);
+        if (frameSize + recordSize > maxBodySize) {
+            frameFirsts[frames++] = i;
+            frameSize = frameHeadSize;
+        }
+        frameSize += recordSize;
+    }
+    frameFirsts[frames] = TEST_SERVER_STORED_MESSAGES;
+
+    byte body[maxBodySize];
+    for (unsigned frame = 0; frame < frames; frame++) { // an empty frame if there are no messages
+        body[0] = FETCH_MODE_BATCHED;
+        *(unsigned*) (body + 1) = peer;
+        *(unsigned*) (body + 1 + INT_SIZE) = frameFirsts[frame + 1] - frameFirsts[frame];
+
+        unsigned size = frameHeadSize;
+        for (unsigned i = frameFirsts[frame]; i < frameFirsts[frame + 1]; i++) {
+            packStoredMessage(body + size, i, peer);
+            size += FETCHED_RECORD_HEAD_SIZE + storedMessageSize(i);
+        }
+        assert(size <= maxBodySize);
+
+        sendMessagePart(client, FLAG_FETCH_MESSAGES, body, size, frame, frames, FROM_SERVER, message->from);
+    }
+}
+
+static Client* nullable findClient(unsigned id) {
+    for (unsigned i = 0; i < TEST_SERVER_MAX_CLIENTS; i++)
+        if (clients[i].id == id) return &(clients[i]);
+    return NULL;
+}
+
+static void packUserInfo(byte* buffer, unsigned id, bool connected) { // [id][connected][name]
+    *(unsigned*) buffer = id;
+    buffer[INT_SIZE] = connected;
+    SDL_memset(buffer + INT_SIZE + 1, 0, USERNAME_SIZE);
+    SDL_snprintf((char*) buffer + INT_SIZE + 1, USERNAME_SIZE, id < TEST_SERVER_MAX_PEERS ? "peer%u" : "user%u", id);
+}
+
+static void processFetchUsersRequest(Client* client, const ExposedTestNet_Message* message) { // replies with the stand-in peers & the clients that have logged in, including the asking one, in as many parts as their infos need
+    byte infos[(TEST_SERVER_MAX_PEERS + TEST_SERVER_MAX_CLIENTS) * USER_INFO_SIZE];
+    unsigned count = 0;
+
+    for (unsigned peer = 2; peer < TEST_SERVER_MAX_PEERS; peer++)
+        packUserInfo(infos + count++ * USER_INFO_SIZE, peer, peer % 2); // as in the presence push
+    for (unsigned i = 0; i < TEST_SERVER_MAX_CLIENTS; i++) {
+        if (!clients[i].id) continue;
+
+        SDL_LockMutex(clients[i].sendMutex);
+        packUserInfo(infos + count++ * USER_INFO_SIZE, clients[i].id, clients[i].coderStreams != NULL);
+        SDL_UnlockMutex(clients[i].sendMutex);
+    }
+
+    const unsigned perPart = ((maxMessageSize ? maxMessageSize : MAX_MESSAGE_SIZE) - MESSAGE_HEAD_SIZE) / USER_INFO_SIZE, parts = (count + perPart - 1) / perPart;
+    for (unsigned part = 0; part < parts; part++) {
+        const unsigned first = part * perPart, size = min(count - first, perPart) * USER_INFO_SIZE;
+        sendMessagePart(client, FLAG_FETCH_USERS, infos + first * USER_INFO_SIZE, size, part, parts, FROM_SERVER, message->from);
+    }
+}
+
+static void processMessage(Client* client, const ExposedTestNet_Message* message) {
+    if (message->to >= TEST_SERVER_FIRST_CLIENT_ID && message->to < TEST_SERVER_FIRST_CLIENT_ID + TEST_SERVER_MAX_CLIENTS) { // to another client, relayed as is whatever it is
+        Client* receiver = findClient(message->to);
+        if (receiver) sendMessagePart(receiver, message->flag, message->body, message->size, message->index, message->count, message->from, message->to);
+        return;
+    }
+
+    switch (message->flag) {
+        case FLAG_NEGOTIATE: {
+            assert(message->size == INT_SIZE * 2 && message->body);
+
+            if (!maxMessageSize) { // older servers reply with an error to unknown flags
+                const int flag = FLAG_NEGOTIATE;
+                sendMessage(client, FLAG_ERROR, (const byte*) &flag, INT_SIZE, FROM_SERVER, message->from);
+                break;
+            }
+
+            const unsigned reply[2] = {min(*(unsigned*) message->body, maxMessageSize), *(unsigned*) (message->body + INT_SIZE) & features};
+            sendMessage(client, FLAG_NEGOTIATE, (const byte*) reply, sizeof reply, FROM_SERVER, message->from); // the reply itself has the usual header
+            client->agreedFeatures = reply[1];
+        } break;
+        case FLAG_LOG_IN: {
+            byte token[TOKEN_SIZE];
+            SDL_memset(token, 1, TOKEN_SIZE);
+            client->id = TEST_SERVER_FIRST_CLIENT_ID + loggedInClients++;
+            sendMessage(client, FLAG_LOGGED_IN, token, TOKEN_SIZE, FROM_SERVER, client->id);
+
+            if (!(client->agreedFeatures & FEATURE_PRESENCE)) break;
+            byte presence[(TEST_SERVER_MAX_PEERS - 2) * (INT_SIZE + 1)]; // the stand-in peers with odd ids are connected
+            for (unsigned peer = 2, i = 0; peer < TEST_SERVER_MAX_PEERS; peer++, i += INT_SIZE + 1) {
+                *(unsigned*) (presence + i) = peer;
+                presence[i + INT_SIZE] = peer % 2;
+            }
+            sendMessage(client, FLAG_PRESENCE, presence, sizeof presence, FROM_SERVER, client->id);
+        } break;
+        case FLAG_EXCHANGE_KEYS: fallthrough
+        case FLAG_EXCHANGE_KEYS_DONE: fallthrough
+        case FLAG_EXCHANGE_HEADERS_DONE:
+            processConversationSetUpMessage(client, message);
+            break;
+        case FLAG_FILE_ASK: fallthrough
+        case FLAG_FILE:
+            processFileExchangeMessage(client, message);
+            break;
+        case FLAG_FETCH_USERS:
+            processFetchUsersRequest(client, message);
+            break;
+        case FLAG_FETCH_MESSAGES:
+            processFetchMessagesRequest(client, message);
+            break;
+        case FLAG_PING: // echoes it back as the pong
+            assert(client->agreedFeatures & FEATURE_HEARTBEAT && message->body && message->size == 8);
+            sendMessage(client, FLAG_PING, message->body, message->size, FROM_SERVER, message->from);
+            break;
+        case FLAG_PROCEED: // the stand-in peers just count the usual messages, which are encrypted with the conversations' keys
+            assert(message->to < TEST_SERVER_MAX_PEERS && message->body && message->size);
+            peerMessages[message->to]++;
+            break;
+        case FLAG_BROADCAST: // echoes it back
+            assert(message->body && message->size);
+            sendMessage(client, FLAG_BROADCAST, message->body, message->size, FROM_SERVER, message->from);
+            break;
+        default: // the rest is ignored
+            break;
+    }
+}
+
+static int clientThread(void* xClient) { // serves a single client until it disconnects or the server stops
+    Client* client = xClient;
+    const unsigned dropsBefore = drops;
+    client->coderStreams = handshake(client->socket); // nothing is relayed to it before it logs in
+
+    while (client->coderStreams && running && drops == dropsBefore) {
+        if (muted) { // the connection stays open, but nothing gets read or sent
+            if (mutedMidFrame) {
+                mutedMidFrame = false;
+                byte part[INT_SIZE + MAX_MESSAGE_SIZE / 2] = {0}; // the rest of the frame never comes
+                *(unsigned*) part = MAX_MESSAGE_SIZE * 4;
+
+                SDL_LockMutex(client->sendMutex);
+                sendAll(client->socket, part, sizeof part);
+                SDL_UnlockMutex(client->sendMutex);
+            }
+
+            SDL_Delay(POLL_TIMEOUT);
+            continue;
+        }
+        if (!(*(transport->ready))(client->socket, POLL_TIMEOUT)) continue;
+
+        ExposedTestNet_Message* message = receiveMessage(client);
+        if (!message) break; // disconnected
+
+        processMessage(client, message);
+        SDL_free(message->body);
+        SDL_free(message);
+    }
+
+    SDL_LockMutex(client->sendMutex); // waits for the messages being relayed to it
+    if (client->coderStreams) cryptoCoderStreamsDestroy(client->coderStreams);
+    client->coderStreams = NULL;
+    (*(transport->close))(client->socket);
+    SDL_UnlockMutex(client->sendMutex);
+    return 0;
+}
+
+static int serverThread(void*) {
+    if (memoryServerEnd) { // only one client can connect in memory
+        clients[0].socket = memoryServerEnd;
+        clientThread(&(clients[0]));
+    } else {
+        IPaddress address = {INADDR_ANY, SDL_Swap16(port)};
+        TCPsocket server = SDLNet_TCP_Open(&address);
+        assert(server);
+
+        SDL_Thread* clientThreads[TEST_SERVER_MAX_CLIENTS];
+        unsigned accepted = 0;
+
+        while (running) {
+            TCPsocket socket = SDLNet_TCP_Accept(server);
+            if (!socket) {
+                SDL_Delay(10);
+                continue;
+            }
+
+            assert(accepted < TEST_SERVER_MAX_CLIENTS);
+            clients[accepted].socket = exposedTestTransport_wrapSdlSocket(socket);
+            clientThreads[accepted] = SDL_CreateThread(&clientThread, "testServerClient", &(clients[accepted]));
+            assert(clientThreads[accepted++]);
+        }
+
+        for (unsigned i = 0; i < accepted; SDL_WaitThread(clientThreads[i++], NULL));
+        SDLNet_TCP_Close(server);
+    }
+
+    for (unsigned i = 0; i < TEST_SERVER_MAX_PEERS; i++) {
+        if (peerKeys[i]) cryptoKeysDestroy(peerKeys[i]);
+        if (peerCoderStreams[i]) cryptoCoderStreamsDestroy(peerCoderStreams[i]);
+        peerKeys[i] = NULL;
+        peerCoderStreams[i] = NULL;
+        peerFileStreams[i] = 0;
+    }
+    return 0;
+}
+
+void testServer_start(unsigned xPort, unsigned xMaxMessageSize, bool compactHeaders, bool inMemory) {
+    assert(!thread && (!xMaxMessageSize || xMaxMessageSize >= MAX_MESSAGE_SIZE) && (xMaxMessageSize || !compactHeaders));
+    port = xPort;
+    maxMessageSize = xMaxMessageSize;
+    features = (compactHeaders ? FEATURE_COMPACT_HEADER : 0) | (xMaxMessageSize ? FEATURE_BATCHED_FETCH | FEATURE_PRESENCE | FEATURE_HEARTBEAT : 0);
+    muted = mutedMidFrame = false;
+    for (unsigned i = 0; i < TEST_SERVER_MAX_PEERS; peerMessages[i++] = 0);
+    for (unsigned i = 0; i < TEST_SERVER_MAX_CLIENTS; i++) clients[i] = (Client) {NULL, NULL, SDL_CreateMutex(), 0, 0};
+    loggedInClients = 0;
+    exposedTestCrypto_makeSignKeys(signPublicKey, signSecretKey);
+    transport = inMemory ? &TRANSPORT_MEMORY : &TRANSPORT_SDL;
+    memoryServerEnd = inMemory ? transportMemoryListen(port) : NULL; // the client may connect as soon as this returns
+
+    running = true;
+    thread = SDL_CreateThread(&serverThread, "testServer", NULL);
+    assert(thread);
+    if (!inMemory) SDL_Delay(100); // lets it start listening
+}
+
+const byte* testServer_signPublicKey(void) { return signPublicKey; }
+
+unsigned testServer_fileBytesReceived(unsigned peer) {
+    assert(peer < TEST_SERVER_MAX_PEERS);
+    return peerFileBytes[peer];
+}
+
+unsigned testServer_messagesReceived(unsigned peer) {
+    assert(peer < TEST_SERVER_MAX_PEERS);
+    return peerMessages[peer];
+}
+
+void testServer_mute(bool midFrame) {
+    mutedMidFrame = midFrame;
+    muted = true;
+}
+
+void testServer_dropClients(void) { drops++; }
+
+unsigned testServer_loggedInClients(void) { return loggedInClients; }
+
+void testServer_stop(void) {
+    assert(thread);
+    running = false;
+    SDL_WaitThread(thread, NULL);
+    thread = NULL;
+    for (unsigned i = 0; i < TEST_SERVER_MAX_CLIENTS; SDL_DestroyMutex(clients[i++].sendMutex));
+}
@@ -0,0 +1,41 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "../src/defs.h"
+
+// A stand-in for the real server which serves clients on the loopback interface, each in its own thread, speaks just enough of the protocol to test the net module against it; the stand-in peers are shared by all the clients, which can also talk to each other; the users list consists of the stand-in peers, named peer<id>, & the clients that have logged in, named user<id>
+
+enum {
+    TEST_SERVER_MAX_CLIENTS = 32, // connected during the server's lifetime, a single one if it's reached in memory
+    TEST_SERVER_MAX_PEERS = 8, // messages to users with ids in [2, TEST_SERVER_MAX_PEERS) are handled by stand-in peers which accept conversation setup & file exchange invites, the latter ones with acknowledgements
+    TEST_SERVER_DENYING_PEER = 4, // except this one, which denies them
+    TEST_SERVER_FIRST_CLIENT_ID = 16, // the clients get ids from this one on in the order they log in, messages to them are relayed as is, whatever they are
+    TEST_SERVER_STORED_MESSAGES = 200 // messages the server has stored for the conversation with each stand-in peer, the one with index i has timestamp i + 1 & consists of (i % 32 + 1) bytes equal to i; they're sent in batches if the client & the server have agreed on that
+};
+
+void testServer_start(unsigned port, unsigned maxMessageSize, bool compactHeaders, bool inMemory); // inMemory - whether the client connects via TRANSPORT_MEMORY instead of the loopback interface; maxMessageSize - max size of messages (header included) the server agrees to, 0 to behave like an older server which doesn't support the negotiation; compactHeaders - whether the server supports them, requires the negotiation; batched messages fetching, the presence push (the stand-in peers with odd ids are connected) & echoing pings are supported along with the negotiation
+const byte* testServer_signPublicKey(void); // CRYPTO_KEY_SIZE-sized
+unsigned testServer_fileBytesReceived(unsigned peer); // by the stand-in peer from the file being sent to it, stream ids excluded
+unsigned testServer_messagesReceived(unsigned peer); // usual messages sent to the stand-in peer
+void testServer_mute(bool midFrame); // stops answering while keeping the connection open, as a dead link does; midFrame - the link dies in the middle of a large frame, only the beginning of which gets sent
+void testServer_dropClients(void); // disconnects the clients that are connected now, the server keeps listening, so they can reconnect
+unsigned testServer_loggedInClients(void); // times the clients have logged in, the one which has reconnected counts twice
+void testServer_stop(void); // disconnects the client if it's still connected
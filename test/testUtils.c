@@ -0,0 +1,93 @@
+/*
+ * Exchatge - a secured realtime message exchanger (desktop client).
+ * Copyright (C) 2023-2024  Vadim Nikolaev (https://github.com/vadniks)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <SDL.h>
+#include "../src/utils/lz.h"
+#include "testUtils.h"
+
+static void testUtils_lzFill(byte* buffer, unsigned size) { // text-like, repetitive yet not a single run
+    const char words[] = "lorem ipsum dolor sit amet consectetur adipiscing elit ";
+    for (unsigned i = 0, seed = 1; i < size; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buffer[i] = (seed >> 16) % 32 ? (byte) words[i % (sizeof words - 1)] : (byte) (seed >> 8);
+    }
+}
+
+void testUtils_lzRoundTrip(void) {
+    const int allocations = SDL_GetNumAllocations();
+    const unsigned size = 1 << 16;
+
+    byte* source = SDL_malloc(size);
+    byte* compressed = SDL_malloc(size * 2);
+    byte* decompressed = SDL_malloc(size);
+
+    testUtils_lzFill(source, size);
+
+    unsigned consumed = 0, compressedSize = lzCompress(source, size, compressed, size * 2, &consumed);
+    assert(consumed == size && compressedSize && compressedSize < size / 2);
+    assert(lzDecompress(compressed, compressedSize, decompressed, size) == size);
+    assert(!SDL_memcmp(source, decompressed, size));
+
+    SDL_memset(source, 'a', size); // a single run gets encoded as a few overlapping matches
+    compressedSize = lzCompress(source, size, compressed, size * 2, &consumed);
+    assert(consumed == size && compressedSize < 1024);
+    assert(lzDecompress(compressed, compressedSize, decompressed, size) == size);
+    assert(!SDL_memcmp(source, decompressed, size));
+
+    for (unsigned i = 0, seed = 7; i < size; i++) // noise doesn't compress but survives the round trip
+        source[i] = (byte) ((seed = seed * 1103515245u + 12345u) >> 16);
+    compressedSize = lzCompress(source, size, compressed, size * 2, &consumed);
+    assert(consumed == size && compressedSize >= size);
+    assert(lzDecompress(compressed, compressedSize, decompressed, size) == size);
+    assert(!SDL_memcmp(source, decompressed, size));
+
+    assert(!lzDecompress(compressed, compressedSize, decompressed, size - 1)); // doesn't fit
+    assert(!lzDecompress((const byte[]) {0x04, 0xff, 0xff}, 3, decompressed, size)); // refers to bytes before the beginning
+
+    SDL_free(source);
+    SDL_free(compressed);
+    SDL_free(decompressed);
+
+    assert(allocations == SDL_GetNumAllocations());
+}
+
+void testUtils_lzPartial(void) {
+    const int allocations = SDL_GetNumAllocations();
+    const unsigned size = 1 << 14;
+
+    byte* source = SDL_malloc(size);
+    byte* decompressed = SDL_malloc(size);
+    testUtils_lzFill(source, size);
+
+    for (unsigned destinationSize = 1; destinationSize < size / 8; destinationSize = destinationSize * 3 + 1) { // the destination is too small for the whole source, the compressed prefix is still valid
+        byte compressed[destinationSize];
+
+        unsigned consumed = 0;
+        const unsigned compressedSize = lzCompress(source, size, compressed, destinationSize, &consumed);
+        assert(compressedSize <= destinationSize && consumed < size);
+
+        assert(lzDecompress(compressed, compressedSize, decompressed, size) == consumed);
+        assert(!SDL_memcmp(source, decompressed, consumed));
+    }
+
+    SDL_free(source);
+    SDL_free(decompressed);
+
+    assert(allocations == SDL_GetNumAllocations());
+}